@@ -0,0 +1,193 @@
+/*
+Regression checks of the benchmark results against a baseline.
+
+A baseline is a results file in the JSON-lines format of results.h, e.g. saved by a run of the previous revision with `--save-baseline=`.
+`read_results` reads its samples back by variant, phase and role, and `compare_to_baseline` compares those of the current run to them and
+logs a table of the differences:
+
+- wall and CPU time, with Welch's t-test on the means of the runs: a change counts if the means differ by more than the threshold and the
+  difference is significant at the 95% level. With a single run on either side, only the threshold applies;
+- traffic and peak RSS, on their medians with the threshold alone, since they barely vary between runs.
+
+Throughput regresses with the wall time of the phases that evaluate or preprocess a fixed amount, and latency with that of the online evaluations.
+*/
+
+#pragma once
+
+#include "log.h"
+#include "stats.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+// Relative increase of a cost beyond which it regresses.
+struct RegressionThresholds
+{
+    double time;
+    double memory;
+    double bytes;
+};
+
+// Raw value of the field `name` of a JSON line, i.e. the text up to the next comma or brace, or a string without its quotes.
+inline bool json_field(const std::string &line, const std::string &name, std::string &value)
+{
+    size_t at = line.find("\"" + name + "\":");
+    if (at == std::string::npos)
+    {
+        return false;
+    }
+    at += name.size() + 3;
+
+    value.clear();
+    if (line[at] != '"')
+    {
+        value = line.substr(at, line.find_first_of(",}", at) - at);
+        return true;
+    }
+    for (size_t i = at + 1; i < line.size() && line[i] != '"'; i++)
+    {
+        if (line[i] == '\\' && i + 1 < line.size())
+        {
+            i++;
+        }
+        value += line[i];
+    }
+    return true;
+}
+
+// Samples of the JSON-lines results file at `path`, by variant, phase and role. Returns false if it cannot be read.
+inline bool read_results(const std::string &path, std::map<PhaseKey, std::vector<PhaseSample>> &results)
+{
+    std::ifstream in(path);
+    if (!in)
+    {
+        return false;
+    }
+
+    for (std::string line; std::getline(in, line);)
+    {
+        PhaseKey key;
+        std::string wall_ms, cpu_ms, bytes_sent, bytes_received, peak_rss_kb;
+        if (!json_field(line, "variant", key.variant) || !json_field(line, "phase", key.phase) || !json_field(line, "role", key.role) ||
+            !json_field(line, "wall_ms", wall_ms) || !json_field(line, "cpu_ms", cpu_ms) || !json_field(line, "bytes_sent", bytes_sent) ||
+            !json_field(line, "bytes_received", bytes_received) || !json_field(line, "peak_rss_kb", peak_rss_kb))
+        {
+            continue;
+        }
+
+        PhaseSample sample;
+        sample.wall_ms = std::strtod(wall_ms.c_str(), nullptr);
+        sample.cpu_ms = std::strtod(cpu_ms.c_str(), nullptr);
+        sample.bytes_sent = std::strtoull(bytes_sent.c_str(), nullptr, 10);
+        sample.bytes_received = std::strtoull(bytes_received.c_str(), nullptr, 10);
+        sample.memory.peak_rss_kb = std::strtoull(peak_rss_kb.c_str(), nullptr, 10);
+        results[key].push_back(sample);
+    }
+    return true;
+}
+
+// Whether the means of `before` and `after` differ significantly at the 95% level (Welch's t-test), or true if either has a single value.
+inline bool significant_change(const Summary &before, const Summary &after)
+{
+    if (before.count < 2 || after.count < 2)
+    {
+        return true;
+    }
+
+    double v1 = before.stddev * before.stddev / before.count;
+    double v2 = after.stddev * after.stddev / after.count;
+    if (v1 + v2 == 0)
+    {
+        return before.mean != after.mean;
+    }
+
+    double t = std::abs(after.mean - before.mean) / std::sqrt(v1 + v2);
+    double dof = (v1 + v2) * (v1 + v2) / (v1 * v1 / (before.count - 1) + v2 * v2 / (after.count - 1));
+    return t > student_t95(std::max<size_t>(1, static_cast<size_t>(dof)));
+}
+
+// Compares every series of the current run to the same series of `baseline`, logs the table of the differences, and returns the number of
+// regressions. Series measured on one side only are listed without counting as regressions.
+inline size_t compare_to_baseline(const std::map<PhaseKey, std::vector<PhaseSample>> &baseline, const std::vector<PhaseSeries> &current,
+                                  const RegressionThresholds &thresholds)
+{
+    size_t regressions = 0;
+    std::vector<std::string> rows;
+    auto row = [&](const std::string &name, const char *metric, double before, double after, const char *verdict)
+    {
+        char line[256];
+        snprintf(line, sizeof(line), "%-64s %-12s %14.3f %14.3f %+8.1f%%", name.c_str(), metric, before, after, before ? 100 * (after / before - 1) : 0.0);
+        rows.push_back(*verdict ? std::string(line) + "  " + verdict : line);
+    };
+
+    std::map<PhaseKey, bool> compared;
+    for (const PhaseSeries &series : current)
+    {
+        std::string name = series.key.variant + " / " + series.key.phase + " / " + series.key.role;
+        auto found = baseline.find(series.key);
+        if (found == baseline.end())
+        {
+            rows.push_back(name + ": not in the baseline");
+            continue;
+        }
+        compared[series.key] = true;
+
+        auto values = [](const std::vector<PhaseSample> &samples, auto metric)
+        {
+            std::vector<double> v;
+            for (const PhaseSample &sample : samples)
+            {
+                v.push_back(metric(sample));
+            }
+            return summarize(v);
+        };
+
+        // time: means, with the t-test
+        for (auto [metric, get] : {std::make_pair("wall ms", +[](const PhaseSample &s) { return s.wall_ms; }),
+                                   std::make_pair("cpu ms", +[](const PhaseSample &s) { return s.cpu_ms; })})
+        {
+            Summary before = values(found->second, get), after = values(series.samples, get);
+            double change = before.mean ? after.mean / before.mean - 1 : 0;
+            bool significant = significant_change(before, after);
+            const char *verdict = !significant || std::abs(change) <= thresholds.time ? "" : change > 0 ? "REGRESSION" : "improvement";
+            regressions += change > thresholds.time && significant;
+            row(name, metric, before.mean, after.mean, verdict);
+        }
+
+        // traffic and memory: medians, with the threshold alone
+        for (auto [metric, get, threshold] :
+             {std::make_tuple("bytes", +[](const PhaseSample &s) { return double(s.bytes_sent + s.bytes_received); }, thresholds.bytes),
+              std::make_tuple("peak RSS kB", +[](const PhaseSample &s) { return double(s.memory.peak_rss_kb); }, thresholds.memory)})
+        {
+            double before = values(found->second, get).median, after = values(series.samples, get).median;
+            double change = before ? after / before - 1 : 0;
+            const char *verdict = std::abs(change) <= threshold ? "" : change > 0 ? "REGRESSION" : "improvement";
+            regressions += change > threshold;
+            row(name, metric, before, after, verdict);
+        }
+    }
+    for (const auto &[key, samples] : baseline)
+    {
+        if (!compared.count(key))
+        {
+            rows.push_back(key.variant + " / " + key.phase + " / " + key.role + ": not measured by this run");
+        }
+    }
+
+    char header[256];
+    snprintf(header, sizeof(header), "%-64s %-12s %14s %14s %9s", "variant / phase / role", "metric", "baseline", "current", "change");
+    LOG_INFO("\nComparison to the baseline (time: > {}% and significant at 95%, traffic: > {}%, memory: > {}%):", 100 * thresholds.time,
+             100 * thresholds.bytes, 100 * thresholds.memory);
+    LOG_INFO("{}", std::string(header));
+    for (const std::string &line : rows)
+    {
+        LOG_INFO("{}", line);
+    }
+    return regressions;
+}
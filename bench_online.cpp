@@ -0,0 +1,259 @@
+/*
+Microbenchmarks of the online phase, with Google Benchmark.
+
+Every kernel is measured for each parameter set below and each instruction set supported by the host. Benchmarks are named
+`<operation>/<isa>/<parameter set>`, so that e.g.
+
+    ./oprf_bench --benchmark_filter='blind_eval/.+/n482_q12_p8'
+
+compares instruction sets on the parameters of tool.h. Times are per call, and the `cycles/op` counter gives TSC cycles per call.
+The `pool_*` benchmarks run Request over a whole pool of `pool_rounds` rounds, in order (with and without prefetching) or at random,
+to expose the cost of pool accesses that miss the caches.
+*/
+
+#include <benchmark/benchmark.h>
+#include <cryptoTools/Crypto/RandomOracle.h>
+
+#include "kernels.h"
+#include "online.h"
+#include "pool.h"
+
+#include <x86intrin.h>
+
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+struct ParamSet
+{
+    const char *name;
+    OprfParams params;
+};
+
+// parameters of tool.h, the (415, 2^8, 2^4) set of the paper, and a set on 32-bit lanes.
+const ParamSet param_sets[] = {
+    {"n482_q12_p8", {482, 12, 8}},
+    {"n415_q8_p4", {415, 8, 4}},
+    {"n512_q20_p12", {512, 20, 12}},
+};
+
+// `tau` of tool.h
+const size_t pool_rounds = 1 << 16;
+
+// rounds per call of the batched BlindEval
+const size_t batch = 64;
+
+// Random inputs of the kernels for one parameter set, `batch` rounds of each.
+template <typename Lane>
+struct Inputs
+{
+    OprfParams params;
+    osuCrypto::AlignedUnVector<Lane> a, sc0, sc1, e_1, rs, ss, y;
+    std::vector<uint32_t> bpr_bar, indices;
+    std::vector<uint8_t> b_bar, sk, ro, request, response;
+
+    explicit Inputs(const OprfParams &params) : params(params)
+    {
+        const size_t n = params.n, delta = params.delta();
+        std::mt19937_64 prng(params.n);
+
+        auto fill = [&](osuCrypto::AlignedUnVector<Lane> &v, size_t size, uint32_t mask)
+        {
+            v.resize(size);
+            for (size_t i = 0; i < size; i++)
+            {
+                v[i] = static_cast<Lane>(prng() & mask);
+            }
+        };
+        fill(a, n, params.q_mask());
+        fill(sc0, n * batch, params.q_mask());
+        fill(sc1, n * batch, params.q_mask());
+        fill(e_1, n * batch, params.q_mask());
+        fill(rs, n * batch, params.q_mask());
+        fill(ss, delta * batch, params.p_mask());
+        y.resize(delta * batch);
+
+        bpr_bar.resize(batch);
+        indices.resize(batch);
+        for (size_t r = 0; r < batch; r++)
+        {
+            bpr_bar[r] = prng() & (delta - 1);
+            indices[r] = prng() & (delta - 1);
+        }
+
+        auto bytes = [&](std::vector<uint8_t> &v, size_t size)
+        {
+            v.resize(size);
+            for (auto &byte : v)
+            {
+                byte = static_cast<uint8_t>(prng());
+            }
+        };
+        bytes(b_bar, (n + 7) / 8);
+        bytes(sk, (n + 7) / 8);
+        bytes(ro, n * sizeof(Lane));
+        bytes(request, params.request_size());
+        bytes(response, params.response_size());
+    }
+};
+
+// Client pool of `pool_rounds` rounds for the `pool_*` benchmarks. Only the pool of the current parameter set is kept, since the
+// benchmarks run one parameter set after the other.
+template <typename Lane>
+const ClientPool<Lane> &pool_for(const OprfParams &params)
+{
+    static std::unique_ptr<ClientPool<Lane>> pool;
+    if (!pool || pool->n != params.n)
+    {
+        pool.reset();
+        pool = std::make_unique<ClientPool<Lane>>();
+        pool->n = params.n;
+        pool->delta = params.delta();
+        pool->tau = pool_rounds;
+
+        std::mt19937_64 prng(pool_rounds);
+        pool->sc0.resize(params.n * pool_rounds);
+        pool->sc1.resize(params.n * pool_rounds);
+        for (size_t i = 0; i < params.n * pool_rounds; i++)
+        {
+            pool->sc0[i] = static_cast<Lane>(prng() & params.q_mask());
+            pool->sc1[i] = static_cast<Lane>(prng() & params.q_mask());
+        }
+    }
+    return *pool;
+}
+
+// Runs `body` once per iteration and reports the TSC cycles per iteration next to the time.
+template <typename Body>
+void measure(benchmark::State &state, Body &&body)
+{
+    uint64_t start = __rdtsc();
+    for (auto _ : state)
+    {
+        body();
+    }
+    state.counters["cycles/op"] = benchmark::Counter(static_cast<double>(__rdtsc() - start), benchmark::Counter::kAvgIterations);
+}
+
+template <typename Lane>
+void register_set(const ParamSet &set, const OnlineKernels &isa_kernels)
+{
+    const LaneKernels<Lane> &k = isa_kernels.lanes<Lane>();
+    auto in = std::make_shared<Inputs<Lane>>(set.params);
+    const OprfParams p = set.params;
+    const size_t delta = p.delta();
+
+    auto add = [&](const char *operation, auto body)
+    {
+        std::string name = std::string(operation) + "/" + isa_kernels.name + "/" + set.name;
+        benchmark::RegisterBenchmark(name.c_str(), [body, in](benchmark::State &state)
+                                     { measure(state, [&]
+                                               { body(*in); }); });
+    };
+
+    // a = H(t, x): random oracle and reduction of its output
+    add("derive_coefficients", [&k, p](Inputs<Lane> &in)
+        {
+            osuCrypto::RandomOracle ro(in.ro.size());
+            ro.Update(int64_t(1));
+            ro.Update(int64_t(2));
+            ro.Final(in.ro.data());
+            k.coeffs_from_bytes(in.ro.data(), p.n, p.q_mask(), in.a.data()); });
+
+    add("request", [&k, p](Inputs<Lane> &in)
+        { benchmark::DoNotOptimize(k.request(in.a.data(), in.sc0.data(), in.sc1.data(), in.b_bar.data(), in.e_1.data(), p.n, p.q_mask())); });
+
+    add("pack_request", [&k, p](Inputs<Lane> &in)
+        {
+            size_t bytes = k.pack_bits(in.e_1.data(), p.n, p.lg_q, in.request.data());
+            k.pack_bits(in.y.data(), 1, p.lg_delta(), in.request.data() + bytes); });
+
+    add("unpack_request", [&k, p](Inputs<Lane> &in)
+        { k.unpack_bits(in.request.data(), p.n, p.lg_q, in.e_1.data()); });
+
+    // BlindEval of one round: sum of the atil values, then the y table
+    add("blind_eval", [&k, p, delta](Inputs<Lane> &in)
+        {
+            uint32_t atil_sum = k.blind_eval(in.e_1.data(), in.rs.data(), in.sk.data(), p.n, p.q_mask());
+            k.y_table(in.ss.data(), in.bpr_bar[0], atil_sum, in.y.data(), delta, p.lg_delta(), p.q_mask(), p.p_mask()); });
+
+    add("y_table", [&k, p, delta](Inputs<Lane> &in)
+        { k.y_table(in.ss.data(), in.bpr_bar[0], 12345 & p.q_mask(), in.y.data(), delta, p.lg_delta(), p.q_mask(), p.p_mask()); });
+
+    // `batch` rounds per call
+    add("blind_eval_batch", [&k, p, delta](Inputs<Lane> &in)
+        { k.blind_eval_batch(in.e_1.data(), in.rs.data(), in.sk.data(), in.ss.data(), in.bpr_bar.data(), in.y.data(), batch, p.n, delta, p.lg_delta(),
+                             p.q_mask(), p.p_mask()); });
+
+    add("pack_response", [&k, p, delta](Inputs<Lane> &in)
+        { k.pack_bits(in.y.data(), delta, p.lg_p, in.response.data()); });
+
+    // Finalize, as `oprf_finalize` in online.h: unpacks the response up to the index selected by c_sum
+    add("finalize", [&k, p](Inputs<Lane> &in)
+        {
+            static size_t r = 0;
+            uint32_t index = in.indices[r++ % batch];
+            k.unpack_bits(in.response.data(), index + 1, p.lg_p, in.y.data());
+            benchmark::DoNotOptimize((in.y[index] - in.sc0[0] - (in.a[0] >> p.lg_delta())) & p.p_mask()); });
+
+    add("masked_sum", [&k, p](Inputs<Lane> &in)
+        { benchmark::DoNotOptimize(k.masked_sum(in.a.data(), in.sk.data(), p.n, p.q_mask())); });
+
+    // Request on consecutive rounds of a whole pool, as the online phase consumes it, with the prefetching of `PoolCursor` (2 rounds ahead),
+    // without it, and on random rounds.
+    static const char *patterns[] = {"pool_sequential_prefetch", "pool_sequential", "pool_random"};
+    for (int pattern = 0; pattern < 3; pattern++)
+    {
+        std::string name = std::string(patterns[pattern]) + "/" + isa_kernels.name + "/" + set.name;
+        benchmark::RegisterBenchmark(name.c_str(), [&k, p, pattern, in](benchmark::State &state)
+                                     {
+            const ClientPool<Lane> &pool = pool_for<Lane>(p);
+            std::mt19937_64 prng(1);
+            size_t round = 0;
+
+            measure(state, [&]
+                    {
+                round = pattern == 2 ? prng() % pool_rounds : (round + 1) % pool_rounds;
+                if (pattern == 0)
+                {
+                    size_t ahead = (round + 2) % pool_rounds;
+                    prefetch_l2(&pool.sc0[ahead * p.n], p.n * sizeof(Lane));
+                    prefetch_l2(&pool.sc1[ahead * p.n], p.n * sizeof(Lane));
+                }
+                benchmark::DoNotOptimize(k.request(in->a.data(), &pool.sc0[round * p.n], &pool.sc1[round * p.n], in->b_bar.data(), in->e_1.data(), p.n, p.q_mask())); }); });
+    }
+}
+
+int main(int argc, char **argv)
+{
+    for (const ParamSet &set : param_sets)
+    {
+        for (Isa isa : {Isa::Generic, Isa::Sse41, Isa::Avx2, Isa::Avx512})
+        {
+            const OnlineKernels *isa_kernels = kernels_for(isa);
+            if (!isa_kernels)
+            {
+                continue;
+            }
+
+            if (set.params.lg_q <= 16)
+            {
+                register_set<uint16_t>(set, *isa_kernels);
+            }
+            else
+            {
+                register_set<uint32_t>(set, *isa_kernels);
+            }
+        }
+    }
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+    {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,171 @@
+/*
+Cuckoo hash table of fixed-size tags, used by the PSI mode.
+
+The server inserts the tags of its set, serializes the table and sends it to the client, which looks its own tags up.
+Each tag can sit in one of `num_hashes` slots. Tags are OPRF outputs and thus pseudorandom, so the slots are derived from the tag itself
+rather than from a keyed hash function. A slot holding only zero bytes is empty; a tag of all zeros is as unlikely as a false positive.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+class CuckooTable
+{
+public:
+    static constexpr size_t num_hashes = 3;
+
+    // A table for up to `capacity` tags of `tag_bytes` bytes (at least 8), with `expansion` slots per tag.
+    CuckooTable(size_t capacity, size_t tag_bytes, double expansion = 1.27)
+        : tag_bytes(tag_bytes), num_slots(std::max<size_t>(static_cast<size_t>(capacity * expansion), num_hashes)), slots(num_slots * tag_bytes)
+    {
+        if (tag_bytes < sizeof(uint64_t))
+        {
+            throw std::invalid_argument("cuckoo table tags must be at least 8 bytes long");
+        }
+    }
+
+    // Inserts a tag, evicting the tags in its way. Throws if no free slot was found after `max_kicks` evictions.
+    void insert(const uint8_t *tag)
+    {
+        std::vector<uint8_t> current(tag, tag + tag_bytes);
+        std::vector<uint8_t> evicted(tag_bytes);
+        size_t last = num_slots;
+
+        for (size_t kick = 0; kick < max_kicks; kick++)
+        {
+            for (size_t k = 0; k < num_hashes; k++)
+            {
+                uint8_t *s = slot(slot_index(current.data(), k));
+                if (empty(s))
+                {
+                    memcpy(s, current.data(), tag_bytes);
+                    count++;
+                    return;
+                }
+            }
+
+            // all slots taken: evict the occupant of a random one, other than the slot the current tag was just evicted from
+            size_t index = last;
+            for (size_t attempt = 0; index == last && attempt < 4 * num_hashes; attempt++)
+            {
+                walk ^= walk << 13;
+                walk ^= walk >> 7;
+                walk ^= walk << 17;
+                index = slot_index(current.data(), walk % num_hashes);
+            }
+
+            uint8_t *s = slot(index);
+            memcpy(evicted.data(), s, tag_bytes);
+            memcpy(s, current.data(), tag_bytes);
+            std::swap(current, evicted);
+            last = index;
+        }
+
+        throw std::runtime_error("cuckoo insertion failed with " + std::to_string(count) + " tags in " + std::to_string(num_slots) + " slots");
+    }
+
+    bool contains(const uint8_t *tag) const
+    {
+        for (size_t k = 0; k < num_hashes; k++)
+        {
+            if (memcmp(slot(slot_index(tag, k)), tag, tag_bytes) == 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    // Serialized form: the tag size and number of slots as little-endian u64, followed by the slots.
+    std::vector<uint8_t> serialize() const
+    {
+        std::vector<uint8_t> out(2 * sizeof(uint64_t) + slots.size());
+        uint64_t fields[2] = {tag_bytes, num_slots};
+        memcpy(out.data(), fields, sizeof(fields));
+        memcpy(out.data() + sizeof(fields), slots.data(), slots.size());
+        return out;
+    }
+
+    static CuckooTable deserialize(const std::vector<uint8_t> &in)
+    {
+        uint64_t fields[2];
+        if (in.size() < sizeof(fields))
+        {
+            throw std::runtime_error("truncated cuckoo table");
+        }
+        memcpy(fields, in.data(), sizeof(fields));
+
+        // divides rather than multiplies, so that large fields cannot overflow into a matching size
+        size_t payload = in.size() - sizeof(fields);
+        if (fields[0] < sizeof(uint64_t) || fields[1] == 0 || fields[1] > payload / fields[0] || fields[0] * fields[1] != payload)
+        {
+            throw std::runtime_error("malformed cuckoo table");
+        }
+
+        CuckooTable table(0, fields[0]);
+        table.num_slots = fields[1];
+        table.slots.assign(in.begin() + sizeof(fields), in.end());
+        for (size_t i = 0; i < table.num_slots; i++)
+        {
+            table.count += !table.empty(table.slot(i));
+        }
+        return table;
+    }
+
+private:
+    static constexpr size_t max_kicks = 1000;
+
+    size_t tag_bytes;
+    size_t num_slots;
+    size_t count = 0;
+    std::vector<uint8_t> slots;
+
+    // state of the random walk used to pick the slot to evict
+    uint64_t walk = 0x2545f4914f6cdd1dull;
+
+    // slot `k` of a tag: its first 8 bytes, mixed with a different constant per `k` and mapped onto the table.
+    size_t slot_index(const uint8_t *tag, size_t k) const
+    {
+        uint64_t v;
+        memcpy(&v, tag, sizeof(v));
+        v += 0x9e3779b97f4a7c15ull * (k + 1);
+        v = (v ^ (v >> 30)) * 0xbf58476d1ce4e5b9ull;
+        v = (v ^ (v >> 27)) * 0x94d049bb133111ebull;
+        v ^= v >> 31;
+        return static_cast<size_t>((static_cast<unsigned __int128>(v) * num_slots) >> 64);
+    }
+
+    uint8_t *slot(size_t i)
+    {
+        return &slots[i * tag_bytes];
+    }
+
+    const uint8_t *slot(size_t i) const
+    {
+        return &slots[i * tag_bytes];
+    }
+
+    bool empty(const uint8_t *s) const
+    {
+        for (size_t b = 0; b < tag_bytes; b++)
+        {
+            if (s[b])
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+};
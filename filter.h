@@ -0,0 +1,340 @@
+/*
+Cuckoo filter over hashed OPRF outputs, for membership queries against a large server set (e.g. breach lookups).
+
+The server inserts the hashes of its outputs and sends the filter to its clients, which probe it with the hashes of their own outputs.
+Buckets hold four 16-bit fingerprints (layout in kernels.h), so that a filter at its target load takes about 17 bits per element
+and answers a query for an absent element positively with probability about 2^-13.
+
+`insert` only uses compare-and-swap on buckets, so a filter can be built by several threads at once.
+A fingerprint that finds no room after `max_kicks` relocations goes to a small stash, checked on every query.
+Filters are updated in place with `insert` and `erase`, and `diff` / `apply` send only the buckets that changed to the clients.
+*/
+
+#pragma once
+
+#include "kernels.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+class CuckooFilter
+{
+public:
+    static constexpr size_t slots_per_bucket = 4;
+
+    // A filter for about `capacity` elements, at a load of at most 95%.
+    explicit CuckooFilter(size_t capacity)
+    {
+        size_t num_buckets = 1;
+        while (num_buckets * slots_per_bucket * 95 < capacity * 100)
+        {
+            num_buckets <<= 1;
+        }
+        bucket_mask = num_buckets - 1;
+        buckets.assign(num_buckets, 0);
+    }
+
+    // Hash of an OPRF output of at least 8 bytes. Outputs are pseudorandom, so mixing their first 8 bytes is enough.
+    static uint64_t hash(const uint8_t *tag)
+    {
+        uint64_t v;
+        memcpy(&v, tag, sizeof(v));
+        v = (v ^ (v >> 30)) * 0xbf58476d1ce4e5b9ull;
+        v = (v ^ (v >> 27)) * 0x94d049bb133111ebull;
+        return v ^ (v >> 31);
+    }
+
+    // Safe to call from several threads at once, but not concurrently with `erase` or queries.
+    void insert(uint64_t h)
+    {
+        uint16_t fp = filter_fingerprint(h);
+        uint64_t i1 = h & bucket_mask;
+        uint64_t i2 = filter_alt_bucket(i1, fp, bucket_mask);
+
+        std::atomic_ref<size_t>(count).fetch_add(1, std::memory_order_relaxed);
+        if (try_add(i1, fp) || try_add(i2, fp))
+        {
+            return;
+        }
+
+        // both buckets are full: take the place of a random fingerprint and move it to its alternate bucket, and so on.
+        uint64_t i = (h >> 32) & 1 ? i2 : i1;
+        uint64_t walk = h | 1;
+        for (size_t kick = 0; kick < max_kicks; kick++)
+        {
+            walk ^= walk << 13;
+            walk ^= walk >> 7;
+            walk ^= walk << 17;
+
+            fp = swap_slot(i, walk % slots_per_bucket, fp);
+            if (fp == 0)
+            {
+                return;
+            }
+
+            i = filter_alt_bucket(i, fp, bucket_mask);
+            if (try_add(i, fp))
+            {
+                return;
+            }
+        }
+
+        // keeps the bucket so that queries find the fingerprint from either of its buckets
+        while (std::atomic_ref<uint32_t>(stash_lock).exchange(1, std::memory_order_acquire))
+        {
+        }
+        stash.push_back((i << 16) | fp);
+        std::atomic_ref<uint32_t>(stash_lock).store(0, std::memory_order_release);
+    }
+
+    // Removes one occurrence of an element inserted earlier. Returns false if it was not found.
+    bool erase(uint64_t h)
+    {
+        uint16_t fp = filter_fingerprint(h);
+        uint64_t i1 = h & bucket_mask;
+        uint64_t i2 = filter_alt_bucket(i1, fp, bucket_mask);
+
+        for (uint64_t i : {i1, i2})
+        {
+            for (size_t s = 0; s < slots_per_bucket; s++)
+            {
+                if (((buckets[i] >> (16 * s)) & 0xffff) == fp)
+                {
+                    buckets[i] &= ~(0xffffull << (16 * s));
+                    count--;
+                    return true;
+                }
+            }
+        }
+
+        for (size_t k = 0; k < stash.size(); k++)
+        {
+            if (stash_matches(stash[k], fp, i1, i2))
+            {
+                stash.erase(stash.begin() + k);
+                count--;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    bool contains(uint64_t h) const
+    {
+        return filter_probe_one(buckets.data(), bucket_mask, h) || in_stash(h);
+    }
+
+    // found[k] = 1 if hashes[k] may be in the filter, probing with the kernels in use (see `filter_probe` in kernels.h).
+    void contains(const uint64_t *hashes, size_t count, uint8_t *found) const
+    {
+        online_kernels().filter_probe(buckets.data(), bucket_mask, hashes, count, found);
+
+        if (!stash.empty())
+        {
+            for (size_t k = 0; k < count; k++)
+            {
+                found[k] = found[k] || in_stash(hashes[k]);
+            }
+        }
+    }
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    size_t num_buckets() const
+    {
+        return buckets.size();
+    }
+
+    size_t stash_size() const
+    {
+        return stash.size();
+    }
+
+    // Serialized form, as little-endian u64: the number of buckets, of elements and of stash entries, followed by the buckets and the stash.
+    std::vector<uint8_t> serialize() const
+    {
+        std::vector<uint64_t> words = {buckets.size(), count, stash.size()};
+        words.insert(words.end(), buckets.begin(), buckets.end());
+        words.insert(words.end(), stash.begin(), stash.end());
+        return to_bytes(words);
+    }
+
+    static CuckooFilter deserialize(const std::vector<uint8_t> &in)
+    {
+        std::vector<uint64_t> words = from_bytes(in);
+
+        // counts are checked against the words left rather than added up, so that large counts cannot wrap around into a matching size
+        if (words.size() < 3 || !is_power_of_two(words[0]) || words[0] > words.size() - 3 || words[2] != words.size() - 3 - words[0] ||
+            !valid_stash(words.begin() + 3 + words[0], words.end(), words[0]))
+        {
+            throw std::runtime_error("malformed cuckoo filter");
+        }
+
+        CuckooFilter filter(0);
+        filter.bucket_mask = words[0] - 1;
+        filter.count = words[1];
+        filter.buckets.assign(words.begin() + 3, words.begin() + 3 + words[0]);
+        filter.stash.assign(words.begin() + 3 + words[0], words.end());
+        return filter;
+    }
+
+    // Update bringing a copy of `base` (a filter of the same size) to this filter, as little-endian u64:
+    // the number of elements, of changed buckets and of stash entries, followed by (index, bucket) pairs and by the whole stash.
+    std::vector<uint8_t> diff(const CuckooFilter &base) const
+    {
+        if (base.buckets.size() != buckets.size())
+        {
+            throw std::invalid_argument("cuckoo filters of different sizes");
+        }
+
+        std::vector<uint64_t> changes;
+        for (size_t i = 0; i < buckets.size(); i++)
+        {
+            if (buckets[i] != base.buckets[i])
+            {
+                changes.push_back(i);
+                changes.push_back(buckets[i]);
+            }
+        }
+
+        std::vector<uint64_t> words = {count, changes.size() / 2, stash.size()};
+        words.insert(words.end(), changes.begin(), changes.end());
+        words.insert(words.end(), stash.begin(), stash.end());
+        return to_bytes(words);
+    }
+
+    // Throws, leaving the filter unchanged, if the update is malformed.
+    void apply(const std::vector<uint8_t> &update)
+    {
+        std::vector<uint64_t> words = from_bytes(update);
+        if (words.size() < 3 || words[1] > (words.size() - 3) / 2 || words[2] != words.size() - 3 - 2 * words[1] ||
+            !valid_stash(words.begin() + 3 + 2 * words[1], words.end(), buckets.size()))
+        {
+            throw std::runtime_error("malformed cuckoo filter update");
+        }
+        for (size_t k = 0; k < words[1]; k++)
+        {
+            if (words[3 + 2 * k] >= buckets.size())
+            {
+                throw std::runtime_error("malformed cuckoo filter update");
+            }
+        }
+
+        for (size_t k = 0; k < words[1]; k++)
+        {
+            buckets[words[3 + 2 * k]] = words[3 + 2 * k + 1];
+        }
+
+        count = words[0];
+        stash.assign(words.begin() + 3 + 2 * words[1], words.end());
+    }
+
+private:
+    static constexpr size_t max_kicks = 500;
+
+    uint64_t bucket_mask;
+    std::vector<uint64_t> buckets;
+    size_t count = 0;
+
+    // fingerprints that found no room, as `(bucket << 16) | fingerprint`
+    std::vector<uint64_t> stash;
+    uint32_t stash_lock = 0;
+
+    // Puts `fp` in a free slot of bucket `i`, if any.
+    bool try_add(uint64_t i, uint16_t fp)
+    {
+        std::atomic_ref<uint64_t> bucket(buckets[i]);
+        uint64_t old = bucket.load(std::memory_order_relaxed);
+        while (true)
+        {
+            size_t s = 0;
+            while (s < slots_per_bucket && ((old >> (16 * s)) & 0xffff))
+            {
+                s++;
+            }
+            if (s == slots_per_bucket)
+            {
+                return false;
+            }
+            if (bucket.compare_exchange_weak(old, old | (static_cast<uint64_t>(fp) << (16 * s)), std::memory_order_relaxed))
+            {
+                return true;
+            }
+        }
+    }
+
+    // Replaces slot `s` of bucket `i` by `fp` and returns its previous content.
+    uint16_t swap_slot(uint64_t i, size_t s, uint16_t fp)
+    {
+        std::atomic_ref<uint64_t> bucket(buckets[i]);
+        uint64_t old = bucket.load(std::memory_order_relaxed);
+        uint64_t slot_mask = 0xffffull << (16 * s);
+        while (!bucket.compare_exchange_weak(old, (old & ~slot_mask) | (static_cast<uint64_t>(fp) << (16 * s)), std::memory_order_relaxed))
+        {
+        }
+        return static_cast<uint16_t>(old >> (16 * s));
+    }
+
+    static bool stash_matches(uint64_t entry, uint16_t fp, uint64_t i1, uint64_t i2)
+    {
+        return (entry & 0xffff) == fp && ((entry >> 16) == i1 || (entry >> 16) == i2);
+    }
+
+    bool in_stash(uint64_t h) const
+    {
+        uint16_t fp = filter_fingerprint(h);
+        uint64_t i1 = h & bucket_mask;
+        uint64_t i2 = filter_alt_bucket(i1, fp, bucket_mask);
+        for (uint64_t entry : stash)
+        {
+            if (stash_matches(entry, fp, i1, i2))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Whether the stash entries in [begin, end) refer to buckets of a filter of `num_buckets` buckets.
+    static bool valid_stash(std::vector<uint64_t>::const_iterator begin, std::vector<uint64_t>::const_iterator end, uint64_t num_buckets)
+    {
+        for (auto entry = begin; entry != end; ++entry)
+        {
+            if ((*entry >> 16) >= num_buckets)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static bool is_power_of_two(uint64_t v)
+    {
+        return v && !(v & (v - 1));
+    }
+
+    static std::vector<uint8_t> to_bytes(const std::vector<uint64_t> &words)
+    {
+        std::vector<uint8_t> out(words.size() * sizeof(uint64_t));
+        memcpy(out.data(), words.data(), out.size());
+        return out;
+    }
+
+    static std::vector<uint64_t> from_bytes(const std::vector<uint8_t> &in)
+    {
+        if (in.size() % sizeof(uint64_t))
+        {
+            throw std::runtime_error("truncated cuckoo filter data");
+        }
+        std::vector<uint64_t> words(in.size() / sizeof(uint64_t));
+        memcpy(words.data(), in.data(), in.size());
+        return words;
+    }
+};
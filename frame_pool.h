@@ -0,0 +1,187 @@
+/*
+Per-thread pools of coroutine frames for the protocol coroutines of the online phase.
+
+Every coroutine allocates its frame on the heap when it is called. Coroutines that take `pooled_frame` as their first parameter
+(after the object, for lambdas and member functions) instead get their frame from size classes of 64 bytes held by the calling thread:
+a freed frame goes back to the free list of the thread that frees it and is reused by the next coroutine of the same size class.
+Frames larger than `max_frame_bytes`, frames beyond `max_free_frames` per class and frames freed once the pool of the thread is destroyed
+go to the heap as usual. Frames up to `max_frame_bytes` always take the whole size of their class, even when allocated after the pool of the
+thread is destroyed, so that any thread can keep them for the next coroutine of that class.
+
+The promise type of coproto's `task<>` is kept as is; it is only given an allocator through a specialization of `std::coroutine_traits`.
+*/
+
+#pragma once
+
+#include "libOTe/Tools/Coproto.h"
+
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+struct pooled_frame_t
+{
+    explicit pooled_frame_t() = default;
+};
+
+inline constexpr pooled_frame_t pooled_frame{};
+
+class FramePool
+{
+public:
+    static constexpr size_t class_bytes = 64;
+    static constexpr size_t max_frame_bytes = 4096;
+    static constexpr size_t max_free_frames = 256;
+
+    struct Stats
+    {
+        uint64_t allocations;
+        uint64_t reuses;
+        uint64_t heap_allocations;
+    };
+
+    static void *allocate(size_t size)
+    {
+        if (pool_destroyed)
+        {
+            return ::operator new(block_bytes(size));
+        }
+        ThreadPool &pool = local();
+        pool.stats.allocations++;
+
+        if (size > max_frame_bytes)
+        {
+            pool.stats.heap_allocations++;
+            return ::operator new(size);
+        }
+
+        size_t c = size_class(size);
+        if (FreeFrame *frame = pool.free[c])
+        {
+            pool.free[c] = frame->next;
+            pool.num_free[c]--;
+            pool.stats.reuses++;
+            return frame;
+        }
+
+        pool.stats.heap_allocations++;
+        return ::operator new(block_bytes(size));
+    }
+
+    static void deallocate(void *ptr, size_t size)
+    {
+        // frames freed by the destructors of other thread-local objects, after the pool of the thread is gone
+        if (pool_destroyed)
+        {
+            ::operator delete(ptr);
+            return;
+        }
+
+        ThreadPool &pool = local();
+        size_t c = size_class(size);
+        if (size > max_frame_bytes || pool.num_free[c] == max_free_frames)
+        {
+            ::operator delete(ptr);
+            return;
+        }
+
+        FreeFrame *frame = static_cast<FreeFrame *>(ptr);
+        frame->next = pool.free[c];
+        pool.free[c] = frame;
+        pool.num_free[c]++;
+    }
+
+    // counters of the calling thread
+    static Stats stats()
+    {
+        return pool_destroyed ? Stats{} : local().stats;
+    }
+
+private:
+    static constexpr size_t num_classes = max_frame_bytes / class_bytes;
+
+    struct FreeFrame
+    {
+        FreeFrame *next;
+    };
+
+    struct ThreadPool
+    {
+        FreeFrame *free[num_classes] = {};
+        size_t num_free[num_classes] = {};
+        Stats stats = {};
+
+        ~ThreadPool()
+        {
+            pool_destroyed = true;
+            for (FreeFrame *frame : free)
+            {
+                while (frame)
+                {
+                    ::operator delete(std::exchange(frame, frame->next));
+                }
+            }
+        }
+    };
+
+    // set when the pool of the thread is destroyed at thread exit; trivially destructible, so that it can still be read afterwards
+    static inline thread_local bool pool_destroyed = false;
+
+    static ThreadPool &local()
+    {
+        static thread_local ThreadPool pool;
+        return pool;
+    }
+
+    static size_t size_class(size_t size)
+    {
+        return (size + class_bytes - 1) / class_bytes - 1;
+    }
+
+    // bytes of the block holding a frame of `size` bytes, which the free lists may hand to any frame of its class
+    static size_t block_bytes(size_t size)
+    {
+        return size > max_frame_bytes ? size : (size_class(size) + 1) * class_bytes;
+    }
+};
+
+// Promise of `Task` allocating its frame from the pool of the calling thread.
+// It adds no member, so that the handles built by the promise of `Task` point to the same frame.
+template <typename Task>
+struct PooledPromise : Task::promise_type
+{
+    using Task::promise_type::promise_type;
+
+    static void *operator new(size_t size)
+    {
+        return FramePool::allocate(size);
+    }
+
+    static void operator delete(void *ptr, size_t size)
+    {
+        FramePool::deallocate(ptr, size);
+    }
+};
+
+// the frame is laid out by the promise of `Task`, whose handles must find the same promise in it
+static_assert(sizeof(PooledPromise<coproto::task<>>) == sizeof(coproto::task<>::promise_type), "PooledPromise must not add members");
+static_assert(alignof(PooledPromise<coproto::task<>>) == alignof(coproto::task<>::promise_type), "PooledPromise must not change the alignment");
+static_assert(!std::is_standard_layout_v<coproto::task<>::promise_type> || std::is_standard_layout_v<PooledPromise<coproto::task<>>>,
+              "PooledPromise must keep the layout of the promise of coproto::task<>");
+
+// free functions whose first parameter is `pooled_frame_t`
+template <typename... Args>
+struct std::coroutine_traits<coproto::task<>, pooled_frame_t, Args...>
+{
+    using promise_type = PooledPromise<coproto::task<>>;
+};
+
+// lambdas and member functions, whose object comes first
+template <typename Self, typename... Args>
+struct std::coroutine_traits<coproto::task<>, Self, pooled_frame_t, Args...>
+{
+    using promise_type = PooledPromise<coproto::task<>>;
+};
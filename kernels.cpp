@@ -0,0 +1,143 @@
+/*
+Selection of the kernels declared in `kernels.h` according to the features of the host CPU.
+*/
+
+#include "kernels.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+
+namespace kernels_generic
+{
+extern const OnlineKernels table;
+}
+namespace kernels_sse41
+{
+extern const OnlineKernels table;
+}
+namespace kernels_avx2
+{
+extern const OnlineKernels table;
+}
+namespace kernels_avx512
+{
+extern const OnlineKernels table;
+}
+
+static std::atomic<const OnlineKernels *> active_kernels{nullptr};
+
+static bool host_supports(Isa isa)
+{
+    __builtin_cpu_init();
+
+    switch (isa)
+    {
+    case Isa::Generic:
+        return true;
+    case Isa::Sse41:
+        return __builtin_cpu_supports("sse4.1");
+    case Isa::Avx2:
+        return __builtin_cpu_supports("avx2");
+    case Isa::Avx512:
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl");
+    }
+
+    return false;
+}
+
+// all flavours, from the least to the most capable
+static const OnlineKernels *const all_kernels[] = {
+    &kernels_generic::table,
+    &kernels_sse41::table,
+    &kernels_avx2::table,
+    &kernels_avx512::table,
+};
+
+const OnlineKernels *kernels_for(Isa isa)
+{
+    for (const OnlineKernels *k : all_kernels)
+    {
+        if (k->isa == isa)
+        {
+            return host_supports(isa) ? k : nullptr;
+        }
+    }
+
+    return nullptr;
+}
+
+const char *isa_name(Isa isa)
+{
+    for (const OnlineKernels *k : all_kernels)
+    {
+        if (k->isa == isa)
+        {
+            return k->name;
+        }
+    }
+
+    return "unknown";
+}
+
+static const OnlineKernels *kernels_by_name(const char *name)
+{
+    for (const OnlineKernels *k : all_kernels)
+    {
+        if (strcmp(name, k->name) == 0)
+        {
+            return host_supports(k->isa) ? k : nullptr;
+        }
+    }
+
+    return nullptr;
+}
+
+static const OnlineKernels *default_kernels()
+{
+    const char *forced = std::getenv("OPRF_ISA");
+    if (forced && *forced)
+    {
+        if (const OnlineKernels *k = kernels_by_name(forced))
+        {
+            return k;
+        }
+        std::cerr << "OPRF_ISA=" << forced << " is unknown or not supported by this host, using the best available kernels" << std::endl;
+    }
+
+    for (size_t i = std::size(all_kernels); i-- > 0;)
+    {
+        if (host_supports(all_kernels[i]->isa))
+        {
+            return all_kernels[i];
+        }
+    }
+
+    return &kernels_generic::table;
+}
+
+const OnlineKernels &online_kernels()
+{
+    const OnlineKernels *k = active_kernels.load(std::memory_order_acquire);
+    if (!k)
+    {
+        // concurrent first calls compute the same value, so the race is benign
+        k = default_kernels();
+        active_kernels.store(k, std::memory_order_release);
+    }
+    return *k;
+}
+
+bool select_isa(const char *name)
+{
+    const OnlineKernels *k = kernels_by_name(name);
+    if (!k)
+    {
+        return false;
+    }
+
+    active_kernels.store(k, std::memory_order_release);
+    return true;
+}
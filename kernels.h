@@ -0,0 +1,145 @@
+/*
+Hand-written kernels for the online phase (Figure 4) and for the packing steps around it.
+
+Every kernel is compiled several times, once per instruction set (see `kernels_impl.h` and the `kernels_<isa>.cpp` files),
+and the best flavour supported by the host is selected at startup.
+The selection can be forced with the `OPRF_ISA` environment variable or the `--isa=` command line flag of the executable,
+e.g. to compare flavours on the same host.
+
+The kernels do not depend on libOTe and operate on plain arrays:
+blocks are 16-byte values, and bit vectors are packed least significant bit first, as in `osuCrypto::BitVector`.
+Values mod q are held in the narrowest lane type that fits, see `LaneKernels`.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+enum class Isa
+{
+    Generic,
+    Sse41,
+    Avx2,
+    Avx512,
+};
+
+// Kernels operating on values mod q or mod p, stored in lanes of type `Lane` (`uint16_t` or `uint32_t`).
+// Sums are returned reduced mod q; they are accumulated mod 2^16 or 2^32, which is exact since q divides the lane modulus.
+template <typename Lane>
+struct LaneKernels
+{
+    // dst[i] = low bits of the 16-byte block at `src + i * stride` (`stride` in bytes).
+    void (*unpack_lo)(const void *src, size_t stride, Lane *dst, size_t count);
+
+    // a[i] = big-endian word `i` of the random oracle output, reduced mod q. Words are `sizeof(Lane)` bytes long.
+    void (*coeffs_from_bytes)(const uint8_t *ro, size_t n, uint32_t q_mask, Lane *a);
+
+    // Request (Fig. 4) for one round. `sc0`/`sc1` hold the round's phase one sender messages and `b_bar` its bits.
+    // e_0 is identically zero, so only e_1 is written. Returns c_sum mod q.
+    uint32_t (*request)(const Lane *a, const Lane *sc0, const Lane *sc1, const uint8_t *b_bar, Lane *e_1, size_t n, uint32_t q_mask);
+
+    // BlindEval (Fig. 4), first step: returns the sum of atil[i][sk[i]] mod q, where atil[i][0] = -Rs_r[i] and atil[i][1] = e_1[i] - Rs_r[i].
+    uint32_t (*blind_eval)(const Lane *e_1, const Lane *rs, const uint8_t *sk, size_t n, uint32_t q_mask);
+
+    // BlindEval (Fig. 4), second step: y[i] = ((atil_sum - i) mod q) / delta + Ss[(i - bpr_bar) mod delta] mod p.
+    void (*y_table)(const Lane *ss_row, uint32_t bpr_bar, uint32_t atil_sum, Lane *y, size_t delta, uint32_t lg_delta, uint32_t q_mask, uint32_t p_mask);
+
+    // BlindEval (Fig. 4) for `rounds` rounds at once. Round `r` reads row `r` of `e_1`, `rs` (n values each) and `ss` (delta values),
+    // and `bpr_bar[r]`, and writes its table to row `r` of `y` (delta values).
+    void (*blind_eval_batch)(const Lane *e_1, const Lane *rs, const uint8_t *sk, const Lane *ss, const uint32_t *bpr_bar, Lane *y,
+                             size_t rounds, size_t n, size_t delta, uint32_t lg_delta, uint32_t q_mask, uint32_t p_mask);
+
+    // Direct evaluation by the key holder: returns the sum of a[i] for sk[i] = 1, mod q.
+    uint32_t (*masked_sum)(const Lane *a, const uint8_t *sk, size_t n, uint32_t q_mask);
+
+    // Packs the low `width` bits of each value into a little-endian bit stream. Returns the number of bytes written.
+    size_t (*pack_bits)(const Lane *src, size_t count, uint32_t width, uint8_t *dst);
+
+    // Inverse of `pack_bits`.
+    void (*unpack_bits)(const uint8_t *src, size_t count, uint32_t width, Lane *dst);
+};
+
+struct OnlineKernels
+{
+    Isa isa;
+    const char *name;
+
+    // Repeats the first `nbits` bits of `src` `reps` times into `dst`, i.e. dst bit `j * nbits + i` = src bit `i`.
+    void (*tile_bits)(const uint8_t *src, size_t nbits, size_t reps, uint8_t *dst);
+
+    // dst block `j * stride` = src block `j` for `j < count` (`stride` in blocks).
+    void (*scatter_blocks)(const void *src, size_t count, size_t stride, void *dst);
+
+    // Membership probe of a cuckoo filter for `count` hashed keys: found[k] = 1 if the fingerprint of hashes[k] is in one of its two buckets.
+    // See `filter_fingerprint` below for the layout.
+    void (*filter_probe)(const uint64_t *buckets, uint64_t bucket_mask, const uint64_t *hashes, size_t count, uint8_t *found);
+
+    // for lg_q <= 16
+    LaneKernels<uint16_t> u16;
+
+    // for 16 < lg_q < 32
+    LaneKernels<uint32_t> u32;
+
+    template <typename Lane>
+    const LaneKernels<Lane> &lanes() const;
+};
+
+template <>
+inline const LaneKernels<uint16_t> &OnlineKernels::lanes<uint16_t>() const
+{
+    return u16;
+}
+
+template <>
+inline const LaneKernels<uint32_t> &OnlineKernels::lanes<uint32_t>() const
+{
+    return u32;
+}
+
+// Number of bytes needed to hold `count` values of `width` bits once packed.
+inline size_t packed_size(size_t count, uint32_t width)
+{
+    return (count * width + 7) / 8;
+}
+
+// Cuckoo filter layout (see filter.h). Buckets hold four 16-bit fingerprints in a u64, with 0 marking an empty slot.
+// A hashed key goes to bucket `hash & bucket_mask` or to its alternate bucket, with the fingerprint taken from its top bits.
+inline uint16_t filter_fingerprint(uint64_t hash)
+{
+    uint16_t fp = static_cast<uint16_t>(hash >> 48);
+    return fp ? fp : 1;
+}
+
+// The alternate bucket of a fingerprint in bucket `bucket`; applying it twice gives back `bucket`.
+inline uint64_t filter_alt_bucket(uint64_t bucket, uint16_t fp, uint64_t bucket_mask)
+{
+    return (bucket ^ (fp * 0x5bd1e995ull)) & bucket_mask;
+}
+
+inline bool filter_bucket_has(uint64_t bucket, uint16_t fp)
+{
+    // a 16-bit lane of `x` is zero where the fingerprint matches
+    uint64_t x = bucket ^ (fp * 0x0001000100010001ull);
+    return ((x - 0x0001000100010001ull) & ~x & 0x8000800080008000ull) != 0;
+}
+
+inline bool filter_probe_one(const uint64_t *buckets, uint64_t bucket_mask, uint64_t hash)
+{
+    uint16_t fp = filter_fingerprint(hash);
+    uint64_t i1 = hash & bucket_mask;
+    return filter_bucket_has(buckets[i1], fp) || filter_bucket_has(buckets[filter_alt_bucket(i1, fp, bucket_mask)], fp);
+}
+
+// Kernels currently in use. Defaults to the best flavour supported by the host, or to `OPRF_ISA` when set.
+const OnlineKernels &online_kernels();
+
+// Kernels for a given instruction set, or `nullptr` when the host does not support it.
+const OnlineKernels *kernels_for(Isa isa);
+
+// Name of an instruction set, as accepted by `select_isa`.
+const char *isa_name(Isa isa);
+
+// Forces the kernels in use by name ("generic", "sse4.1", "avx2" or "avx512").
+// Returns false if the name is unknown or the host lacks the instruction set.
+bool select_isa(const char *name);
@@ -0,0 +1,7 @@
+// Kernels for AVX2 hosts, built with -mavx2 (see CMakeLists.txt).
+
+#define KERNEL_NAMESPACE kernels_avx2
+#define KERNEL_ISA Isa::Avx2
+#define KERNEL_NAME "avx2"
+
+#include "kernels_impl.h"
@@ -0,0 +1,335 @@
+// Kernels for AVX-512 (F, BW and VL) hosts, built with -mavx512f -mavx512bw -mavx512vl (see CMakeLists.txt).
+//
+// Request, BlindEval and the direct evaluation are hand-written: 16 or 32 bits of `b_bar` or `sk` (one per lane) are loaded straight into a mask register,
+// so that the selection of Sc[b_bar[i]] and atil[i][sk[i]] is a masked blend or add instead of indexing.
+// The y table rotation uses `vpermw` / `vpermd` when a row of Ss fits in a single register.
+// Cuckoo filter probes handle 8 keys at a time, gathering both of their buckets and comparing the four fingerprints of each at once.
+
+#include "kernels.h"
+
+#include <cstring>
+#include <immintrin.h>
+
+namespace kernels_avx512
+{
+
+// Number of bits of `bits` starting at bit `i`, which must be a multiple of 8, as a mask. Only the bytes covering `count` bits are read.
+static inline uint32_t load_bits(const uint8_t *bits, size_t i, size_t count)
+{
+    uint32_t m = 0;
+    memcpy(&m, bits + i / 8, (count + 7) / 8);
+    return count == 32 ? m : m & ((1u << count) - 1);
+}
+
+static inline uint32_t lanes_mask(size_t count)
+{
+    return count == 32 ? 0xffffffffu : (1u << count) - 1;
+}
+
+// Sum of 32 16-bit lanes mod 2^16. `madd` sums pairs as signed values, which only differs by multiples of 2^16.
+static inline uint32_t reduce_add_epu16(__m512i v)
+{
+    return static_cast<uint32_t>(_mm512_reduce_add_epi32(_mm512_madd_epi16(v, _mm512_set1_epi16(1))));
+}
+
+template <typename Lane>
+static uint32_t avx512_request(const Lane *a, const Lane *sc0, const Lane *sc1, const uint8_t *b_bar, Lane *e_1, size_t n, uint32_t q_mask);
+
+template <>
+uint32_t avx512_request<uint32_t>(const uint32_t *a, const uint32_t *sc0, const uint32_t *sc1, const uint8_t *b_bar, uint32_t *e_1, size_t n, uint32_t q_mask)
+{
+    const __m512i q = _mm512_set1_epi32(q_mask);
+    __m512i c_sum = _mm512_setzero_si512();
+
+    for (size_t i = 0; i < n; i += 16)
+    {
+        size_t count = n - i < 16 ? n - i : 16;
+        __mmask16 lanes = static_cast<__mmask16>(lanes_mask(count));
+        __mmask16 m = static_cast<__mmask16>(load_bits(b_bar, i, count));
+
+        __m512i s0 = _mm512_maskz_loadu_epi32(lanes, sc0 + i);
+        __m512i s1 = _mm512_maskz_loadu_epi32(lanes, sc1 + i);
+        __m512i chosen = _mm512_mask_blend_epi32(m, s0, s1); // Sc[b_bar[i]]
+        __m512i other = _mm512_mask_blend_epi32(m, s1, s0);  // Sc[1 - b_bar[i]]
+
+        __m512i c_i = _mm512_and_si512(_mm512_sub_epi32(_mm512_setzero_si512(), chosen), q);
+        __m512i e = _mm512_add_epi32(_mm512_add_epi32(_mm512_maskz_loadu_epi32(lanes, a + i), c_i), other);
+        _mm512_mask_storeu_epi32(e_1 + i, lanes, _mm512_and_si512(e, q));
+
+        // masked-off lanes hold (0 - 0) & q = 0
+        c_sum = _mm512_add_epi32(c_sum, c_i);
+    }
+
+    return static_cast<uint32_t>(_mm512_reduce_add_epi32(c_sum)) & q_mask;
+}
+
+template <>
+uint32_t avx512_request<uint16_t>(const uint16_t *a, const uint16_t *sc0, const uint16_t *sc1, const uint8_t *b_bar, uint16_t *e_1, size_t n, uint32_t q_mask)
+{
+    const __m512i q = _mm512_set1_epi16(static_cast<short>(q_mask));
+    __m512i c_sum = _mm512_setzero_si512();
+
+    for (size_t i = 0; i < n; i += 32)
+    {
+        size_t count = n - i < 32 ? n - i : 32;
+        __mmask32 lanes = lanes_mask(count);
+        __mmask32 m = load_bits(b_bar, i, count);
+
+        __m512i s0 = _mm512_maskz_loadu_epi16(lanes, sc0 + i);
+        __m512i s1 = _mm512_maskz_loadu_epi16(lanes, sc1 + i);
+        __m512i chosen = _mm512_mask_blend_epi16(m, s0, s1);
+        __m512i other = _mm512_mask_blend_epi16(m, s1, s0);
+
+        __m512i c_i = _mm512_and_si512(_mm512_sub_epi16(_mm512_setzero_si512(), chosen), q);
+        __m512i e = _mm512_add_epi16(_mm512_add_epi16(_mm512_maskz_loadu_epi16(lanes, a + i), c_i), other);
+        _mm512_mask_storeu_epi16(e_1 + i, lanes, _mm512_and_si512(e, q));
+
+        c_sum = _mm512_add_epi16(c_sum, c_i);
+    }
+
+    return reduce_add_epu16(c_sum) & q_mask;
+}
+
+template <typename Lane>
+static uint32_t avx512_blind_eval(const Lane *e_1, const Lane *rs, const uint8_t *sk, size_t n, uint32_t q_mask);
+
+template <>
+uint32_t avx512_blind_eval<uint32_t>(const uint32_t *e_1, const uint32_t *rs, const uint8_t *sk, size_t n, uint32_t q_mask)
+{
+    __m512i acc = _mm512_setzero_si512();
+
+    for (size_t i = 0; i < n; i += 16)
+    {
+        size_t count = n - i < 16 ? n - i : 16;
+        __mmask16 lanes = static_cast<__mmask16>(lanes_mask(count));
+        __mmask16 m = static_cast<__mmask16>(load_bits(sk, i, count));
+
+        acc = _mm512_sub_epi32(acc, _mm512_maskz_loadu_epi32(lanes, rs + i));
+        acc = _mm512_mask_add_epi32(acc, m, acc, _mm512_maskz_loadu_epi32(m, e_1 + i));
+    }
+
+    return static_cast<uint32_t>(_mm512_reduce_add_epi32(acc)) & q_mask;
+}
+
+template <>
+uint32_t avx512_blind_eval<uint16_t>(const uint16_t *e_1, const uint16_t *rs, const uint8_t *sk, size_t n, uint32_t q_mask)
+{
+    __m512i acc = _mm512_setzero_si512();
+
+    for (size_t i = 0; i < n; i += 32)
+    {
+        size_t count = n - i < 32 ? n - i : 32;
+        __mmask32 lanes = lanes_mask(count);
+        __mmask32 m = load_bits(sk, i, count);
+
+        acc = _mm512_sub_epi16(acc, _mm512_maskz_loadu_epi16(lanes, rs + i));
+        acc = _mm512_mask_add_epi16(acc, m, acc, _mm512_maskz_loadu_epi16(m, e_1 + i));
+    }
+
+    return reduce_add_epu16(acc) & q_mask;
+}
+
+template <typename Lane>
+static uint32_t avx512_masked_sum(const Lane *a, const uint8_t *sk, size_t n, uint32_t q_mask);
+
+template <>
+uint32_t avx512_masked_sum<uint32_t>(const uint32_t *a, const uint8_t *sk, size_t n, uint32_t q_mask)
+{
+    __m512i acc = _mm512_setzero_si512();
+
+    for (size_t i = 0; i < n; i += 16)
+    {
+        size_t count = n - i < 16 ? n - i : 16;
+        __mmask16 m = static_cast<__mmask16>(load_bits(sk, i, count));
+        acc = _mm512_mask_add_epi32(acc, m, acc, _mm512_maskz_loadu_epi32(m, a + i));
+    }
+
+    return static_cast<uint32_t>(_mm512_reduce_add_epi32(acc)) & q_mask;
+}
+
+template <>
+uint32_t avx512_masked_sum<uint16_t>(const uint16_t *a, const uint8_t *sk, size_t n, uint32_t q_mask)
+{
+    __m512i acc = _mm512_setzero_si512();
+
+    for (size_t i = 0; i < n; i += 32)
+    {
+        __mmask32 m = load_bits(sk, i, n - i < 32 ? n - i : 32);
+        acc = _mm512_mask_add_epi16(acc, m, acc, _mm512_maskz_loadu_epi16(m, a + i));
+    }
+
+    return reduce_add_epu16(acc) & q_mask;
+}
+
+template <typename Lane>
+static void avx512_y_table(const Lane *ss_row, uint32_t bpr_bar, uint32_t atil_sum, Lane *y, size_t delta, uint32_t lg_delta, uint32_t q_mask, uint32_t p_mask);
+
+template <>
+void avx512_y_table<uint32_t>(const uint32_t *ss_row, uint32_t bpr_bar, uint32_t atil_sum, uint32_t *y, size_t delta, uint32_t lg_delta, uint32_t q_mask, uint32_t p_mask)
+{
+    const __m512i q = _mm512_set1_epi32(q_mask);
+    const __m512i p = _mm512_set1_epi32(p_mask);
+    const __m512i iota = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m128i shift = _mm_cvtsi32_si128(lg_delta);
+
+    if (delta <= 16)
+    {
+        // the whole row fits in a register: rotate it with a single permutation.
+        __mmask16 lanes = static_cast<__mmask16>(lanes_mask(delta));
+        __m512i row = _mm512_maskz_loadu_epi32(lanes, ss_row);
+        __m512i idx = _mm512_and_si512(_mm512_sub_epi32(iota, _mm512_set1_epi32(bpr_bar)), _mm512_set1_epi32(static_cast<uint32_t>(delta - 1)));
+        __m512i rotated = _mm512_permutexvar_epi32(idx, row);
+
+        __m512i hi = _mm512_srl_epi32(_mm512_and_si512(_mm512_sub_epi32(_mm512_set1_epi32(atil_sum), iota), q), shift);
+        _mm512_mask_storeu_epi32(y, lanes, _mm512_and_si512(_mm512_add_epi32(hi, rotated), p));
+        return;
+    }
+
+    // larger rows: two contiguous runs as in the portable kernel, with masked loads.
+    size_t split = bpr_bar & (delta - 1);
+    for (size_t i = 0; i < delta; i += 16)
+    {
+        // lanes before `split` read from the end of the row, the others from its start.
+        __mmask16 wrap = static_cast<__mmask16>(i >= split ? 0 : lanes_mask(split - i < 16 ? split - i : 16));
+        __m512i rotated = _mm512_maskz_loadu_epi32(static_cast<__mmask16>(~wrap), ss_row + i - split);
+        rotated = _mm512_mask_loadu_epi32(rotated, wrap, ss_row + delta - split + i);
+
+        __m512i index = _mm512_add_epi32(iota, _mm512_set1_epi32(static_cast<uint32_t>(i)));
+        __m512i hi = _mm512_srl_epi32(_mm512_and_si512(_mm512_sub_epi32(_mm512_set1_epi32(atil_sum), index), q), shift);
+        _mm512_storeu_si512(y + i, _mm512_and_si512(_mm512_add_epi32(hi, rotated), p));
+    }
+}
+
+template <>
+void avx512_y_table<uint16_t>(const uint16_t *ss_row, uint32_t bpr_bar, uint32_t atil_sum, uint16_t *y, size_t delta, uint32_t lg_delta, uint32_t q_mask, uint32_t p_mask)
+{
+    const __m512i q = _mm512_set1_epi16(static_cast<short>(q_mask));
+    const __m512i p = _mm512_set1_epi16(static_cast<short>(p_mask));
+    const __m512i iota = _mm512_set_epi16(31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16,
+                                          15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    const __m128i shift = _mm_cvtsi32_si128(lg_delta);
+
+    // atil_sum and the indices are reduced mod q <= 2^16, so 16-bit arithmetic is exact.
+    const __m512i atil = _mm512_set1_epi16(static_cast<short>(atil_sum));
+
+    if (delta <= 32)
+    {
+        __mmask32 lanes = lanes_mask(delta);
+        __m512i row = _mm512_maskz_loadu_epi16(lanes, ss_row);
+        __m512i idx = _mm512_and_si512(_mm512_sub_epi16(iota, _mm512_set1_epi16(static_cast<short>(bpr_bar))), _mm512_set1_epi16(static_cast<short>(delta - 1)));
+        __m512i rotated = _mm512_permutexvar_epi16(idx, row);
+
+        __m512i hi = _mm512_srl_epi16(_mm512_and_si512(_mm512_sub_epi16(atil, iota), q), shift);
+        _mm512_mask_storeu_epi16(y, lanes, _mm512_and_si512(_mm512_add_epi16(hi, rotated), p));
+        return;
+    }
+
+    size_t split = bpr_bar & (delta - 1);
+    for (size_t i = 0; i < delta; i += 32)
+    {
+        __mmask32 wrap = i >= split ? 0 : lanes_mask(split - i < 32 ? split - i : 32);
+        __m512i rotated = _mm512_maskz_loadu_epi16(~wrap, ss_row + i - split);
+        rotated = _mm512_mask_loadu_epi16(rotated, wrap, ss_row + delta - split + i);
+
+        __m512i index = _mm512_add_epi16(iota, _mm512_set1_epi16(static_cast<short>(i)));
+        __m512i hi = _mm512_srl_epi16(_mm512_and_si512(_mm512_sub_epi16(atil, index), q), shift);
+        _mm512_storeu_si512(y + i, _mm512_and_si512(_mm512_add_epi16(hi, rotated), p));
+    }
+}
+
+// Rounds are processed 8 at a time with one accumulator each, so that every mask built from `sk` is reused 8 times.
+template <typename Lane>
+static void avx512_blind_eval_batch(const Lane *e_1, const Lane *rs, const uint8_t *sk, const Lane *ss, const uint32_t *bpr_bar, Lane *y,
+                                    size_t rounds, size_t n, size_t delta, uint32_t lg_delta, uint32_t q_mask, uint32_t p_mask)
+{
+    constexpr size_t group = 8;
+    constexpr size_t width = 64 / sizeof(Lane);
+
+    for (size_t r0 = 0; r0 < rounds; r0 += group)
+    {
+        size_t count_r = rounds - r0 < group ? rounds - r0 : group;
+        __m512i acc[group];
+        for (size_t r = 0; r < group; r++)
+        {
+            acc[r] = _mm512_setzero_si512();
+        }
+
+        for (size_t i = 0; i < n; i += width)
+        {
+            size_t count = n - i < width ? n - i : width;
+            uint32_t lanes = lanes_mask(count);
+            uint32_t m = load_bits(sk, i, count);
+
+            for (size_t r = 0; r < count_r; r++)
+            {
+                const Lane *e_row = e_1 + (r0 + r) * n + i;
+                const Lane *rs_row = rs + (r0 + r) * n + i;
+                if constexpr (sizeof(Lane) == 2)
+                {
+                    acc[r] = _mm512_sub_epi16(acc[r], _mm512_maskz_loadu_epi16(lanes, rs_row));
+                    acc[r] = _mm512_mask_add_epi16(acc[r], m, acc[r], _mm512_maskz_loadu_epi16(m, e_row));
+                }
+                else
+                {
+                    acc[r] = _mm512_sub_epi32(acc[r], _mm512_maskz_loadu_epi32(static_cast<__mmask16>(lanes), rs_row));
+                    acc[r] = _mm512_mask_add_epi32(acc[r], static_cast<__mmask16>(m), acc[r], _mm512_maskz_loadu_epi32(static_cast<__mmask16>(m), e_row));
+                }
+            }
+        }
+
+        for (size_t r = 0; r < count_r; r++)
+        {
+            uint32_t atil_sum = (sizeof(Lane) == 2 ? reduce_add_epu16(acc[r]) : static_cast<uint32_t>(_mm512_reduce_add_epi32(acc[r]))) & q_mask;
+            avx512_y_table<Lane>(ss + (r0 + r) * delta, bpr_bar[r0 + r], atil_sum, y + (r0 + r) * delta, delta, lg_delta, q_mask, p_mask);
+        }
+    }
+}
+
+static void avx512_filter_probe(const uint64_t *buckets, uint64_t bucket_mask, const uint64_t *hashes, size_t count, uint8_t *found)
+{
+    const __m512i mask = _mm512_set1_epi64(static_cast<long long>(bucket_mask));
+    const __m512i alt = _mm512_set1_epi64(0x5bd1e995);
+    const __m512i one = _mm512_set1_epi64(1);
+
+    size_t k = 0;
+    for (; k + 8 <= count; k += 8)
+    {
+        __m512i h = _mm512_loadu_si512(hashes + k);
+
+        // same as `filter_fingerprint` and `filter_alt_bucket`; the fingerprint fits in 32 bits so `vpmuludq` gives the full product.
+        __m512i fp = _mm512_max_epu64(_mm512_srli_epi64(h, 48), one);
+        __m512i i1 = _mm512_and_si512(h, mask);
+        __m512i i2 = _mm512_and_si512(_mm512_xor_si512(i1, _mm512_mul_epu32(fp, alt)), mask);
+
+        __m512i b1 = _mm512_i64gather_epi64(i1, buckets, 8);
+        __m512i b2 = _mm512_i64gather_epi64(i2, buckets, 8);
+
+        // fingerprint repeated in the four 16-bit lanes of each key
+        __m512i fps = _mm512_or_si512(fp, _mm512_slli_epi64(fp, 16));
+        fps = _mm512_or_si512(fps, _mm512_slli_epi64(fps, 32));
+
+        __m512i hits = _mm512_movm_epi16(_mm512_cmpeq_epi16_mask(b1, fps) | _mm512_cmpeq_epi16_mask(b2, fps));
+        __mmask8 hit = _mm512_test_epi64_mask(hits, hits);
+
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(found + k), _mm_maskz_set1_epi8(hit, 1));
+    }
+
+    for (; k < count; k++)
+    {
+        found[k] = filter_probe_one(buckets, bucket_mask, hashes[k]);
+    }
+}
+
+}
+
+#define KERNEL_NAMESPACE kernels_avx512
+#define KERNEL_ISA Isa::Avx512
+#define KERNEL_NAME "avx512"
+#define KERNEL_REQUEST avx512_request
+#define KERNEL_BLIND_EVAL avx512_blind_eval
+#define KERNEL_Y_TABLE avx512_y_table
+#define KERNEL_BLIND_EVAL_BATCH avx512_blind_eval_batch
+#define KERNEL_MASKED_SUM avx512_masked_sum
+#define KERNEL_FILTER_PROBE avx512_filter_probe
+
+#include "kernels_impl.h"
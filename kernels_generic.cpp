@@ -0,0 +1,7 @@
+// Kernels for any x86-64 host, built with the default compiler flags.
+
+#define KERNEL_NAMESPACE kernels_generic
+#define KERNEL_ISA Isa::Generic
+#define KERNEL_NAME "generic"
+
+#include "kernels_impl.h"
@@ -0,0 +1,314 @@
+/*
+Portable implementation of the kernels declared in `kernels.h`.
+
+This file is included by each `kernels_<isa>.cpp` file after defining `KERNEL_NAMESPACE`.
+Each of these translation units is compiled with the matching `-m` flags (see CMakeLists.txt), so that the loops below are
+vectorized with the corresponding instruction set. The loops are written to vectorize well: bits are consumed one byte at a time,
+and selections are done with masks rather than with branches or indexing.
+
+A flavour can replace individual kernels with hand-written ones by defining them in its namespace beforehand and naming them
+with the corresponding `KERNEL_<NAME>` macro, e.g. `KERNEL_BLIND_EVAL`.
+*/
+
+#include "kernels.h"
+
+#include <cstring>
+
+#ifndef KERNEL_NAMESPACE
+#error "KERNEL_NAMESPACE must be defined before including kernels_impl.h"
+#endif
+
+#ifndef KERNEL_REQUEST
+#define KERNEL_REQUEST request
+#endif
+#ifndef KERNEL_BLIND_EVAL
+#define KERNEL_BLIND_EVAL blind_eval
+#endif
+#ifndef KERNEL_Y_TABLE
+#define KERNEL_Y_TABLE y_table
+#endif
+#ifndef KERNEL_BLIND_EVAL_BATCH
+#define KERNEL_BLIND_EVAL_BATCH blind_eval_batch
+#endif
+#ifndef KERNEL_MASKED_SUM
+#define KERNEL_MASKED_SUM masked_sum
+#endif
+#ifndef KERNEL_FILTER_PROBE
+#define KERNEL_FILTER_PROBE filter_probe
+#endif
+
+namespace KERNEL_NAMESPACE
+{
+
+template <typename Lane>
+static void unpack_lo(const void *src, size_t stride, Lane *dst, size_t count)
+{
+    const uint8_t *bytes = static_cast<const uint8_t *>(src);
+    for (size_t i = 0; i < count; i++)
+    {
+        memcpy(&dst[i], bytes + i * stride, sizeof(Lane));
+    }
+}
+
+// ORs the first `nbits` bits of `src` into `dst` starting at bit `offset`.
+static void or_bits_at(const uint8_t *src, size_t nbits, uint8_t *dst, size_t offset)
+{
+    size_t full = nbits / 8;
+    size_t shift = offset & 7;
+    uint8_t *out = dst + (offset >> 3);
+
+    if (shift == 0)
+    {
+        for (size_t k = 0; k < full; k++)
+        {
+            out[k] |= src[k];
+        }
+    }
+    else
+    {
+        for (size_t k = 0; k < full; k++)
+        {
+            out[k] |= static_cast<uint8_t>(src[k] << shift);
+            out[k + 1] |= static_cast<uint8_t>(src[k] >> (8 - shift));
+        }
+    }
+
+    size_t rem = nbits & 7;
+    if (rem)
+    {
+        uint8_t last = src[full] & static_cast<uint8_t>((1u << rem) - 1);
+        out[full] |= static_cast<uint8_t>(last << shift);
+        if (shift + rem > 8)
+        {
+            out[full + 1] |= static_cast<uint8_t>(last >> (8 - shift));
+        }
+    }
+}
+
+static void tile_bits(const uint8_t *src, size_t nbits, size_t reps, uint8_t *dst)
+{
+    memset(dst, 0, (nbits * reps + 7) / 8);
+    for (size_t j = 0; j < reps; j++)
+    {
+        or_bits_at(src, nbits, dst, j * nbits);
+    }
+}
+
+static void scatter_blocks(const void *src, size_t count, size_t stride, void *dst)
+{
+    const uint8_t *in = static_cast<const uint8_t *>(src);
+    uint8_t *out = static_cast<uint8_t *>(dst);
+    for (size_t j = 0; j < count; j++)
+    {
+        memcpy(out + j * stride * 16, in + j * 16, 16);
+    }
+}
+
+[[maybe_unused]] static void filter_probe(const uint64_t *buckets, uint64_t bucket_mask, const uint64_t *hashes, size_t count, uint8_t *found)
+{
+    for (size_t k = 0; k < count; k++)
+    {
+        found[k] = filter_probe_one(buckets, bucket_mask, hashes[k]);
+    }
+}
+
+template <typename Lane>
+static void coeffs_from_bytes(const uint8_t *ro, size_t n, uint32_t q_mask, Lane *a)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        uint32_t word = 0;
+        for (size_t k = 0; k < sizeof(Lane); k++)
+        {
+            word = (word << 8) | ro[sizeof(Lane) * i + k];
+        }
+        a[i] = static_cast<Lane>(word & q_mask);
+    }
+}
+
+template <typename Lane>
+[[maybe_unused]] static uint32_t request(const Lane *a, const Lane *sc0, const Lane *sc1, const uint8_t *b_bar, Lane *e_1, size_t n, uint32_t q_mask)
+{
+    uint32_t c_sum = 0;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        // all ones if b_bar[i] is set
+        uint32_t m = 0u - ((b_bar[i >> 3] >> (i & 7)) & 1u);
+
+        uint32_t chosen = (sc1[i] & m) | (sc0[i] & ~m); // Sc[b_bar[i]]
+        uint32_t other = (sc0[i] & m) | (sc1[i] & ~m);  // Sc[1 - b_bar[i]]
+
+        uint32_t c_i = (0u - chosen) & q_mask;
+        e_1[i] = static_cast<Lane>((a[i] + c_i + other) & q_mask);
+
+        c_sum += c_i;
+    }
+
+    return c_sum & q_mask;
+}
+
+template <typename Lane>
+[[maybe_unused]] static uint32_t blind_eval(const Lane *e_1, const Lane *rs, const uint8_t *sk, size_t n, uint32_t q_mask)
+{
+    uint32_t atil_sum = 0;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        uint32_t m = 0u - ((sk[i >> 3] >> (i & 7)) & 1u);
+        atil_sum += (e_1[i] & m) - static_cast<uint32_t>(rs[i]);
+    }
+
+    return atil_sum & q_mask;
+}
+
+template <typename Lane>
+[[maybe_unused]] static void y_table(const Lane *ss_row, uint32_t bpr_bar, uint32_t atil_sum, Lane *y, size_t delta, uint32_t lg_delta, uint32_t q_mask, uint32_t p_mask)
+{
+    // (i - bpr_bar) mod delta wraps around once, so the rotation is done as two contiguous runs.
+    size_t split = bpr_bar & (delta - 1);
+
+    for (size_t i = 0; i < split; i++)
+    {
+        y[i] = static_cast<Lane>(((((atil_sum - static_cast<uint32_t>(i)) & q_mask) >> lg_delta) + ss_row[delta - split + i]) & p_mask);
+    }
+    for (size_t i = split; i < delta; i++)
+    {
+        y[i] = static_cast<Lane>(((((atil_sum - static_cast<uint32_t>(i)) & q_mask) >> lg_delta) + ss_row[i - split]) & p_mask);
+    }
+}
+
+template <typename Lane>
+[[maybe_unused]] static void blind_eval_batch(const Lane *e_1, const Lane *rs, const uint8_t *sk, const Lane *ss, const uint32_t *bpr_bar, Lane *y,
+                                              size_t rounds, size_t n, size_t delta, uint32_t lg_delta, uint32_t q_mask, uint32_t p_mask)
+{
+    for (size_t r = 0; r < rounds; r++)
+    {
+        uint32_t atil_sum = KERNEL_BLIND_EVAL<Lane>(e_1 + r * n, rs + r * n, sk, n, q_mask);
+        KERNEL_Y_TABLE<Lane>(ss + r * delta, bpr_bar[r], atil_sum, y + r * delta, delta, lg_delta, q_mask, p_mask);
+    }
+}
+
+template <typename Lane>
+[[maybe_unused]] static uint32_t masked_sum(const Lane *a, const uint8_t *sk, size_t n, uint32_t q_mask)
+{
+    uint32_t sum = 0;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        uint32_t m = 0u - ((sk[i >> 3] >> (i & 7)) & 1u);
+        sum += a[i] & m;
+    }
+
+    return sum & q_mask;
+}
+
+template <typename Lane>
+static size_t pack_bits(const Lane *src, size_t count, uint32_t width, uint8_t *dst)
+{
+    if (width == 8)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            dst[i] = static_cast<uint8_t>(src[i]);
+        }
+        return count;
+    }
+    if (width == 16)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            dst[2 * i] = static_cast<uint8_t>(src[i]);
+            dst[2 * i + 1] = static_cast<uint8_t>(src[i] >> 8);
+        }
+        return 2 * count;
+    }
+
+    uint64_t mask = (width == 32) ? 0xffffffffull : ((1ull << width) - 1);
+    uint64_t acc = 0;
+    uint32_t bits = 0;
+    size_t out = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        acc |= (static_cast<uint64_t>(src[i]) & mask) << bits;
+        bits += width;
+        while (bits >= 8)
+        {
+            dst[out++] = static_cast<uint8_t>(acc);
+            acc >>= 8;
+            bits -= 8;
+        }
+    }
+    if (bits)
+    {
+        dst[out++] = static_cast<uint8_t>(acc);
+    }
+
+    return out;
+}
+
+template <typename Lane>
+static void unpack_bits(const uint8_t *src, size_t count, uint32_t width, Lane *dst)
+{
+    if (width == 8)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            dst[i] = src[i];
+        }
+        return;
+    }
+    if (width == 16)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            dst[i] = static_cast<Lane>(src[2 * i] | (src[2 * i + 1] << 8));
+        }
+        return;
+    }
+
+    uint64_t mask = (width == 32) ? 0xffffffffull : ((1ull << width) - 1);
+    uint64_t acc = 0;
+    uint32_t bits = 0;
+    size_t in = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        while (bits < width)
+        {
+            acc |= static_cast<uint64_t>(src[in++]) << bits;
+            bits += 8;
+        }
+        dst[i] = static_cast<Lane>(acc & mask);
+        acc >>= width;
+        bits -= width;
+    }
+}
+
+template <typename Lane>
+static constexpr LaneKernels<Lane> lane_kernels = {
+    unpack_lo<Lane>,
+    coeffs_from_bytes<Lane>,
+    KERNEL_REQUEST<Lane>,
+    KERNEL_BLIND_EVAL<Lane>,
+    KERNEL_Y_TABLE<Lane>,
+    KERNEL_BLIND_EVAL_BATCH<Lane>,
+    KERNEL_MASKED_SUM<Lane>,
+    pack_bits<Lane>,
+    unpack_bits<Lane>,
+};
+
+extern const OnlineKernels table;
+
+const OnlineKernels table = {
+    KERNEL_ISA,
+    KERNEL_NAME,
+    tile_bits,
+    scatter_blocks,
+    KERNEL_FILTER_PROBE,
+    lane_kernels<uint16_t>,
+    lane_kernels<uint32_t>,
+};
+
+}
@@ -0,0 +1,7 @@
+// Kernels for SSE4.1 hosts, built with -msse4.1 (see CMakeLists.txt).
+
+#define KERNEL_NAMESPACE kernels_sse41
+#define KERNEL_ISA Isa::Sse41
+#define KERNEL_NAME "sse4.1"
+
+#include "kernels_impl.h"
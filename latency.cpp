@@ -0,0 +1,241 @@
+#include "latency.h"
+#include "log.h"
+
+#include <pthread.h>
+
+#include <cinttypes>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <sstream>
+
+namespace latency_detail
+{
+
+std::atomic<bool> enabled{false};
+
+namespace
+{
+
+// Histograms of one thread, for every stage. Counts are only written by the owning thread and read by the exporter.
+struct ThreadHistograms
+{
+    std::unique_ptr<std::atomic<uint64_t>[]> counts{new std::atomic<uint64_t>[NumLatencyStages * latency_buckets]()};
+};
+
+std::mutex registry_mutex;
+std::vector<std::unique_ptr<ThreadHistograms>> registry;
+
+// Histograms of threads that exited. Snapshots add up the counts of every thread, so the next threads that record can add theirs
+// to them, and there are only as many histograms as threads recording at once.
+std::vector<ThreadHistograms *> spare_histograms;
+
+// Gives the histograms of a thread back when the thread exits.
+struct HistogramsOwner
+{
+    ThreadHistograms *histograms = nullptr;
+
+    ~HistogramsOwner()
+    {
+        if (histograms)
+        {
+            std::lock_guard<std::mutex> lock(registry_mutex);
+            spare_histograms.push_back(histograms);
+            histograms = nullptr;
+        }
+    }
+};
+
+ThreadHistograms &thread_histograms()
+{
+    thread_local HistogramsOwner owner;
+    if (!owner.histograms)
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        if (spare_histograms.empty())
+        {
+            registry.push_back(std::make_unique<ThreadHistograms>());
+            owner.histograms = registry.back().get();
+        }
+        else
+        {
+            owner.histograms = spare_histograms.back();
+            spare_histograms.pop_back();
+        }
+    }
+    return *owner.histograms;
+}
+
+}
+
+void record(LatencyStage stage, uint64_t ns, uint64_t count)
+{
+    std::atomic<uint64_t> &counter = thread_histograms().counts[stage * latency_buckets + LatencyHistogram::bucket(ns)];
+    // a single writer, so no locked increment is needed
+    counter.store(counter.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+}
+
+}
+
+LatencyHistograms latency_snapshot()
+{
+    using namespace latency_detail;
+
+    LatencyHistograms histograms;
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    for (const std::unique_ptr<ThreadHistograms> &thread : registry)
+    {
+        for (int stage = 0; stage < NumLatencyStages; stage++)
+        {
+            for (size_t i = 0; i < latency_buckets; i++)
+            {
+                uint64_t count = thread->counts[stage * latency_buckets + i].load(std::memory_order_relaxed);
+                if (count)
+                {
+                    histograms[stage].add(i, count);
+                }
+            }
+        }
+    }
+    return histograms;
+}
+
+bool read_latency_log(const std::string &path, LatencyHistograms &histograms)
+{
+    std::ifstream log(path);
+    if (!log)
+    {
+        return false;
+    }
+
+    for (std::string line; std::getline(log, line);)
+    {
+        size_t stage_at = line.find("\"stage\":\"");
+        size_t buckets_at = line.find("\"buckets\":[");
+        if (stage_at == std::string::npos || buckets_at == std::string::npos)
+        {
+            continue;
+        }
+
+        stage_at += 9;
+        std::string name = line.substr(stage_at, line.find('"', stage_at) - stage_at);
+        int stage = 0;
+        while (stage < NumLatencyStages && name != latency_stage_name(stage))
+        {
+            stage++;
+        }
+        if (stage == NumLatencyStages)
+        {
+            continue;
+        }
+
+        buckets_at += 11;
+        std::string buckets = line.substr(buckets_at, line.find(']', buckets_at) - buckets_at);
+        std::replace(buckets.begin(), buckets.end(), ',', ' ');
+        std::istringstream values(buckets);
+        size_t index;
+        uint64_t count;
+        while (values >> index >> count)
+        {
+            if (index < latency_buckets)
+            {
+                histograms[stage].add(index, count);
+            }
+        }
+    }
+    return true;
+}
+
+void log_latency(const LatencyHistograms &histograms)
+{
+    for (int stage = 0; stage < NumLatencyStages; stage++)
+    {
+        const LatencyHistogram &h = histograms[stage];
+        if (h.count())
+        {
+            LOG_INFO("latency {}: {} evaluations, p50 {}µs, p99 {}µs, p99.9 {}µs, max {}µs", latency_stage_name(stage), h.count(), h.percentile(0.5) / 1e3,
+                     h.percentile(0.99) / 1e3, h.percentile(0.999) / 1e3, h.max() / 1e3);
+        }
+    }
+}
+
+void LatencySession::start(const std::string &log_path, double interval)
+{
+    path = log_path;
+    interval_s = interval;
+    start_time = std::chrono::steady_clock::now();
+    std::ofstream(path, std::ios::trunc);
+    latency_detail::enabled = true;
+
+    exporter = std::thread([this]
+                           {
+        // named so that the CPU accounting of stats.h can leave it out
+        pthread_setname_np(pthread_self(), "oprf-latency");
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopping.wait_for(lock, std::chrono::duration<double>(interval_s), [this] { return stopped; }))
+        {
+            lock.unlock();
+            export_interval();
+            lock.lock();
+        } });
+}
+
+LatencySession::~LatencySession()
+{
+    if (path.empty())
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopped = true;
+    }
+    stopping.notify_one();
+    exporter.join();
+    latency_detail::enabled = false;
+
+    export_interval();
+    log_latency(latency_snapshot());
+}
+
+// Appends the values recorded since the previous export.
+void LatencySession::export_interval()
+{
+    LatencyHistograms snapshot = latency_snapshot();
+    double time_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+    std::ofstream log(path, std::ios::app);
+    for (int stage = 0; stage < NumLatencyStages; stage++)
+    {
+        LatencyHistogram interval = snapshot[stage];
+        interval.subtract(exported[stage]);
+        if (!interval.count())
+        {
+            continue;
+        }
+
+        char head[256];
+        snprintf(head, sizeof(head),
+                 "{\"time_s\":%.3f,\"stage\":\"%s\",\"count\":%" PRIu64 ",\"p50_ns\":%" PRIu64 ",\"p99_ns\":%" PRIu64 ",\"p999_ns\":%" PRIu64
+                 ",\"max_ns\":%" PRIu64 ",\"buckets\":[",
+                 time_s, latency_stage_name(stage), interval.count(), interval.percentile(0.5), interval.percentile(0.99), interval.percentile(0.999), interval.max());
+        log << head;
+        bool first = true;
+        for (size_t i = 0; i < latency_buckets; i++)
+        {
+            if (interval.at(i))
+            {
+                log << (first ? "" : ",") << i << "," << interval.at(i);
+                first = false;
+            }
+        }
+        log << "]}\n";
+    }
+    exported = snapshot;
+
+    if (!log)
+    {
+        LOG_ERROR("Could not write the latency histograms to {}", path);
+    }
+}
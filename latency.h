@@ -0,0 +1,225 @@
+/*
+Latency histograms of the online evaluations, by stage.
+
+The stages are the Request of the client, the network round trip of a batch as the client sees it (from sending the requests to receiving
+the responses, so the server's time is included), the BlindEval of the server, the Finalize of the client, and the end-to-end time of an
+evaluation from the start of its Request to the end of its Finalize. For evaluations made in batches, every evaluation of a batch is
+recorded with the mean BlindEval and Finalize time of the batch and with the round trip of the batch, and ends with the Finalize of the batch.
+
+Histograms are log-linear, as in HdrHistogram: values below 2^latency_sub_bucket_bits ns are counted exactly, and larger ones in buckets
+of 1/2^(latency_sub_bucket_bits - 1) of their lower bound, so that percentiles are within 1.6% of the exact value. Each thread records to
+histograms of its own, handed to a later thread once it exits, so that a value costs a count of leading zeros and an increment, and nothing
+when recording is off. Histograms are merged by adding their counts: `latency_snapshot` merges those of every thread, and `read_latency_log`
+those of logs written by other processes.
+
+`LatencySession` appends the histograms of every interval to a log, one JSON line per stage with the index and count of its non-empty buckets:
+
+    {"time_s":1.000,"stage":"request","count":8192,"p50_ns":..,"p99_ns":..,"p999_ns":..,"max_ns":..,"buckets":[index,count,index,count,...]}
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum LatencyStage
+{
+    LatencyRequest,
+    LatencyNetwork,
+    LatencyBlindEval,
+    LatencyFinalize,
+    LatencyEndToEnd,
+    NumLatencyStages,
+};
+
+const unsigned latency_sub_bucket_bits = 7;
+const size_t latency_half_buckets = size_t(1) << (latency_sub_bucket_bits - 1);
+const size_t latency_buckets = (66 - latency_sub_bucket_bits) * latency_half_buckets;
+
+class LatencyHistogram
+{
+public:
+    // Bucket counting a value: the value itself below 2^latency_sub_bucket_bits, and otherwise its shift followed by its top bits.
+    static size_t bucket(uint64_t ns)
+    {
+        if (ns < (uint64_t(1) << latency_sub_bucket_bits))
+        {
+            return ns;
+        }
+        unsigned shift = 64 - __builtin_clzll(ns) - latency_sub_bucket_bits;
+        return shift * latency_half_buckets + (ns >> shift);
+    }
+
+    // Largest value counted in a bucket.
+    static uint64_t highest_value(size_t index)
+    {
+        if (index < 2 * latency_half_buckets)
+        {
+            return index;
+        }
+        size_t shift = index / latency_half_buckets - 1;
+        uint64_t top = index - shift * latency_half_buckets;
+        return ((top + 1) << shift) - 1;
+    }
+
+    void record(uint64_t ns, uint64_t count = 1)
+    {
+        counts[bucket(ns)] += count;
+    }
+
+    uint64_t at(size_t index) const
+    {
+        return counts[index];
+    }
+
+    void add(size_t index, uint64_t count)
+    {
+        counts[index] += count;
+    }
+
+    void merge(const LatencyHistogram &other)
+    {
+        for (size_t i = 0; i < latency_buckets; i++)
+        {
+            counts[i] += other.counts[i];
+        }
+    }
+
+    // Removes the counts of an earlier snapshot of the same histogram.
+    void subtract(const LatencyHistogram &earlier)
+    {
+        for (size_t i = 0; i < latency_buckets; i++)
+        {
+            counts[i] -= earlier.counts[i];
+        }
+    }
+
+    uint64_t count() const
+    {
+        uint64_t total = 0;
+        for (uint64_t c : counts)
+        {
+            total += c;
+        }
+        return total;
+    }
+
+    // Value at or below which a fraction `q` of the values are, e.g. 0.99 for p99, or 0 if there are none.
+    uint64_t percentile(double q) const
+    {
+        uint64_t total = count();
+        if (total == 0)
+        {
+            return 0;
+        }
+        uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(q * total + 0.5));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < latency_buckets; i++)
+        {
+            seen += counts[i];
+            if (seen >= rank)
+            {
+                return highest_value(i);
+            }
+        }
+        return highest_value(latency_buckets - 1);
+    }
+
+    uint64_t max() const
+    {
+        for (size_t i = latency_buckets; i-- > 0;)
+        {
+            if (counts[i])
+            {
+                return highest_value(i);
+            }
+        }
+        return 0;
+    }
+
+private:
+    std::vector<uint64_t> counts = std::vector<uint64_t>(latency_buckets);
+};
+
+using LatencyHistograms = std::array<LatencyHistogram, NumLatencyStages>;
+
+namespace latency_detail
+{
+
+extern std::atomic<bool> enabled;
+
+void record(LatencyStage stage, uint64_t ns, uint64_t count);
+
+}
+
+inline const char *latency_stage_name(int stage)
+{
+    static const char *names[] = {"request", "network", "blind eval", "finalize", "end to end"};
+    return names[stage];
+}
+
+inline bool latency_enabled()
+{
+    return latency_detail::enabled.load(std::memory_order_relaxed);
+}
+
+// Time in ns on the steady clock, or 0 if recording is off, so that timing a stage costs nothing then.
+inline uint64_t latency_now()
+{
+    if (!latency_enabled())
+    {
+        return 0;
+    }
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Records `count` evaluations that took `ns` in `stage`, if recording is on.
+inline void record_latency(LatencyStage stage, uint64_t ns, uint64_t count = 1)
+{
+    if (latency_enabled())
+    {
+        latency_detail::record(stage, ns, count);
+    }
+}
+
+// The histograms of every thread so far, merged.
+LatencyHistograms latency_snapshot();
+
+// Adds the buckets of every line of a log written by a `LatencySession` to `histograms`. Returns false if the log cannot be read.
+bool read_latency_log(const std::string &path, LatencyHistograms &histograms);
+
+// Logs the count and percentiles of every stage that has values.
+void log_latency(const LatencyHistograms &histograms);
+
+// Records latencies from `start` until the session ends, and appends the histograms of every `interval_s` seconds to the log at the given path.
+// Logs the percentiles of the whole session when it ends.
+class LatencySession
+{
+public:
+    LatencySession() = default;
+    ~LatencySession();
+    LatencySession(const LatencySession &) = delete;
+    LatencySession &operator=(const LatencySession &) = delete;
+
+    void start(const std::string &path, double interval_s);
+
+private:
+    std::string path;
+    double interval_s = 0;
+    std::chrono::steady_clock::time_point start_time;
+    std::mutex mutex;
+    std::condition_variable stopping;
+    bool stopped = false;
+    std::thread exporter;
+    LatencyHistograms exported;
+
+    void export_interval();
+};
@@ -0,0 +1,253 @@
+/*
+Emulated network link between the two parties of a phase, for network-bound measures on a single host.
+
+A `LinkEmulator` accepts TCP connections on a local port and relays each of them to the party listening on another local port. The traffic
+of each direction goes through a link of its own with the given one-way latency and bandwidth: a chunk read by the relay at time t leaves
+the link once the previous chunk has left and its own bytes have been serialized at the bandwidth, and is delivered `latency` later.
+Chunks are the reads of the relay, of at most `link_chunk_bytes`, so that a long message streams through the link instead of being
+delayed as a whole. Losses and reordering are not emulated.
+
+The emulator also counts the traffic it relays in each direction: bytes, reads, and flights, a flight being a run of reads in one direction
+of a connection ended by a read in the other. In a protocol where each party waits for the other, the flights are its messages in turn and
+half of them, rounded up, its round trips.
+*/
+
+#pragma once
+
+#include "log.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+const size_t link_chunk_bytes = 16 << 10;
+
+// Traffic relayed by a `LinkEmulator` over all its connections, from the client to the server (index 0) and back (index 1).
+struct LinkTraffic
+{
+    uint64_t bytes[2] = {};
+    uint64_t reads[2] = {};
+    uint64_t flights[2] = {};
+};
+
+class LinkEmulator
+{
+public:
+    // Relays the connections made to `port` to `target_port`, both on 127.0.0.1. A bandwidth of 0 is unlimited.
+    LinkEmulator(uint16_t port, uint16_t target_port, double latency_ms, double mbps)
+        : target_port(target_port), latency(std::chrono::duration_cast<Duration>(std::chrono::duration<double, std::milli>(latency_ms))),
+          ns_per_byte(mbps > 0 ? 8e3 / mbps : 0)
+    {
+        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        int on = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        sockaddr_in address = loopback(port);
+        if (bind(listen_fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(listen_fd, 16) != 0)
+        {
+            LOG_ERROR("Could not listen on port {} for the emulated link: {}", port, strerror(errno));
+            return;
+        }
+
+        LOG_INFO("Emulating a link of {}ms and {} Mbit/s from port {} to port {}", latency_ms, mbps, port, target_port);
+        acceptor = std::thread([this]
+                               { accept_connections(); });
+    }
+
+    // Stops accepting connections and waits for the open ones to be closed by the parties.
+    ~LinkEmulator()
+    {
+        shutdown(listen_fd, SHUT_RDWR);
+        close(listen_fd);
+        if (acceptor.joinable())
+        {
+            acceptor.join();
+        }
+        for (std::thread &connection : connections)
+        {
+            connection.join();
+        }
+    }
+
+    LinkEmulator(const LinkEmulator &) = delete;
+    LinkEmulator &operator=(const LinkEmulator &) = delete;
+
+    LinkTraffic traffic() const
+    {
+        std::lock_guard<std::mutex> lock(traffic_mutex);
+        return totals;
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+    using Duration = Clock::duration;
+
+    struct Chunk
+    {
+        Clock::time_point delivery;
+        std::vector<char> data;
+    };
+
+    uint16_t target_port;
+    Duration latency;
+    double ns_per_byte;
+    int listen_fd;
+    std::thread acceptor;
+    std::vector<std::thread> connections;
+    mutable std::mutex traffic_mutex;
+    LinkTraffic totals;
+
+    static sockaddr_in loopback(uint16_t port)
+    {
+        sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        return address;
+    }
+
+    void accept_connections()
+    {
+        for (;;)
+        {
+            int client_fd = accept(listen_fd, nullptr, nullptr);
+            if (client_fd < 0)
+            {
+                // the listening socket was shut down
+                return;
+            }
+            connections.emplace_back([this, client_fd]
+                                     { relay(client_fd); });
+        }
+    }
+
+    // Connects to the target, which may not listen yet, and forwards both directions until both are closed.
+    void relay(int client_fd)
+    {
+        int target_fd = -1;
+        sockaddr_in address = loopback(target_port);
+        for (int attempt = 0; attempt < 1000 && target_fd < 0; attempt++)
+        {
+            target_fd = socket(AF_INET, SOCK_STREAM, 0);
+            if (connect(target_fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0)
+            {
+                close(target_fd);
+                target_fd = -1;
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        }
+        if (target_fd < 0)
+        {
+            LOG_ERROR("The emulated link could not connect to port {}", target_port);
+            close(client_fd);
+            return;
+        }
+
+        // the delays are the link's, not those of Nagle's algorithm on the relay
+        int on = 1;
+        setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        setsockopt(target_fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+        // direction of the last read on this connection, for the flights
+        int last_direction = -1;
+        std::thread upstream([&]
+                             { forward(client_fd, target_fd, 0, last_direction); });
+        forward(target_fd, client_fd, 1, last_direction);
+        upstream.join();
+
+        close(client_fd);
+        close(target_fd);
+    }
+
+    void count(int direction, size_t bytes, int &last_direction)
+    {
+        std::lock_guard<std::mutex> lock(traffic_mutex);
+        totals.bytes[direction] += bytes;
+        totals.reads[direction]++;
+        if (last_direction != direction)
+        {
+            totals.flights[direction]++;
+            last_direction = direction;
+        }
+    }
+
+    // Forwards what is received from `from` to `to` through one direction of the link, until `from` closes.
+    // Chunks are read as they arrive, so that the sender is not slowed down by the latency, and written by another thread when delivered.
+    void forward(int from, int to, int direction, int &last_direction)
+    {
+        std::mutex mutex;
+        std::condition_variable ready;
+        std::deque<Chunk> in_flight;
+        bool closed = false;
+
+        std::thread writer([&]
+                           {
+            for (;;)
+            {
+                Chunk chunk;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    ready.wait(lock, [&] { return !in_flight.empty() || closed; });
+                    if (in_flight.empty())
+                    {
+                        break;
+                    }
+                    chunk = std::move(in_flight.front());
+                    in_flight.pop_front();
+                }
+
+                std::this_thread::sleep_until(chunk.delivery);
+                size_t written = 0;
+                while (written < chunk.data.size())
+                {
+                    ssize_t n = send(to, chunk.data.data() + written, chunk.data.size() - written, MSG_NOSIGNAL);
+                    if (n <= 0)
+                    {
+                        break;
+                    }
+                    written += n;
+                }
+            }
+            shutdown(to, SHUT_WR); });
+
+        // time at which the last chunk read has left the link
+        Clock::time_point link_free = Clock::now();
+        std::vector<char> buffer(link_chunk_bytes);
+        for (;;)
+        {
+            ssize_t n = recv(from, buffer.data(), buffer.size(), 0);
+            if (n <= 0)
+            {
+                break;
+            }
+            count(direction, n, last_direction);
+
+            Duration serialization = std::chrono::duration_cast<Duration>(std::chrono::duration<double, std::nano>(n * ns_per_byte));
+            link_free = std::max(link_free, Clock::now()) + serialization;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                in_flight.push_back({link_free + latency, std::vector<char>(buffer.begin(), buffer.begin() + n)});
+            }
+            ready.notify_one();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        ready.notify_one();
+        writer.join();
+    }
+};
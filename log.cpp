@@ -0,0 +1,488 @@
+#include "log.h"
+
+#include <pthread.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <thread>
+#include <vector>
+
+namespace log_detail
+{
+
+std::atomic<LogLevel> min_level{LogLevel::Info};
+std::atomic<uint32_t> sample_period{1};
+
+namespace
+{
+
+// per-thread buffer size: about 10k records of typical size
+constexpr uint32_t buffer_size = 1 << 20;
+
+// size field of the marker skipping the end of the buffer when a record does not fit before it
+constexpr uint32_t wrap_marker = 0xffffffff;
+
+std::atomic<bool> json_output{false};
+
+// Single-producer single-consumer ring of records: `head` is only written by the owning thread and `tail` by the background thread.
+struct LogBuffer
+{
+    std::unique_ptr<uint8_t[]> data{new uint8_t[buffer_size]};
+    std::atomic<uint64_t> head{0};
+    std::atomic<uint64_t> tail{0};
+    std::atomic<uint64_t> dropped{0};
+    uint32_t thread_index;
+
+    // set when the owning thread exits; the buffer is reused once the background thread has emptied it
+    std::atomic<bool> retired{false};
+};
+
+// number of emptied buffers kept for reuse, the others are freed
+constexpr size_t max_spare_buffers = 8;
+
+std::mutex registry_mutex;
+
+// buffers of live threads, and of exited threads which still have records
+std::vector<std::unique_ptr<LogBuffer>> registry;
+std::vector<std::unique_ptr<LogBuffer>> spare_buffers;
+uint32_t next_thread_index = 0;
+
+// records dropped by buffers no longer in the registry
+uint64_t retired_dropped = 0;
+
+// Retires the buffer of a thread when the thread exits.
+struct BufferOwner
+{
+    LogBuffer *buffer = nullptr;
+
+    ~BufferOwner()
+    {
+        if (buffer)
+        {
+            buffer->retired.store(true, std::memory_order_release);
+            buffer = nullptr;
+        }
+    }
+};
+
+LogBuffer &thread_buffer()
+{
+    thread_local BufferOwner owner;
+    if (!owner.buffer)
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        std::unique_ptr<LogBuffer> buffer;
+        if (spare_buffers.empty())
+        {
+            buffer = std::make_unique<LogBuffer>();
+        }
+        else
+        {
+            buffer = std::move(spare_buffers.back());
+            spare_buffers.pop_back();
+            buffer->retired.store(false, std::memory_order_relaxed);
+        }
+        buffer->thread_index = next_thread_index++;
+        owner.buffer = buffer.get();
+        registry.push_back(std::move(buffer));
+    }
+    return *owner.buffer;
+}
+
+const auto start_time = std::chrono::steady_clock::now();
+
+}
+
+uint64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_time).count();
+}
+
+uint8_t *reserve(uint32_t size)
+{
+    LogBuffer &buffer = thread_buffer();
+    uint64_t head = buffer.head.load(std::memory_order_relaxed);
+    uint64_t tail = buffer.tail.load(std::memory_order_acquire);
+
+    uint32_t offset = head % buffer_size;
+    uint32_t before_end = buffer_size - offset;
+    uint64_t needed = size <= before_end ? size : before_end + size;
+    if (needed > buffer_size - (head - tail))
+    {
+        buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    if (size > before_end)
+    {
+        memcpy(buffer.data.get() + offset, &wrap_marker, sizeof(wrap_marker));
+        buffer.head.store(head + before_end, std::memory_order_release);
+        offset = 0;
+    }
+    return buffer.data.get() + offset;
+}
+
+void commit(uint32_t size)
+{
+    LogBuffer &buffer = thread_buffer();
+    buffer.head.store(buffer.head.load(std::memory_order_relaxed) + size, std::memory_order_release);
+}
+
+namespace
+{
+
+struct Arg
+{
+    ArgType type;
+    union
+    {
+        int64_t i;
+        uint64_t u;
+        double d;
+    };
+    std::string s;
+};
+
+struct Record
+{
+    uint64_t time_ns;
+    uint32_t thread_index;
+    const LogSite *site;
+    std::vector<Arg> args;
+};
+
+std::string to_string(const Arg &arg)
+{
+    char text[32];
+    switch (arg.type)
+    {
+    case ArgType::Int:
+        snprintf(text, sizeof(text), "%lld", static_cast<long long>(arg.i));
+        return text;
+    case ArgType::Uint:
+        snprintf(text, sizeof(text), "%llu", static_cast<unsigned long long>(arg.u));
+        return text;
+    case ArgType::Double:
+        // as printed by std::ostream by default
+        snprintf(text, sizeof(text), "%g", arg.d);
+        return text;
+    default:
+        return arg.s;
+    }
+}
+
+std::string json_string(const std::string &s)
+{
+    std::string out = "\"";
+    for (char c : s)
+    {
+        switch (c)
+        {
+        case '"':
+            out += "\\\"";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        case '\n':
+            out += "\\n";
+            break;
+        case '\t':
+            out += "\\t";
+            break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20)
+            {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                out += escaped;
+            }
+            else
+            {
+                out += c;
+            }
+        }
+    }
+    return out + "\"";
+}
+
+const char *level_name(LogLevel level)
+{
+    static const char *names[] = {"debug", "info", "warn", "error"};
+    return names[static_cast<int>(level)];
+}
+
+// Replaces each `{}` of the format string by the next argument.
+std::string format_message(const Record &record)
+{
+    std::string out;
+    size_t next = 0;
+    for (const char *c = record.site->format; *c; c++)
+    {
+        if (c[0] == '{' && c[1] == '}' && next < record.args.size())
+        {
+            out += to_string(record.args[next++]);
+            c++;
+        }
+        else
+        {
+            out += *c;
+        }
+    }
+    return out;
+}
+
+std::string format_json(const Record &record)
+{
+    const char *file = strrchr(record.site->file, '/');
+    file = file ? file + 1 : record.site->file;
+
+    // leading and trailing line breaks only lay out the text output
+    std::string message = format_message(record);
+    message.erase(0, message.find_first_not_of('\n'));
+    message.erase(message.find_last_not_of('\n') + 1);
+
+    char prefix[128];
+    snprintf(prefix, sizeof(prefix), "{\"t_us\":%.3f,\"level\":\"%s\",\"thread\":%u,\"site\":\"%s:%d\",\"msg\":", record.time_ns / 1e3,
+             level_name(record.site->level), record.thread_index, file, record.site->line);
+
+    std::string out = prefix + json_string(message) + ",\"args\":[";
+    for (size_t k = 0; k < record.args.size(); k++)
+    {
+        out += k ? "," : "";
+        out += record.args[k].type == ArgType::String ? json_string(record.args[k].s) : to_string(record.args[k]);
+    }
+    return out + "]}";
+}
+
+Arg decode_arg(const uint8_t *&p)
+{
+    Arg arg;
+    arg.type = static_cast<ArgType>(*p++);
+    if (arg.type == ArgType::String)
+    {
+        uint32_t len;
+        memcpy(&len, p, sizeof(len));
+        arg.s.assign(reinterpret_cast<const char *>(p + sizeof(len)), len);
+        p += sizeof(len) + len;
+    }
+    else
+    {
+        memcpy(&arg.u, p, 8);
+        p += 8;
+    }
+    return arg;
+}
+
+// Moves the records published so far out of a buffer.
+void take_records(LogBuffer &buffer, std::vector<Record> &records)
+{
+    uint64_t tail = buffer.tail.load(std::memory_order_relaxed);
+    uint64_t head = buffer.head.load(std::memory_order_acquire);
+
+    while (tail < head)
+    {
+        const uint8_t *p = buffer.data.get() + tail % buffer_size;
+        RecordHeader header;
+        memcpy(&header.size, p, sizeof(header.size));
+        if (header.size == wrap_marker)
+        {
+            tail += buffer_size - tail % buffer_size;
+            continue;
+        }
+
+        memcpy(&header, p, sizeof(header));
+        Record record{header.time_ns, buffer.thread_index, header.site, {}};
+        const uint8_t *arg = p + sizeof(header);
+        for (uint32_t k = 0; k < header.num_args; k++)
+        {
+            record.args.push_back(decode_arg(arg));
+        }
+        records.push_back(std::move(record));
+        tail += header.size;
+    }
+
+    buffer.tail.store(tail, std::memory_order_release);
+}
+
+// Writes the pending records of every thread, in time order.
+void drain()
+{
+    std::vector<Record> records;
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        for (size_t i = 0; i < registry.size();)
+        {
+            LogBuffer &buffer = *registry[i];
+            // read before taking the records, so that none written before the thread exited are left behind
+            bool retired = buffer.retired.load(std::memory_order_acquire);
+            take_records(buffer, records);
+            if (!retired || buffer.tail.load(std::memory_order_relaxed) != buffer.head.load(std::memory_order_acquire))
+            {
+                ++i;
+                continue;
+            }
+
+            retired_dropped += buffer.dropped.exchange(0, std::memory_order_relaxed);
+            if (spare_buffers.size() < max_spare_buffers)
+            {
+                spare_buffers.push_back(std::move(registry[i]));
+            }
+            registry[i] = std::move(registry.back());
+            registry.pop_back();
+        }
+    }
+    if (records.empty())
+    {
+        return;
+    }
+
+    std::stable_sort(records.begin(), records.end(), [](const Record &a, const Record &b) { return a.time_ns < b.time_ns; });
+    for (const Record &record : records)
+    {
+        std::string line = json_output ? format_json(record) : format_message(record);
+        line += '\n';
+        fwrite(line.data(), 1, line.size(), record.site->level >= LogLevel::Warn ? stderr : stdout);
+    }
+    fflush(stdout);
+    fflush(stderr);
+}
+
+std::atomic<bool> running{false};
+std::thread writer;
+
+std::atomic<uint64_t> io_violations{0};
+
+// Stream buffer in front of std::cout and std::cerr that counts the writes made under a NoIoGuard, and passes everything through.
+class GuardedStreambuf : public std::streambuf
+{
+public:
+    explicit GuardedStreambuf(std::streambuf *target) : target(target)
+    {
+    }
+
+    std::streambuf *target;
+
+protected:
+    int overflow(int c) override
+    {
+        check();
+        return c == traits_type::eof() ? traits_type::not_eof(c) : target->sputc(static_cast<char>(c));
+    }
+
+    std::streamsize xsputn(const char *s, std::streamsize count) override
+    {
+        check();
+        return target->sputn(s, count);
+    }
+
+    int sync() override
+    {
+        return target->pubsync();
+    }
+
+private:
+    void check()
+    {
+        if (NoIoGuard::active())
+        {
+            io_violations.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+};
+
+std::unique_ptr<GuardedStreambuf> guarded_cout, guarded_cerr;
+
+}
+
+}
+
+thread_local int NoIoGuard::depth = 0;
+
+uint64_t NoIoGuard::violations()
+{
+    return log_detail::io_violations.load(std::memory_order_relaxed);
+}
+
+LogSession::LogSession()
+{
+    using namespace log_detail;
+
+    guarded_cout = std::make_unique<GuardedStreambuf>(std::cout.rdbuf());
+    guarded_cerr = std::make_unique<GuardedStreambuf>(std::cerr.rdbuf());
+    std::cout.rdbuf(guarded_cout.get());
+    std::cerr.rdbuf(guarded_cerr.get());
+
+    running = true;
+    writer = std::thread([] {
+        // named so that the CPU accounting of stats.h can leave it out
+        pthread_setname_np(pthread_self(), "oprf-log");
+        while (running.load(std::memory_order_relaxed))
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            drain();
+        }
+    });
+}
+
+LogSession::~LogSession()
+{
+    using namespace log_detail;
+
+    running = false;
+    writer.join();
+
+    uint64_t dropped = retired_dropped;
+    for (auto &buffer : registry)
+    {
+        dropped += buffer->dropped.load(std::memory_order_relaxed);
+    }
+    if (dropped)
+    {
+        LOG_WARN("{} log records dropped (buffers full)", dropped);
+    }
+    if (NoIoGuard::violations())
+    {
+        LOG_ERROR("{} writes to std::cout or std::cerr from a section without I/O", NoIoGuard::violations());
+    }
+    drain();
+
+    std::cout.flush();
+    std::cerr.flush();
+    std::cout.rdbuf(guarded_cout->target);
+    std::cerr.rdbuf(guarded_cerr->target);
+}
+
+bool set_log_level(const std::string &name)
+{
+    static const char *names[] = {"debug", "info", "warn", "error"};
+    for (int level = 0; level < 4; level++)
+    {
+        if (name == names[level])
+        {
+            log_detail::min_level = static_cast<LogLevel>(level);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool set_log_format(const std::string &name)
+{
+    if (name != "text" && name != "json")
+    {
+        return false;
+    }
+    log_detail::json_output = name == "json";
+    return true;
+}
+
+void set_log_sample(uint32_t period)
+{
+    log_detail::sample_period = period;
+}
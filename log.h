@@ -0,0 +1,228 @@
+/*
+Asynchronous structured logging.
+
+A log call only copies its arguments into a buffer owned by the calling thread: each record holds a pointer to its static call site
+(level, format string, file and line) followed by the arguments in binary form. A background thread drains the buffers of every thread
+every millisecond, and formats and writes the records, so that neither formatting nor I/O happens on the calling thread.
+When a buffer is full, records are dropped rather than waiting; the number of dropped records is reported when logging stops.
+
+Format strings use `{}` for each argument. Arguments are integers, floating-point numbers and strings (copied, so they need not outlive the call).
+Records are written as text, one line per record as the format string reads, or as JSON lines with the arguments as separate fields.
+
+Call sites declared with `LOG_SAMPLED_*` only keep one record out of `--log-sample=N`, for per-evaluation messages.
+
+`NoIoGuard` marks a scope that must not do any console I/O, e.g. the online algorithms. Writes to `std::cout` or `std::cerr` made
+from such a scope are counted and reported as errors when logging stops; log calls are fine since they do no I/O.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+enum class LogLevel : uint8_t
+{
+    Debug,
+    Info,
+    Warn,
+    Error,
+};
+
+struct LogSite
+{
+    LogLevel level;
+    const char *format;
+    const char *file;
+    int line;
+    bool sampled;
+    std::atomic<uint64_t> hits{0};
+};
+
+namespace log_detail
+{
+
+enum class ArgType : uint8_t
+{
+    Int,
+    Uint,
+    Double,
+    String,
+};
+
+struct RecordHeader
+{
+    uint32_t size;
+    uint32_t num_args;
+    const LogSite *site;
+    uint64_t time_ns;
+};
+
+extern std::atomic<LogLevel> min_level;
+extern std::atomic<uint32_t> sample_period;
+
+uint64_t now_ns();
+
+// Reserves `size` bytes in the buffer of the calling thread, or returns nullptr if it is full. `commit` publishes them.
+uint8_t *reserve(uint32_t size);
+void commit(uint32_t size);
+
+// strings are stored as their length on 4 bytes followed by their characters
+inline size_t encoded_size(std::string_view s)
+{
+    return 1 + sizeof(uint32_t) + s.size();
+}
+
+// numbers are stored on 8 bytes after their type
+template <typename T>
+size_t encoded_size(const T &)
+{
+    return 1 + 8;
+}
+
+inline void encode(uint8_t *&p, std::string_view s)
+{
+    *p++ = static_cast<uint8_t>(ArgType::String);
+    uint32_t len = static_cast<uint32_t>(s.size());
+    memcpy(p, &len, sizeof(len));
+    memcpy(p + sizeof(len), s.data(), len);
+    p += sizeof(len) + len;
+}
+
+template <typename T>
+void encode(uint8_t *&p, const T &v)
+{
+    static_assert(std::is_arithmetic_v<T>, "log arguments are numbers or strings");
+    if constexpr (std::is_floating_point_v<T>)
+    {
+        *p++ = static_cast<uint8_t>(ArgType::Double);
+        double d = v;
+        memcpy(p, &d, 8);
+    }
+    else if constexpr (std::is_signed_v<T>)
+    {
+        *p++ = static_cast<uint8_t>(ArgType::Int);
+        int64_t i = v;
+        memcpy(p, &i, 8);
+    }
+    else
+    {
+        *p++ = static_cast<uint8_t>(ArgType::Uint);
+        uint64_t u = v;
+        memcpy(p, &u, 8);
+    }
+    p += 8;
+}
+
+// strings of any kind go through `std::string_view`
+template <typename T>
+decltype(auto) as_arg(const T &v)
+{
+    if constexpr (std::is_convertible_v<const T &, std::string_view>)
+    {
+        return std::string_view(v);
+    }
+    else
+    {
+        return (v);
+    }
+}
+
+}
+
+inline bool log_enabled(LogSite &site)
+{
+    if (site.level < log_detail::min_level.load(std::memory_order_relaxed))
+    {
+        return false;
+    }
+    if (site.sampled)
+    {
+        uint32_t period = log_detail::sample_period.load(std::memory_order_relaxed);
+        return period <= 1 || site.hits.fetch_add(1, std::memory_order_relaxed) % period == 0;
+    }
+    return true;
+}
+
+template <typename... Args>
+void log_record(const LogSite &site, const Args &...args)
+{
+    using namespace log_detail;
+
+    size_t size = sizeof(RecordHeader);
+    ((size += encoded_size(as_arg(args))), ...);
+    size = (size + 7) & ~size_t(7);
+
+    uint8_t *record = reserve(static_cast<uint32_t>(size));
+    if (!record)
+    {
+        return;
+    }
+
+    RecordHeader header{static_cast<uint32_t>(size), sizeof...(Args), &site, now_ns()};
+    memcpy(record, &header, sizeof(header));
+    [[maybe_unused]] uint8_t *p = record + sizeof(header);
+    (encode(p, as_arg(args)), ...);
+
+    commit(static_cast<uint32_t>(size));
+}
+
+#define LOG_AT(level, sampled, format, ...)                                            \
+    do                                                                                 \
+    {                                                                                  \
+        static LogSite log_site_{level, format, __FILE__, __LINE__, sampled};          \
+        if (log_enabled(log_site_))                                                    \
+        {                                                                              \
+            log_record(log_site_ __VA_OPT__(, ) __VA_ARGS__);                          \
+        }                                                                              \
+    } while (0)
+
+#define LOG_DEBUG(format, ...) LOG_AT(LogLevel::Debug, false, format __VA_OPT__(, ) __VA_ARGS__)
+#define LOG_INFO(format, ...) LOG_AT(LogLevel::Info, false, format __VA_OPT__(, ) __VA_ARGS__)
+#define LOG_WARN(format, ...) LOG_AT(LogLevel::Warn, false, format __VA_OPT__(, ) __VA_ARGS__)
+#define LOG_ERROR(format, ...) LOG_AT(LogLevel::Error, false, format __VA_OPT__(, ) __VA_ARGS__)
+#define LOG_SAMPLED_INFO(format, ...) LOG_AT(LogLevel::Info, true, format __VA_OPT__(, ) __VA_ARGS__)
+
+// Starts the background thread; logging stops, after writing every pending record, when the session ends.
+class LogSession
+{
+public:
+    LogSession();
+    ~LogSession();
+    LogSession(const LogSession &) = delete;
+    LogSession &operator=(const LogSession &) = delete;
+};
+
+// Options of the command line, returning false for an invalid value.
+bool set_log_level(const std::string &name);
+bool set_log_format(const std::string &name);
+void set_log_sample(uint32_t period);
+
+// Marks the current thread as not allowed to do console I/O for the lifetime of the guard (see above).
+class NoIoGuard
+{
+public:
+    NoIoGuard()
+    {
+        depth++;
+    }
+
+    ~NoIoGuard()
+    {
+        depth--;
+    }
+
+    static bool active()
+    {
+        return depth > 0;
+    }
+
+    // number of writes to std::cout or std::cerr made under a guard so far
+    static uint64_t violations();
+
+private:
+    static thread_local int depth;
+};
@@ -1,1018 +1,420 @@
 /*
-Most of the code in this file implements the preprocessing algorithms presented in Figure 3 from the paper ``Pool: Pool: A Practical OT-based OPRF from Learning with Rounding".
-The `main` function implements the algorithms from Figure 4 to have a working example of the online phase.
-
-The nomenclature "Phase one" and "Phase two" refer to the two main phases of the preprocessing procedure, denoted (2) and (3) respectively in Figure 3.
-
-Most functions have the same structure in that they implement either a sender or a receiver for a specific OT extender, and they are named accordingly.
-
-The executable obtained from compiling this file allows to benchmark preprocessing phases using several different combination of OT extenders as building blocks.
-Once all the different combinations are benchmarked, the executable proceeds to a final preprocessing phase followed by an execution of the online phase.
+This file is the entry point of the `oprf` executable. It parses the command line, runs the selected mode, and by default benchmarks the
+preprocessing algorithms presented in Figure 3 from the paper ``Pool: Pool: A Practical OT-based OPRF from Learning with Rounding" with
+several combinations of OT extenders (see mode_preprocess.cpp), then runs the algorithms from Figure 4 of the online phase as a working example.
+The protocol itself is in the headers: the phases of the preprocessing in preprocess.h, the online phase in online.h, and the client and server
+classes built on them in pool_oprf.h. The parameters and the helpers shared by the modes are in tool.h, and every other mode has its own
+source: mode_bench.cpp, mode_sweep.cpp, mode_bulk.cpp, mode_psi.cpp and mode_tenants.cpp.
 
 The code relies on the `libOTe` library for the OT primitives.
 */
 
-#include "libOTe/Base/MasnyRindalKyber.h"
-#include "libOTe/TwoChooseOne/Iknp/IknpOtExtReceiver.h"
-#include "libOTe/TwoChooseOne/Iknp/IknpOtExtSender.h"
-#include "libOTe/TwoChooseOne/Silent/SilentOtExtReceiver.h"
-#include "libOTe/TwoChooseOne/Silent/SilentOtExtSender.h"
-#include "libOTe/NChooseOne/Kkrt/KkrtNcoOtReceiver.h"
-#include "libOTe/NChooseOne/Kkrt/KkrtNcoOtSender.h"
 #include "libOTe/Tools/Coproto.h"
 #include "cryptoTools/Common/BitVector.h"
-#include "coproto/Socket/AsioSocket.h"
 #include "cryptoTools/Common/Timer.h"
-#include <cryptoTools/Crypto/RandomOracle.h>
-
-#include <iostream>
-
-/*
-Parameters for the preprocessing.
-Variable names are chosen to match the paper's notation. `lg_X` denotes the binary logarithm of `X`.
-When changing the parameters, one should be careful to make sure that they are consistent.
-For example, `tau` should be big enough for `num_rounds` of OPRF rounds to be executed in the online phase.
-
-As is, the parameters allow to measure numbers used in Table 4 for `# evals` set at 2^13.
-*/
-const uint n = 482;
-const uint tau = 1 << 16;
-const uint lg_q = 12;
-const uint q = 1 << lg_q;
-const uint lg_lg_p = 3;
-const uint lg_p = 1 << lg_lg_p;
-const uint p = 1 << lg_p;
-const uint lg_delta = lg_q - lg_p;
-const uint delta = 1 << lg_delta;
 
-// refer to appendix A of the paper for the definition of kappa
-const uint kappa = 6144;
-
-// base OT count for Silent OTs
-const uint baseOtCount = 128;
-
-// number of OPRF rounds to execute in the online phase
-const uint num_rounds = 10;
-
-// Phase one receiver using the IKNP OT extender.
-// This phase one preprocessing implementation is used to obtain the random OTs that are used in the online phase.
-void phase_one_iknp_receive(osuCrypto::BitVector &b, osuCrypto::AlignedUnVector<osuCrypto::block> &Rs_r)
+#include "kernels.h"
+#include "latency.h"
+#include "log.h"
+#include "online.h"
+#include "perf.h"
+#include "pool_oprf.h"
+#include "stats.h"
+#include "subprotocol.h"
+#include "tool.h"
+#include "trace.h"
+
+#include <cctype>
+#include <exception>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+const uint64_t max_uint = std::numeric_limits<uint>::max();
+
+// Value of a command line argument as a whole number from `min` to `max`. Throws `std::invalid_argument` otherwise.
+uint64_t parse_count(const std::string &value, uint64_t min, uint64_t max)
 {
-    osuCrypto::PRNG prng(osuCrypto::sysRandomSeed());
-
-    auto sock = coproto::asioConnect("localhost:1212", false);
-
-    // prepare IKNP OT extender
-    osuCrypto::IknpOtExtReceiver receiver = osuCrypto::IknpOtExtReceiver{};
-    std::vector<std::array<osuCrypto::block, 2>> baseOtSenderMsgs(receiver.baseOtCount());
-
-    osuCrypto::MasnyRindalKyber baseOt;
-
-    coproto::sync_wait(baseOt.send(baseOtSenderMsgs, prng, sock));
-    receiver.setBaseOts(baseOtSenderMsgs);
-
-    // onto actual OT
-
-    // initialize bit vector `b` with repeated random bits
-    osuCrypto::BitVector b_n(n);
-    b_n.randomize(prng);
-    for (int j = 0; j < tau; j++)
-    {
-        for (int i = 0; i < n; i++)
-        {
-            b[j * n + i] = b_n[i];
-        }
-    }
-
+    size_t end = 0;
+    uint64_t count = 0;
     try
     {
-        // perform random OTs and write results to Rs_r
-        coproto::sync_wait(receiver.receive(b, Rs_r, prng, sock));
-    }
-    catch (std::exception &e)
-    {
-        std::cerr << e.what() << std::endl;
-        coproto::sync_wait(sock.close());
-    }
-
-    coproto::sync_wait(sock.flush());
-
-    auto dataReceived = sock.bytesReceived();
-    auto dataSent = sock.bytesSent();
-
-    std::cout << "phase one iknp receiver, sent " << dataSent << " bytes and received " << dataReceived << " bytes" << std::endl;
-}
-
-// Phase one sender using the IKNP OT extender.
-// This phase one preprocessing implementation is used to obtain the random OTs that are used in the online phase.
-void phase_one_iknp_send(osuCrypto::AlignedUnVector<std::array<osuCrypto::block, 2>> &Sc)
-{
-    osuCrypto::PRNG prng(osuCrypto::sysRandomSeed());
-
-    auto sock = coproto::asioConnect("localhost:1212", true);
-
-    // prepare IKNP OT extender
-    osuCrypto::IknpOtExtSender sender = osuCrypto::IknpOtExtSender{};
-
-    osuCrypto::MasnyRindalKyber baseOt;
-
-    osuCrypto::BitVector baseOtBv(sender.baseOtCount());
-    baseOtBv.randomize(prng);
-
-    std::vector<osuCrypto::block> baseOtRcvMsgs(sender.baseOtCount());
-
-    coproto::sync_wait(baseOt.receive(baseOtBv, baseOtRcvMsgs, prng, sock));
-    sender.setBaseOts(baseOtRcvMsgs, baseOtBv);
-
-    // onto actual OT
-    try
-    {
-        // perform random OTs and write the random OTs to Sc
-        coproto::sync_wait(sender.send(Sc, prng, sock));
-    }
-    catch (std::exception &e)
-    {
-        std::cerr << e.what() << std::endl;
-        coproto::sync_wait(sock.close());
-    }
-
-    coproto::sync_wait(sock.flush());
-
-    auto dataReceived = sock.bytesReceived();
-    auto dataSent = sock.bytesSent();
-
-    std::this_thread::sleep_for(std::chrono::seconds(1));
-
-    std::cout << "phase one iknp sender, sent " << dataSent << " bytes and received " << dataReceived << " bytes" << std::endl;
-}
-
-// Phase one receiver using the "unwasteful" IKNP OT extender.
-// This phase one preprocessing implementation is benchmarked to obtain the numbers presented in the paper under IKNP.
-void phase_one_iknp_unwasteful_receive(osuCrypto::BitVector &b, osuCrypto::AlignedUnVector<osuCrypto::block> &Rs_r)
-{
-    osuCrypto::Timer timer;
-
-    osuCrypto::PRNG prng(osuCrypto::sysRandomSeed());
-
-    auto sock = coproto::asioConnect("localhost:1212", false);
-
-    // prepare IKNP OT extender
-    osuCrypto::IknpOtExtReceiver receiver = osuCrypto::IknpOtExtReceiver{};
-    std::vector<std::array<osuCrypto::block, 2>> baseOtSenderMsgs(receiver.baseOtCount());
-
-    osuCrypto::MasnyRindalKyber baseOt;
-    osuCrypto::Timer::timeUnit baseOtStart = timer.setTimePoint("phase 1 iknp base ot start");
-
-    coproto::sync_wait(baseOt.send(baseOtSenderMsgs, prng, sock));
-    receiver.setBaseOts(baseOtSenderMsgs);
-
-    osuCrypto::Timer::timeUnit baseOtEnd = timer.setTimePoint("phase 1 iknp base ot end");
-
-    // onto actual OT
-    osuCrypto::BitVector b_n(n);
-    b_n.randomize(prng);
-    for (int j = 0; j < kappa; j++)
-    {
-        for (int i = 0; i < n; i++)
+        // `std::stoull` would take a leading minus sign and negate the value
+        if (!value.empty() && std::isdigit(static_cast<unsigned char>(value[0])))
         {
-            b[j * n + i] = b_n[i];
+            count = std::stoull(value, &end);
         }
     }
-
-    osuCrypto::Timer::timeUnit start = timer.setTimePoint("phase 1 iknp receive start");
-
-    try
+    catch (std::out_of_range &)
     {
-        // perform random OTs and write results to Rs_r
-        coproto::sync_wait(receiver.receive(b, Rs_r, prng, sock));
+        end = 0;
     }
-    catch (std::exception &e)
+    if (end == 0 || end != value.size() || count < min || count > max)
     {
-        std::cerr << e.what() << std::endl;
-        coproto::sync_wait(sock.close());
+        throw std::invalid_argument("expected a whole number from " + std::to_string(min) + " to " + std::to_string(max));
     }
-
-    coproto::sync_wait(sock.flush());
-
-    osuCrypto::Timer::timeUnit end = timer.setTimePoint("phase 1 iknp receive end");
-    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(baseOtEnd - baseOtStart + end - start).count();
-
-    auto dataReceived = sock.bytesReceived();
-    auto dataSent = sock.bytesSent();
-
-    std::cout << "phase one iknp unwasteful receiver in " << ms << "ms, sent " << dataSent << " bytes and received " << dataReceived << " bytes" << std::endl;
+    return count;
 }
 
-// Phase one sender using the "unwasteful" IKNP OT extender.
-// This phase one preprocessing implementation is benchmarked to obtain the numbers presented in the paper under IKNP.
-void phase_one_iknp_unwasteful_send(osuCrypto::AlignedUnVector<std::array<osuCrypto::block, 2>> &Sc)
+// Value of a command line argument as a number from `min` to `max`. Throws `std::invalid_argument` otherwise.
+double parse_real(const std::string &value, double min, double max)
 {
-    osuCrypto::Timer timer;
-
-    osuCrypto::PRNG prng(osuCrypto::sysRandomSeed());
-
-    auto sock = coproto::asioConnect("localhost:1212", true);
-
-    // prepare IKNP OT extender
-    osuCrypto::IknpOtExtSender sender = osuCrypto::IknpOtExtSender{};
-
-    osuCrypto::MasnyRindalKyber baseOt;
-
-    osuCrypto::BitVector baseOtBv(sender.baseOtCount());
-    baseOtBv.randomize(prng);
-
-    std::vector<osuCrypto::block> baseOtRcvMsgs(sender.baseOtCount());
-
-    osuCrypto::Timer::timeUnit baseOtStart = timer.setTimePoint("phase 1 iknp base ot start");
-
-    coproto::sync_wait(baseOt.receive(baseOtBv, baseOtRcvMsgs, prng, sock));
-    sender.setBaseOts(baseOtRcvMsgs, baseOtBv);
-
-    osuCrypto::Timer::timeUnit baseOtEnd = timer.setTimePoint("phase 1 iknp base ot end");
-
-    // onto actual OT
-    osuCrypto::Timer::timeUnit start = timer.setTimePoint("phase 1 iknp send start");
-
+    size_t end = 0;
+    double real = 0;
     try
     {
-        // perform random OTs and write the random OTs to Sc
-        coproto::sync_wait(sender.send(Sc, prng, sock));
+        real = std::stod(value, &end);
     }
-    catch (std::exception &e)
-    {
-        std::cerr << e.what() << std::endl;
-        coproto::sync_wait(sock.close());
-    }
-
-    coproto::sync_wait(sock.flush());
-
-    osuCrypto::Timer::timeUnit end = timer.setTimePoint("phase 1 iknp send end");
-    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(baseOtEnd - baseOtStart + end - start).count();
-
-    auto dataReceived = sock.bytesReceived();
-    auto dataSent = sock.bytesSent();
-
-    std::this_thread::sleep_for(std::chrono::seconds(1));
-
-    std::cout << "phase one iknp unwasteful sender in " << ms << "ms, sent " << dataSent << " bytes and received " << dataReceived << " bytes" << std::endl;
-}
-
-// Phase one receiver using the Silent OT extender.
-// This phase one preprocessing implementation is benchmarked to obtain the numbers presented in the paper under Silent OT (n OTs).
-void phase_one_sot_receive(osuCrypto::BitVector &b, osuCrypto::AlignedUnVector<osuCrypto::block> &Rs_r)
-{
-    osuCrypto::PRNG prng(osuCrypto::sysRandomSeed());
-
-    auto sock = coproto::asioConnect("localhost:1212", false);
-
-    // prepare Silent OT extender
-    std::vector<std::array<osuCrypto::block, 2>> baseOtSendMsgs(baseOtCount);
-
-    osuCrypto::Timer timer;
-    osuCrypto::Timer::timeUnit start = timer.setTimePoint("phase 1 silent ot receive start");
-
-    osuCrypto::MasnyRindalKyber baseOt;
-    coproto::sync_wait(baseOt.send(baseOtSendMsgs, prng, sock));
-
-    osuCrypto::SilentOtExtReceiver receiver;
-    receiver.setBaseOts(baseOtSendMsgs);
-    receiver.configure(n, 2, 1, osuCrypto::SilentSecType::SemiHonest);
-
-    // perform random OTs and write results to Rs_r
-    try
+    catch (std::logic_error &)
     {
-        coproto::sync_wait(receiver.silentReceive(b, Rs_r, prng, sock, osuCrypto::OTType::Random));
+        end = 0;
     }
-    catch (std::exception &e)
+    if (end == 0 || end != value.size() || !(real >= min && real <= max))
     {
-        std::cerr << e.what() << std::endl;
-        coproto::sync_wait(sock.close());
+        std::ostringstream range;
+        range << "expected a number from " << min << " to " << max;
+        throw std::invalid_argument(range.str());
     }
-
-    coproto::sync_wait(sock.flush());
-
-    osuCrypto::Timer::timeUnit end = timer.setTimePoint("phase 1 silent ot receive end");
-    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
-
-    auto dataReceived = sock.bytesReceived();
-    auto dataSent = sock.bytesSent();
-
-    std::cout << "phase one silent ot receiver in " << ms << "ms, sent " << dataSent << " bytes and received " << dataReceived << " bytes" << std::endl;
+    return real;
 }
 
-// Phase one sender using the Silent OT extender.
-// This phase one preprocessing implementation is benchmarked to obtain the numbers presented in the paper under Silent OT (n OTs).
-void phase_one_sot_send(osuCrypto::AlignedUnVector<std::array<osuCrypto::block, 2>> &Sc)
-{
-    osuCrypto::PRNG prng(osuCrypto::sysRandomSeed());
-
-    auto sock = coproto::asioConnect("localhost:1212", true);
-
-    // prepare Silent OT extender
-    osuCrypto::BitVector baseOtBv(baseOtCount);
-    baseOtBv.randomize(prng);
-    std::vector<osuCrypto::block> baseOtRecvMsgs(baseOtCount);
-
-    osuCrypto::Timer timer;
-    osuCrypto::Timer::timeUnit start = timer.setTimePoint("phase 1 silent ot send start");
-
-    osuCrypto::MasnyRindalKyber baseOt;
-    coproto::sync_wait(baseOt.receive(baseOtBv, baseOtRecvMsgs, prng, sock));
-
-    osuCrypto::SilentOtExtSender sender;
-    sender.configure(n, 2, 1, osuCrypto::SilentSecType::SemiHonest);
-    sender.setBaseOts(baseOtRecvMsgs, baseOtBv);
-
-    // perform random OTs and write the random OTs to Sc
-    try
-    {
-        coproto::sync_wait(sender.silentSend(Sc, prng, sock));
-    }
-    catch (std::exception &e)
-    {
-        std::cerr << e.what() << std::endl;
-    }
-
-    coproto::sync_wait(sock.flush());
-
-    osuCrypto::Timer::timeUnit end = timer.setTimePoint("phase 1 silent ot send end");
-    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
-
-    auto dataReceived = sock.bytesReceived();
-    auto dataSent = sock.bytesSent();
-
-    std::this_thread::sleep_for(std::chrono::seconds(1));
-
-    std::cout << "phase one silent ot sender in " << ms << "ms, sent " << dataSent << " bytes and received " << dataReceived << " bytes" << std::endl;
-}
-
-// Phase one receiver using the Silent OT extender.
-// This phase one preprocessing implementation is benchmarked to obtain the numbers presented in the paper under Silent OT (n * kappa OTs).
-void phase_one_sot_unwasteful_receive(osuCrypto::BitVector &b, osuCrypto::AlignedUnVector<osuCrypto::block> &Rs_r)
-{
-    osuCrypto::PRNG prng(osuCrypto::sysRandomSeed());
-
-    auto sock = coproto::asioConnect("localhost:1212", false);
-
-    // prepare Silent OT extender
-    std::vector<std::array<osuCrypto::block, 2>> baseOtSendMsgs(baseOtCount);
-
-    osuCrypto::Timer timer;
-    osuCrypto::Timer::timeUnit start = timer.setTimePoint("phase 1 silent ot receive start");
-
-    osuCrypto::MasnyRindalKyber baseOt;
-    coproto::sync_wait(baseOt.send(baseOtSendMsgs, prng, sock));
-
-    osuCrypto::SilentOtExtReceiver receiver;
-    receiver.setBaseOts(baseOtSendMsgs);
-    receiver.configure(n * kappa, 2, 1, osuCrypto::SilentSecType::SemiHonest);
-
-    // perform random OTs and write results to Rs_r
-    try
-    {
-        coproto::sync_wait(receiver.silentReceive(b, Rs_r, prng, sock, osuCrypto::OTType::Random));
-    }
-    catch (std::exception &e)
-    {
-        std::cerr << e.what() << std::endl;
-        coproto::sync_wait(sock.close());
-    }
-
-    coproto::sync_wait(sock.flush());
-
-    osuCrypto::Timer::timeUnit end = timer.setTimePoint("phase 1 silent ot receive end");
-    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
-
-    auto dataReceived = sock.bytesReceived();
-    auto dataSent = sock.bytesSent();
-
-    std::cout << "phase one silent ot unwasteful receiver in " << ms << "ms, sent " << dataSent << " bytes and received " << dataReceived << " bytes" << std::endl;
-}
-
-// Phase one sender using the Silent OT extender.
-// This phase one preprocessing implementation is benchmarked to obtain the numbers presented in the paper under Silent OT (n * kappa OTs).
-void phase_one_sot_unwasteful_send(osuCrypto::AlignedUnVector<std::array<osuCrypto::block, 2>> &Sc)
-{
-    osuCrypto::PRNG prng(osuCrypto::sysRandomSeed());
-
-    auto sock = coproto::asioConnect("localhost:1212", true);
-
-    // prepare Silent OT extender
-    osuCrypto::BitVector baseOtBv(baseOtCount);
-    baseOtBv.randomize(prng);
-    std::vector<osuCrypto::block> baseOtRecvMsgs(baseOtCount);
-
-    osuCrypto::Timer timer;
-    osuCrypto::Timer::timeUnit start = timer.setTimePoint("phase 1 silent ot send start");
-
-    osuCrypto::MasnyRindalKyber baseOt;
-    coproto::sync_wait(baseOt.receive(baseOtBv, baseOtRecvMsgs, prng, sock));
-
-    osuCrypto::SilentOtExtSender sender;
-    sender.configure(n * kappa, 2, 1, osuCrypto::SilentSecType::SemiHonest);
-    sender.setBaseOts(baseOtRecvMsgs, baseOtBv);
-
-    // perform random OTs and write the random OTs to Sc
-    try
-    {
-        coproto::sync_wait(sender.silentSend(Sc, prng, sock));
-    }
-    catch (std::exception &e)
-    {
-        std::cerr << e.what() << std::endl;
-    }
-
-    coproto::sync_wait(sock.flush());
-
-    osuCrypto::Timer::timeUnit end = timer.setTimePoint("phase 1 silent ot send end");
-    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
-
-    auto dataReceived = sock.bytesReceived();
-    auto dataSent = sock.bytesSent();
-
-    std::this_thread::sleep_for(std::chrono::seconds(1));
-
-    std::cout << "phase one silent ot unwasteful sender in " << ms << "ms, sent " << dataSent << " bytes and received " << dataReceived << std::endl;
-}
-
-// Phase two receiver using the KKRT OT extender.
-// This phase two preprocessing implementation is used to obtain the random OTs that are used in the online phase.
-void phase_two_kkrt_receive(uint statisticalSecurityParam, std::vector<osuCrypto::u64> &bpr, osuCrypto::AlignedVector<osuCrypto::block> &Rc_r)
+int main(int argc, char *argv[])
 {
-    osuCrypto::PRNG prng(osuCrypto::sysRandomSeed());
-
-    osuCrypto::KkrtNcoOtReceiver receiver;
-
-    auto sock = coproto::asioConnect("localhost:1212", false);
-
-    auto receiveRoutine = [&]() -> coproto::task<>
-    {
-        receiver.configure(false, statisticalSecurityParam, lg_delta);
-
-        co_await (receiver.init(tau, prng, sock));
-
-        int step = 1 << 10; // iterate over 2^10 OTs at a time before sending a correction.
-        int i;
-
-        for (i = 0; i < tau;)
+    // every message goes through the asynchronous logger (see log.h), which writes what is pending when main returns.
+    LogSession log_session;
+
+    // written when main returns, before the logger stops (`--trace=`)
+    TraceSession trace_session;
+
+    // exported periodically, and for the last time when main returns (`--latency=`)
+    LatencySession latency_session;
+    std::vector<std::string> latency_logs;
+
+    std::string bulk_input;
+    std::string bulk_output = "oprf_outputs.bin";
+    bool bulk_direct_mode = false;
+    std::vector<uint> psi_sizes;
+    std::vector<uint> lookup_sizes;
+    uint tenants = 0;
+    uint load_users = 0;
+    bool bench_kernels = false;
+    std::string sweep_parameter;
+    std::vector<uint> sweep_values;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        try
         {
-            int min = std::min<osuCrypto::u64>(tau - i, step);
-            for (int j = 0; j < min; j++, i++)
+            if (arg.rfind("--isa=", 0) == 0)
             {
-                bpr[i] = static_cast<osuCrypto::u64>(prng.get<osuCrypto::u8>() & (delta - 1));
-                receiver.encode(i, &bpr[i], &Rc_r[i]);
+                // forces the kernels flavour, e.g. to compare instruction sets on the same host
+                if (!select_isa(arg.c_str() + 6))
+                {
+                    LOG_ERROR("Unknown or unsupported instruction set: {}", arg.substr(6));
+                    return 1;
+                }
             }
-
-            co_await (receiver.sendCorrection(sock, min));
-        }
-
-        co_await (receiver.check(sock, prng.get()));
-
-        co_await (sock.flush());
-    };
-
-    try
-    {
-        coproto::sync_wait(receiveRoutine());
-    }
-    catch (std::exception &e)
-    {
-        std::cerr << e.what() << std::endl;
-    }
-
-    auto dataReceived = sock.bytesReceived();
-    auto dataSent = sock.bytesSent();
-
-    std::cout << "phase two kkrt receiver, sent " << dataSent << " bytes and received " << dataReceived << " bytes" << std::endl;
-}
-
-// Phase two sender using the KKRT OT extender.
-// This phase two preprocessing implementation is used to obtain the random OTs that are used in the online phase.
-void phase_two_kkrt_send(uint statisticalSecurityParam, osuCrypto::Matrix<osuCrypto::block> &Ss)
-{
-    osuCrypto::PRNG prng(osuCrypto::sysRandomSeed());
-
-    osuCrypto::KkrtNcoOtSender sender;
-
-    auto sock = coproto::asioConnect("localhost:1212", true);
-
-    auto sendRoutine = [&]() -> coproto::task<>
-    {
-        sender.configure(false, statisticalSecurityParam, lg_delta);
-
-        co_await (sender.init(tau, prng, sock));
-
-        int step = 1 << 10; // iterate over 2^10 OTs at a time before sending a correction.
-        int i;
-
-        for (i = 0; i < tau;)
-        {
-            int min = std::min<osuCrypto::u64>(tau - i, step);
-
-            co_await (sender.recvCorrection(sock, min));
-
-            for (int j = 0; j < min; j++, i++)
+            else if (arg.rfind("--prefetch=", 0) == 0)
+            {
+                prefetch_rounds = parse_count(arg.substr(11), 0, max_prefetch_rounds);
+            }
+            else if (arg.rfind("--bulk=", 0) == 0)
+            {
+                bulk_input = arg.substr(7);
+            }
+            else if (arg == "--direct")
+            {
+                bulk_direct_mode = true;
+            }
+            else if (arg.rfind("--verify-rate=", 0) == 0)
+            {
+                verify_rate = parse_real(arg.substr(14), 0, 1);
+            }
+            else if (arg.rfind("--bulk-out=", 0) == 0)
+            {
+                bulk_output = arg.substr(11);
+            }
+            else if (arg.rfind("--psi=", 0) == 0)
+            {
+                psi_sizes.push_back(parse_count(arg.substr(6), 1, max_psi_lg_size));
+            }
+            else if (arg == "--psi-bench")
+            {
+                // set sizes 2^16 to 2^24
+                for (uint lg_size = 16; lg_size <= 24; lg_size += 2)
+                {
+                    psi_sizes.push_back(lg_size);
+                }
+            }
+            else if (arg.rfind("--lookup=", 0) == 0)
             {
-                for (int k = 0; k < delta; k++)
+                uint lg_size = parse_count(arg.substr(9), 1, 63);
+                if (!lookup_size_valid(lg_size))
                 {
-                    osuCrypto::block choice = static_cast<osuCrypto::block>(k);
-                    sender.encode(i, &choice, &Ss[i][k]);
+                    LOG_ERROR("Unsupported lookup set size 2^{}: the set must keep at least {} elements after its update", lg_size, lookup_queries / 2);
+                    return 1;
                 }
+                lookup_sizes.push_back(lg_size);
+            }
+            else if (arg.rfind("--tenants=", 0) == 0)
+            {
+                tenants = parse_count(arg.substr(10), 1, max_uint);
+            }
+            else if (arg.rfind("--load=", 0) == 0)
+            {
+                load_users = parse_count(arg.substr(7), 1, max_uint);
+            }
+            else if (arg.rfind("--load-clients=", 0) == 0)
+            {
+                load_clients = parse_count(arg.substr(15), 1, max_uint);
+            }
+            else if (arg.rfind("--load-duration=", 0) == 0)
+            {
+                load_duration_s = parse_real(arg.substr(16), 1e-3, 1e9);
+            }
+            else if (arg.rfind("--load-rate=", 0) == 0)
+            {
+                load_rate = parse_real(arg.substr(12), 0, 1e9);
+            }
+            else if (arg.rfind("--zipf=", 0) == 0)
+            {
+                load_zipf = parse_real(arg.substr(7), 0, 100);
+            }
+            else if (arg.rfind("--pool-budget=", 0) == 0)
+            {
+                tenant_budget = parse_count(arg.substr(14), 1, std::numeric_limits<size_t>::max() >> 20) << 20;
+            }
+            else if (arg.rfind("--sweep=", 0) == 0)
+            {
+                // `--sweep=tau` for the default grid of a parameter, or `--sweep=tau:1024,65536` for given values
+                std::string sweep = arg.substr(8);
+                sweep_parameter = sweep.substr(0, sweep.find(':'));
+                if (sweep.find(':') != std::string::npos)
+                {
+                    std::stringstream list(sweep.substr(sweep.find(':') + 1));
+                    for (std::string value; std::getline(list, value, ',');)
+                    {
+                        sweep_values.push_back(parse_count(value, 1, max_uint));
+                    }
+                }
+            }
+            else if (arg == "--transport=local")
+            {
+                transport = Transport::Local;
+            }
+            else if (arg.rfind("--link=", 0) == 0)
+            {
+                std::string link = arg.substr(7);
+                link_latency_ms = parse_real(link.substr(0, link.find(',')), 0, 1e6);
+                link_mbps = link.find(',') == std::string::npos ? 0 : parse_real(link.substr(link.find(',') + 1), 0, 1e6);
+                transport = Transport::Link;
+            }
+            else if (arg.rfind("--reps=", 0) == 0)
+            {
+                bench_reps = parse_count(arg.substr(7), 1, max_uint);
+            }
+            else if (arg.rfind("--warmup=", 0) == 0)
+            {
+                bench_warmup = parse_count(arg.substr(9), 0, max_uint);
+            }
+            else if (arg.rfind("--results=", 0) == 0)
+            {
+                results_path = arg.substr(10);
+            }
+            else if (arg == "--subprotocols")
+            {
+                subprotocol_report = true;
+            }
+            else if (arg.rfind("--trace=", 0) == 0)
+            {
+                // timeline of the run in the Chrome trace-event format (see trace.h)
+                trace_session.start(arg.substr(8));
+                set_trace_thread_name("main");
+            }
+            else if (arg.rfind("--latency=", 0) == 0)
+            {
+                // latency histograms of the online evaluations by stage (see latency.h)
+                latency_session.start(arg.substr(10), latency_export_interval_s);
+            }
+            else if (arg.rfind("--merge-latency=", 0) == 0)
+            {
+                latency_logs.push_back(arg.substr(16));
+            }
+            else if (arg == "--perf")
+            {
+                // hardware counters around the hot loops (see perf.h)
+                set_perf_enabled(true);
+            }
+            else if (arg.rfind("--log-level=", 0) == 0)
+            {
+                if (!set_log_level(arg.substr(12)))
+                {
+                    LOG_ERROR("Unknown log level: {}", arg.substr(12));
+                    return 1;
+                }
+            }
+            else if (arg.rfind("--log-format=", 0) == 0)
+            {
+                if (!set_log_format(arg.substr(13)))
+                {
+                    LOG_ERROR("Unknown log format: {}", arg.substr(13));
+                    return 1;
+                }
+            }
+            else if (arg.rfind("--log-sample=", 0) == 0)
+            {
+                // keeps one per-evaluation message out of N
+                set_log_sample(parse_count(arg.substr(13), 0, max_uint));
+            }
+            else if (arg == "--bench-frames")
+            {
+                benchmark_coroutine_frames();
+                return 0;
+            }
+            else if (arg == "--bench-kernels")
+            {
+                bench_kernels = true;
+            }
+            else if (arg.rfind("--save-baseline=", 0) == 0)
+            {
+                save_baseline_path = arg.substr(16);
+            }
+            else if (arg.rfind("--compare=", 0) == 0)
+            {
+                compare_baseline_path = arg.substr(10);
             }
         }
-        co_await (sender.check(sock, osuCrypto::ZeroBlock));
-
-        co_await (sock.flush());
-    };
-
-    try
-    {
-        coproto::sync_wait(sendRoutine());
-    }
-    catch (std::exception &e)
-    {
-        std::cerr << e.what() << std::endl;
-    }
-
-    std::this_thread::sleep_for(std::chrono::seconds(1));
-
-    auto dataReceived = sock.bytesReceived();
-    auto dataSent = sock.bytesSent();
-
-    std::cout << "phase two kkrt sender, sent " << dataSent << " bytes and received " << dataReceived << " bytes" << std::endl;
-}
-
-// Phase two receiver using the IKNP OT extender.
-// This phase two preprocessing implementation is benchmarked to obtain the numbers presented in the paper under IKNP.
-void phase_two_iknp_receive(osuCrypto::BitVector &b, osuCrypto::AlignedUnVector<osuCrypto::block> &Rs_r)
-{
-    osuCrypto::Timer timer;
-
-    osuCrypto::PRNG prng(osuCrypto::sysRandomSeed());
-
-    auto sock = coproto::asioConnect("localhost:1212", false);
-
-    // prepare IKNP OT extender
-    osuCrypto::IknpOtExtReceiver receiver = osuCrypto::IknpOtExtReceiver{};
-    std::vector<std::array<osuCrypto::block, 2>> baseOtSenderMsgs(receiver.baseOtCount());
-
-    osuCrypto::MasnyRindalKyber baseOt;
-
-    osuCrypto::Timer::timeUnit baseOtStart = timer.setTimePoint("phase 2 iknp base ot start");
-
-    coproto::sync_wait(baseOt.send(baseOtSenderMsgs, prng, sock));
-    receiver.setBaseOts(baseOtSenderMsgs);
-
-    osuCrypto::Timer::timeUnit baseOtEnd = timer.setTimePoint("phase 2 iknp base ot end");
-
-    // onto actual OT
-
-    b.randomize(prng);
-
-    osuCrypto::Timer::timeUnit start = timer.setTimePoint("phase 2 iknp receive start");
-
-    try
-    {
-        // perform random OTs and write results to Rs_r
-        coproto::sync_wait(receiver.receive(b, Rs_r, prng, sock));
-    }
-    catch (std::exception &e)
-    {
-        std::cerr << e.what() << std::endl;
-        coproto::sync_wait(sock.close());
-    }
-
-    coproto::sync_wait(sock.flush());
-
-    osuCrypto::Timer::timeUnit end = timer.setTimePoint("phase 2 iknp receive end");
-    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(baseOtEnd - baseOtStart + end - start).count();
-
-    auto dataReceived = sock.bytesReceived();
-    auto dataSent = sock.bytesSent();
-
-    std::cout << "phase two iknp receiver in " << ms << "ms, sent " << dataSent << " bytes and received " << dataReceived << " bytes" << std::endl;
-}
-
-// Phase two sender using the IKNP OT extender.
-// This phase two preprocessing implementation is benchmarked to obtain the numbers presented in the paper under IKNP.
-void phase_two_iknp_send(osuCrypto::AlignedUnVector<std::array<osuCrypto::block, 2>> &Sc)
-{
-    osuCrypto::Timer timer;
-
-    osuCrypto::PRNG prng(osuCrypto::sysRandomSeed());
-
-    auto sock = coproto::asioConnect("localhost:1212", true);
-
-    // prepare IKNP OT extender
-    osuCrypto::IknpOtExtSender sender = osuCrypto::IknpOtExtSender{};
-
-    osuCrypto::MasnyRindalKyber baseOt;
-
-    osuCrypto::BitVector baseOtBv(sender.baseOtCount());
-    baseOtBv.randomize(prng);
-
-    std::vector<osuCrypto::block> baseOtRcvMsgs(sender.baseOtCount());
-
-    osuCrypto::Timer::timeUnit baseOtStart = timer.setTimePoint("phase 2 iknp base ot start");
-
-    coproto::sync_wait(baseOt.receive(baseOtBv, baseOtRcvMsgs, prng, sock));
-    sender.setBaseOts(baseOtRcvMsgs, baseOtBv);
-
-    osuCrypto::Timer::timeUnit baseOtEnd = timer.setTimePoint("phase 2 iknp base ot end");
-
-    // onto actual OT
-    osuCrypto::Timer::timeUnit start = timer.setTimePoint("phase 2 iknp send start");
-
-    try
-    {
-        // perform random OTs and write the random OTs to Sc
-        coproto::sync_wait(sender.send(Sc, prng, sock));
-    }
-    catch (std::exception &e)
-    {
-        std::cerr << e.what() << std::endl;
-        coproto::sync_wait(sock.close());
-    }
-
-    coproto::sync_wait(sock.flush());
-
-    osuCrypto::Timer::timeUnit end = timer.setTimePoint("phase 2 iknp send end");
-    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(baseOtEnd - baseOtStart + end - start).count();
-
-    auto dataReceived = sock.bytesReceived();
-    auto dataSent = sock.bytesSent();
-
-    std::this_thread::sleep_for(std::chrono::seconds(1));
-
-    std::cout << "phase two iknp sender in " << ms << "ms, sent " << dataSent << " bytes and received " << dataReceived << " bytes" << std::endl;
-}
-
-// Phase two receiver using the Silent OT extender.
-// This phase two preprocessing implementation is benchmarked to obtain the numbers presented in the paper under Silent OT (n OTs and n * kappa OTs).
-void phase_two_sot_receive(osuCrypto::BitVector &b, osuCrypto::AlignedUnVector<osuCrypto::block> &Rs_r)
-{
-    osuCrypto::PRNG prng(osuCrypto::sysRandomSeed());
-
-    auto sock = coproto::asioConnect("localhost:1212", false);
-
-    // prepare Silent OT extender
-    std::vector<std::array<osuCrypto::block, 2>> baseOtSendMsgs(baseOtCount);
-
-    osuCrypto::Timer timer;
-    osuCrypto::Timer::timeUnit start = timer.setTimePoint("phase 2 silent ot receive start");
-
-    osuCrypto::MasnyRindalKyber baseOt;
-    coproto::sync_wait(baseOt.send(baseOtSendMsgs, prng, sock));
-
-    osuCrypto::SilentOtExtReceiver receiver;
-    receiver.setBaseOts(baseOtSendMsgs);
-    receiver.configure(lg_delta * tau, 2, 1, osuCrypto::SilentSecType::SemiHonest);
-
-    // perform random OTs and write results to Rs_r
-    try
-    {
-        coproto::sync_wait(receiver.silentReceive(b, Rs_r, prng, sock, osuCrypto::OTType::Random));
-    }
-    catch (std::exception &e)
-    {
-        std::cerr << e.what() << std::endl;
-        coproto::sync_wait(sock.close());
+        catch (std::invalid_argument &e)
+        {
+            LOG_ERROR("Invalid argument {}: {}", arg, e.what());
+            return 1;
+        }
     }
 
-    coproto::sync_wait(sock.flush());
-
-    osuCrypto::Timer::timeUnit end = timer.setTimePoint("phase 2 silent ot receive end");
-    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
-
-    auto dataReceived = sock.bytesReceived();
-    auto dataSent = sock.bytesSent();
-
-    std::cout << "phase two silent ot receiver in " << ms << "ms, sent " << dataSent << " bytes and received " << dataReceived << " bytes" << std::endl;
-}
-
-// Phase two sender using the Silent OT extender.
-// This phase two preprocessing implementation is benchmarked to obtain the numbers presented in the paper under Silent OT (n OTs and n * kappa OTs).
-void phase_two_sot_send(osuCrypto::AlignedUnVector<std::array<osuCrypto::block, 2>> &Sc)
-{
-    osuCrypto::PRNG prng(osuCrypto::sysRandomSeed());
-
-    auto sock = coproto::asioConnect("localhost:1212", true);
-
-    // prepare Silent OT extender
-
-    osuCrypto::BitVector baseOtBv(baseOtCount);
-    baseOtBv.randomize(prng);
-    std::vector<osuCrypto::block> baseOtRecvMsgs(baseOtCount);
-
-    osuCrypto::Timer timer;
-    osuCrypto::Timer::timeUnit start = timer.setTimePoint("phase 2 silent ot send start");
-
-    osuCrypto::MasnyRindalKyber baseOt;
-    coproto::sync_wait(baseOt.receive(baseOtBv, baseOtRecvMsgs, prng, sock));
-
-    osuCrypto::SilentOtExtSender sender;
-    sender.configure(lg_delta * tau, 2, 1, osuCrypto::SilentSecType::SemiHonest);
-    sender.setBaseOts(baseOtRecvMsgs, baseOtBv);
-
-    // perform random OTs and write the random OTs to Sc
-    try
+    if (!latency_logs.empty())
     {
-        coproto::sync_wait(sender.silentSend(Sc, prng, sock));
-    }
-    catch (std::exception &e)
-    {
-        std::cerr << e.what() << std::endl;
+        // merges the histograms logged by several runs, e.g. of several processes under the same load
+        LatencyHistograms histograms;
+        for (const std::string &path : latency_logs)
+        {
+            if (!read_latency_log(path, histograms))
+            {
+                LOG_ERROR("Could not read the latency log {}", path);
+                return 1;
+            }
+        }
+        log_latency(histograms);
+        return 0;
     }
 
-    coproto::sync_wait(sock.flush());
-
-    osuCrypto::Timer::timeUnit end = timer.setTimePoint("phase 2 silent ot send end");
-    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
-
-    auto dataReceived = sock.bytesReceived();
-    auto dataSent = sock.bytesSent();
-
-    std::this_thread::sleep_for(std::chrono::seconds(1));
-
-    std::cout << "phase two silent ot sender in " << ms << "ms, sent " << dataSent << " bytes and received " << dataReceived << " bytes" << std::endl;
-}
-
-// contains examples for all preprocessing procedures.
-// these procedures were used to obtain the preprocessing measures given in the paper.
-// client complexity is taken as phase one sender + phase two receiver, and vice-versa for the server complexity.
-void benchmark_alt_preproc()
-{
-    std::cout << "Benchmarking alternative preprocessing procedures..." << std::endl;
-    std::cout << "Client complexity is taken as phase one sender + phase two receiver, and vice-versa for the server complexity." << std::endl;
-
-    // data structures for "unwasteful" IKNP phase one
-    osuCrypto::BitVector phase_one_iknp_b(n * kappa);
-    osuCrypto::AlignedUnVector<osuCrypto::block> phase_one_iknp_Rs_r(n * kappa);
-    osuCrypto::AlignedUnVector<std::array<osuCrypto::block, 2>> phase_one_iknp_Sc(n * kappa);
-
-    std::cout << "Benchmarking for phase one of preprocessing with \"unwasteful\" IKNP..." << std::endl;
-    auto phase_one_iknp_unwasteful_thread = std::thread([&]
-                                                        {
-       try {
-          phase_one_iknp_unwasteful_receive(phase_one_iknp_b, phase_one_iknp_Rs_r);
-       } catch (std::exception &e) {
-          std::cerr << e.what() << std::endl;
-       } });
-
-    try
-    {
-        phase_one_iknp_unwasteful_send(phase_one_iknp_Sc);
-    }
-    catch (std::exception &e)
+    if (bench_kernels)
     {
-        std::cerr << e.what() << std::endl;
+        benchmark_online_kernels();
+        return check_baseline();
     }
-    phase_one_iknp_unwasteful_thread.join();
-
-    // data structures for Naor-Pinkas phase two with IKNP
-    osuCrypto::BitVector phase_two_iknp_b(lg_delta * tau);
-    osuCrypto::AlignedUnVector<osuCrypto::block> phase_two_iknp_Rs_r(lg_delta * tau);
-    osuCrypto::AlignedUnVector<std::array<osuCrypto::block, 2>> phase_two_iknp_Sc(lg_delta * tau);
 
-    std::cout << "\nBenchmarking for phase two of preprocessing with IKNP/Naor-Pinkas..." << std::endl;
-    auto phase_two_iknp_thread = std::thread([&]
-                                             {
-       try {
-          phase_two_iknp_receive(phase_two_iknp_b, phase_two_iknp_Rs_r);
-       } catch (std::exception &e) {
-          std::cerr << e.what() << std::endl;
-       } });
+    LOG_INFO("Using {} kernels.", online_kernels().name);
 
-    try
+    if (!bulk_input.empty())
     {
-        phase_two_iknp_send(phase_two_iknp_Sc);
+        return run_bulk(bulk_input, bulk_output, bulk_direct_mode);
     }
-    catch (std::exception &e)
+    if (tenants)
     {
-        std::cerr << e.what() << std::endl;
+        return run_tenants(tenants);
     }
-    phase_two_iknp_thread.join();
-
-    // data structures for phase one with Silent OT (n)
-    osuCrypto::BitVector silent_ot_n_b_n(n);
-    osuCrypto::AlignedUnVector<osuCrypto::block> silent_ot_n_Rs_r_n(n);
-    osuCrypto::AlignedUnVector<std::array<osuCrypto::block, 2>> silent_ot_n_Sc_n(n);
-
-    std::cout << "\n\nBenchmarking for phase one of preprocessing with Silent OT (n OTs)..." << std::endl;
-    auto phase_one_sot_n_thread = std::thread([&]
-                                              {
-      try {
-      phase_one_sot_receive(silent_ot_n_b_n, silent_ot_n_Rs_r_n);
-      } catch (std::exception &e) {
-      std::cerr << e.what() << std::endl;
-      } });
-
-    try
+    if (load_users)
     {
-        phase_one_sot_send(silent_ot_n_Sc_n);
+        return run_load(load_users);
     }
-    catch (std::exception &e)
+    if (!sweep_parameter.empty())
     {
-        std::cerr << e.what() << std::endl;
+        return run_sweep(sweep_parameter, sweep_values);
     }
-    phase_one_sot_n_thread.join();
-
-    // extension of phase 1 OT results to n * kappa useful values
-    std::cout << "Extending phase one results..." << std::endl;
-    osuCrypto::Timer timer;
-    osuCrypto::Timer::timeUnit startExt = timer.setTimePoint("phase 1 extension start");
-
-    // data structures for phase one with Silent OT (n) extension
-    osuCrypto::BitVector silent_ot_n_b(n * kappa);
-    osuCrypto::AlignedUnVector<osuCrypto::block> silent_ot_n_Rs_r(n * kappa);
-    osuCrypto::AlignedUnVector<std::array<osuCrypto::block, 2>> silent_ot_n_Sc(n * kappa);
-    for (int i = 0; i < n; i++)
+    if (!psi_sizes.empty() || !lookup_sizes.empty())
     {
-        osuCrypto::PRNG prng_msg_0(silent_ot_n_Sc_n[i][0]);
-        osuCrypto::PRNG prng_msg_1(silent_ot_n_Sc_n[i][1]);
-        osuCrypto::PRNG prng_res(silent_ot_n_Rs_r_n[i]);
-
-        for (int j = 0; j < kappa; j++)
+        try
         {
-            silent_ot_n_b[j * n + i] = silent_ot_n_b_n[i];
-            silent_ot_n_Sc[j * n + i][0] = prng_msg_0.get<osuCrypto::block>();
-            silent_ot_n_Sc[j * n + i][1] = prng_msg_1.get<osuCrypto::block>();
-            silent_ot_n_Rs_r[j * n + i] = prng_res.get<osuCrypto::block>();
+            for (uint lg_size : psi_sizes)
+            {
+                run_psi(lg_size);
+            }
+            for (uint lg_size : lookup_sizes)
+            {
+                run_lookup(lg_size);
+            }
         }
+        catch (std::exception &e)
+        {
+            LOG_ERROR("{}", e.what());
+            return 1;
+        }
+        return 0;
     }
 
-    osuCrypto::Timer::timeUnit endExt = timer.setTimePoint("phase 1 extension end");
-    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(endExt - startExt).count();
-
-    std::cout << "Extension took " << ms << "ms" << std::endl;
-
-    // data structures for Naor-Pinkas phase two with Silent OT
-    osuCrypto::BitVector phase_two_sot_b(lg_delta * tau);
-    osuCrypto::AlignedUnVector<osuCrypto::block> phase_two_sot_Rs_r(lg_delta * tau);
-    osuCrypto::AlignedUnVector<std::array<osuCrypto::block, 2>> phase_two_sot_Sc(lg_delta * tau);
-
-    std::cout << "\nBenchmarking for phase two of preprocessing with Silent OT/Naor-Pinkas..." << std::endl;
-
-    auto phase_two_sot_thread = std::thread([&]
-                                            {
-       try {
-          phase_two_sot_receive(phase_two_sot_b, phase_two_sot_Rs_r);
-       } catch (std::exception &e) {
-          std::cerr << e.what() << std::endl;
-       } });
-
-    try
-    {
-        phase_two_sot_send(phase_two_sot_Sc);
-    }
-    catch (std::exception &e)
-    {
-        std::cerr << e.what() << std::endl;
-    }
-    phase_two_sot_thread.join();
-
-    std::cout << "\n\nBenchmarking for phase one of preprocessing with Silent OT (n * kappa OTs)..." << std::endl;
-
-    // data structures for phase one with Silent OT (n * kappa)
-    osuCrypto::BitVector phase_one_sot_unwasteful_b(n * kappa);
-    osuCrypto::AlignedUnVector<osuCrypto::block> phase_one_sot_unwasteful_Rs_r(n * kappa);
-    osuCrypto::AlignedUnVector<std::array<osuCrypto::block, 2>> phase_one_sot_unwasteful_Sc(n * kappa);
-
-    auto phase_one_sot_unwasteful_thread = std::thread([&]
-                                                       {
-      try {
-      phase_one_sot_unwasteful_receive(phase_one_sot_unwasteful_b, phase_one_sot_unwasteful_Rs_r);
-      } catch (std::exception &e) {
-      std::cerr << e.what() << std::endl;
-      } });
-
-    try
-    {
-        phase_one_sot_unwasteful_send(phase_one_sot_unwasteful_Sc);
-    }
-    catch (std::exception &e)
-    {
-        std::cerr << e.what() << std::endl;
-    }
-    phase_one_sot_unwasteful_thread.join();
-
-    // data structures for Naor-Pinkas phase two with Silent OT
-    osuCrypto::BitVector second_phase_two_sot_b(lg_delta * tau);
-    osuCrypto::AlignedUnVector<osuCrypto::block> second_phase_two_sot_Rs_r(lg_delta * tau);
-    osuCrypto::AlignedUnVector<std::array<osuCrypto::block, 2>> second_phase_two_sot_Sc(lg_delta * tau);
-
-    std::cout << "\nBenchmarking for phase two of preprocessing with Silent OT/Naor-Pinkas..." << std::endl;
-
-    auto second_phase_two_sot_thread = std::thread([&]
-                                                   {
-       try {
-        phase_two_sot_receive(second_phase_two_sot_b, second_phase_two_sot_Rs_r);
-       } catch (std::exception &e) {
-          std::cerr << e.what() << std::endl;
-       } });
-
-    try
-    {
-        phase_two_sot_send(second_phase_two_sot_Sc);
-    }
-    catch (std::exception &e)
-    {
-        std::cerr << e.what() << std::endl;
-    }
-    second_phase_two_sot_thread.join();
-}
-
-int main(int argc, char *argv[])
-{
     // The following is for benchmarking purposes only.
     benchmark_alt_preproc();
-
-    std::cout << "\n\nComputing preprocessing for online example..." << std::endl;
-
-    // phase one data structures
-    osuCrypto::BitVector b(n * tau);
-    osuCrypto::AlignedUnVector<osuCrypto::block> Rs_r(n * tau);
-    osuCrypto::AlignedUnVector<std::array<osuCrypto::block, 2>> Sc(n * tau);
-
-    auto phase_one_iknp_thread = std::thread([&]
-                                             {
-       try {
-          phase_one_iknp_receive(b, Rs_r);
-       } catch (std::exception &e) {
-          std::cerr << e.what() << std::endl;
-       } });
-
-    try
+    if (subprotocol_report)
     {
-        phase_one_iknp_send(Sc);
+        subprotocol_stats().log();
     }
-    catch (std::exception &e)
-    {
-        std::cerr << e.what() << std::endl;
-    }
-    phase_one_iknp_thread.join();
-
-    // phase two data structures
-    std::vector<osuCrypto::u64> bpr(tau);
-    osuCrypto::AlignedVector<osuCrypto::block> Rc_r(tau);
-    osuCrypto::Matrix<osuCrypto::block> Ss(tau, delta);
 
-    uint statisticalSecurityParam = 40;
+    LOG_INFO("\n\nComputing preprocessing for online example...");
 
-    auto phase_2_thread = std::thread([&]
-                                      {
-      try {
-      phase_two_kkrt_receive(statisticalSecurityParam, bpr, Rc_r);
-      } catch (std::exception &e) {
-      std::cerr << e.what() << std::endl;
-      } });
+    // the online example is measured as a whole, with both parties in the main thread
+    phase_stats().set_variant("online example");
+    PhaseMeter preprocessing_meter("preprocessing", "both parties");
+    preprocessing_meter.start();
 
+    // the client and server of pool_oprf.h, the server holding the pool of its single user in memory.
+    // the client keeps the state variable `ctr` depicted in Figure 4 - Request, and the server follows the `ctr` values sent by the client.
+    const OprfParams params{n, lg_q, lg_p};
+    osuCrypto::BitVector sk = sample_key();
+    MemoryPoolStore<lane_t> server_pools;
+    PoolOprfServer<lane_t, MemoryPoolStore> server(params, sk, server_pools, prefetch_rounds);
+    PoolOprfClient<lane_t> client(params, 0, prefetch_rounds);
     try
     {
-        phase_two_kkrt_send(statisticalSecurityParam, Ss);
+        run_client_server([&](coproto::Socket &sock)
+                          { client.preprocess(tau, sock, link_emulator()); },
+                          [&](coproto::Socket &sock)
+                          { server.preprocess(0, tau, sock, false, link_emulator()); });
     }
     catch (std::exception &e)
     {
-        std::cerr << e.what() << std::endl;
+        LOG_ERROR("Preprocessing failed: {}", e.what());
+        return 1;
     }
 
-    phase_2_thread.join();
+    preprocessing_meter.stop();
+    preprocessing_meter.finish();
 
     osuCrypto::PRNG prng(osuCrypto::sysRandomSeed());
 
-    // sample secret key
-    osuCrypto::BitVector sk(n);
-    sk.randomize(prng);
-    osuCrypto::BitVector b_bar(n);
-    for (int i = 0; i < n; i++)
-    {
-        b_bar[i] = b[i] ^ sk[i];
-    }
-
-    // parse values from OTs
-    std::vector<std::array<uint, 2>> Sc_uint(n * tau);
-    for (int i = 0; i < n * tau; i++)
-    {
-        int32_t arr0[4];
-        memcpy(arr0, &Sc[i][0], sizeof(arr0));
-        int32_t arr1[4];
-        memcpy(arr1, &Sc[i][1], sizeof(arr1));
-
-        Sc_uint[i][0] = (arr0[0]);
-        Sc_uint[i][1] = (arr1[0]);
-    }
-
-    // State variable `ctr` depicted in Figure 4 - Request.
-    uint ctr = 0;
-
-    std::cout << "\nComputing " << num_rounds << " evaluations of the Pool OPRF..." << std::endl;
+    LOG_INFO("\nComputing {} evaluations of the Pool OPRF...", num_rounds);
 
     // Communication complexity for one round of the Pool OPRF.
     // The communication complexity is computed as follows:
     // n * lg_q + lg_delta for the output values `(e_1, ..., e_n), \bar{b}'` of the `Request` phase (Fig. 4). We do not account for session-specific values.
     // delta * p for the output values `y_0, ..., y_{delta-1}` of the `BlindEval` phase (Fig. 4). Again, we ignore the session-specific values (e.g., `uid, ctr`).
+    // The bytes actually sent by the batched sessions are reported by `log_wire_bytes`.
     uint comm_compl = (n * lg_q + lg_delta + delta * lg_p) / 8;
 
+    // messages exchanged during one round, with values packed on lg_q and lg_p bits respectively.
+    log_wire_budget(params);
+    std::vector<osuCrypto::u8> request_msg(params.request_size());
+    std::vector<osuCrypto::u8> response_msg(params.response_size());
+
+    OutputVerifier<lane_t> verifier(params, sk, 1.0);
+
+    PhaseMeter online_meter("online evaluations", "both parties");
+    online_meter.start();
+    double server_cpu_ms = 0;
+    PerfSection request_perf("request"), blind_eval_perf("blind eval"), finalize_perf("finalize");
+
     for (int round = 0; round < num_rounds; round++)
     {
         // Request (Fig. 4)
@@ -1023,107 +425,56 @@ int main(int argc, char *argv[])
         int64_t t = prng.get<int64_t>();
         int64_t x = prng.get<int64_t>();
 
-        osuCrypto::AlignedVector<uint> a(n);
-        osuCrypto::AlignedVector<uint> e_0(n);
-        osuCrypto::AlignedVector<uint> e_1(n);
-
-        // need a larger type if n*(q-1) > uint::MAX
-        uint c_sum = 0;
-
-        int size = 2 * n * sizeof(osuCrypto::u8);
-        osuCrypto::u8 *dest = static_cast<osuCrypto::u8 *>(malloc(size));
-        osuCrypto::RandomOracle ro(size);
-        ro.Update(t);
-        ro.Update(x);
-        ro.Final(dest);
-
-        for (int i = 0; i < n; i++)
-        {
-            uint high = dest[2 * i];
-            uint low = dest[2 * i + 1];
-            a[i] = ((high << 8) | low) & (q - 1);
-            e_0[i] = 0;
-
-            uint c_i = (e_0[i] - (Sc_uint[(ctr * n) + i][b_bar[i]])) & (q - 1);
-            e_1[i] = (a[i] + c_i + Sc_uint[(ctr * n) + i][1 - b_bar[i]]) & (q - 1);
-
-            c_sum += c_i;
-        }
-
-        c_sum = c_sum & (q - 1);
-
-        uint bpr_bar = ((c_sum & (delta - 1)) - bpr[ctr]) & (delta - 1);
+        request_perf.start();
+        PoolOprfClient<lane_t>::Round request = client.request(t, x, request_msg.data());
+        request_perf.stop();
 
         osuCrypto::Timer::timeUnit req_end = timer.setTimePoint("request end");
 
-        // BlindEval (Fig. 4)
-
-        osuCrypto::AlignedVector<std::array<uint, 2>> atil(n);
-
-        uint atil_sum = 0;
-
-        for (int i = 0; i < n; i++)
-        {
-            int32_t arr[4];
-            memcpy(arr, &Rs_r[(ctr * n) + i], sizeof(arr));
-
-            uint Rs_r_uint = arr[0];
-
-            atil[i][0] = (e_0[i] - Rs_r_uint) & (q - 1);
-            atil[i][1] = (e_1[i] - Rs_r_uint) & (q - 1);
-
-            atil_sum += atil[i][sk[i]];
-        }
-
-        atil_sum = atil_sum & (q - 1);
-
-        osuCrypto::AlignedVector<uint> y(delta);
-
-        for (int i = 0; i < delta; i++)
-        {
-            int32_t arr[4];
-            memcpy(arr, &Ss[ctr][(i - bpr_bar) & (delta - 1)], sizeof(arr));
-            uint Ss_uint = arr[0];
-
-            y[i] = ((((atil_sum - i) & (q - 1)) >> lg_delta) + Ss_uint) & (p - 1);
-        }
+        // BlindEval (Fig. 4), on the round sent along with the request
+        double server_cpu_start = thread_cpu_ms();
+        blind_eval_perf.start();
+        server.blind_eval(0, request.round, request_msg.data(), response_msg.data());
+        blind_eval_perf.stop();
+        server_cpu_ms += thread_cpu_ms() - server_cpu_start;
 
         osuCrypto::Timer::timeUnit be_end = timer.setTimePoint("blind eval end");
 
         // Finalize (Fig. 4)
-        int32_t arr[4];
-        memcpy(arr, &Rc_r[ctr], sizeof(arr));
-        uint Rc_r_uint = arr[0];
-
-        uint y_c_sum_mod_delta = y[c_sum & (delta - 1)];
-
-        uint y_final = (y_c_sum_mod_delta - Rc_r_uint);
-        uint temp_val = ((c_sum - (c_sum & (delta - 1))) >> lg_delta);
-
-        uint z = (y_final - temp_val) & (p - 1);
+        finalize_perf.start();
+        uint z = client.finalize(request, response_msg.data());
+        finalize_perf.stop();
 
         osuCrypto::Timer::timeUnit end = timer.setTimePoint("finalize end");
         auto client_mus = std::chrono::duration_cast<std::chrono::microseconds>(end - be_end + req_end - req_start).count();
         auto server_mus = std::chrono::duration_cast<std::chrono::microseconds>(be_end - req_end).count();
 
-        std::cout << "Result: " << z << " computed in " << client_mus << "µs for the client and " << server_mus << "µs for the server with communication complexity " << comm_compl << "B." << std::endl;
+        // both parties run in this thread, so there is no network stage
+        auto ns = [](auto d)
+        { return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count()); };
+        record_latency(LatencyRequest, ns(req_end - req_start));
+        record_latency(LatencyBlindEval, ns(be_end - req_end));
+        record_latency(LatencyFinalize, ns(end - be_end));
+        record_latency(LatencyEndToEnd, ns(end - req_start));
 
-        // Sanity check
-        uint eval_z = 0;
-        for (int i = 0; i < n; i++)
+        LOG_SAMPLED_INFO("Result: {} computed in {}µs for the client and {}µs for the server with communication complexity {}B.",
+                         z, client_mus, server_mus, comm_compl);
+
+        // Sanity check: every output of the example is compared to the direct evaluation from the key, in every build type.
+        if (!verifier.check(t, x, z))
         {
-            if (sk[i])
-            {
-                eval_z += a[i];
-            }
+            LOG_ERROR("Result {} differs from the direct evaluation of the PRF.", z);
         }
-        eval_z = ((eval_z) >> lg_delta) & (p - 1);
-
-        // asserts that the computed value matches the expected value.
-        assert(eval_z == z);
-        ctr++;
-        free(dest);
     }
 
-    return 0;
+    online_meter.stop();
+    online_meter.finish();
+    LOG_INFO("Server CPU per evaluation: {}µs", 1e3 * server_cpu_ms / num_rounds);
+    request_perf.report();
+    blind_eval_perf.report();
+    finalize_perf.report();
+    save_results();
+
+    int baseline_status = check_baseline();
+    return verifier.mismatches() ? 1 : baseline_status;
 }
@@ -0,0 +1,270 @@
+/*
+Microbenchmarks of the online phase: the online kernels of every instruction set supported by the host (`--bench-kernels`), and the cost of
+the coroutine frames of the batched sessions (`--bench-frames`, see frame_pool.h).
+*/
+
+#include "libOTe/Tools/Coproto.h"
+#include "cryptoTools/Common/Timer.h"
+
+#include "frame_pool.h"
+#include "kernels.h"
+#include "latency.h"
+#include "log.h"
+#include "online.h"
+#include "perf.h"
+#include "pool.h"
+#include "stats.h"
+#include "tool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Calls of the global `operator new` made by the calling thread, which replaces the default one below, so that the coroutine
+// frame benchmark counts the heap allocations of each path instead of assuming them.
+thread_local uint64_t thread_heap_allocations = 0;
+
+void *operator new(size_t size)
+{
+    thread_heap_allocations++;
+    while (true)
+    {
+        if (void *ptr = std::malloc(size ? size : 1))
+        {
+            return ptr;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if (!handler)
+        {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+void operator delete(void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+
+// Times the online kernels of every instruction set supported by the host on random data, for the parameters above.
+// Numbers are per round; the batched BlindEval processes `batch` rounds per call. The kernels are timed `bench_reps` times, and every run
+// records the time of `reps` rounds of each kernel under the "online kernels" variant, by instruction set, e.g. for a baseline comparison.
+void benchmark_online_kernels()
+{
+    LOG_INFO("Benchmarking online kernels with n = {}, lg_q = {}, lg_p = {}, delta = {} on {}-bit lanes...", n, lg_q, lg_p, delta, 8 * sizeof(lane_t));
+    phase_stats().set_variant("online kernels");
+
+    const uint batch = 64;
+    const uint reps = 2000;
+
+    osuCrypto::PRNG prng(osuCrypto::sysRandomSeed());
+
+    osuCrypto::AlignedUnVector<lane_t> a(n), Sc0(n * batch), Sc1(n * batch), e_1(n * batch), Rs(n * batch), Ss(delta * batch), y(delta * batch);
+    osuCrypto::AlignedUnVector<uint> bpr_bar(batch);
+    osuCrypto::BitVector b_bar(n), sk(n);
+    prng.get(Sc0.data(), Sc0.size());
+    prng.get(Sc1.data(), Sc1.size());
+    prng.get(Rs.data(), Rs.size());
+    prng.get(Ss.data(), Ss.size());
+    for (uint i = 0; i < n; i++)
+    {
+        a[i] = prng.get<lane_t>() & (q - 1);
+    }
+    for (uint r = 0; r < batch; r++)
+    {
+        bpr_bar[r] = prng.get<uint>() & (delta - 1);
+    }
+    b_bar.randomize(prng);
+    sk.randomize(prng);
+
+    for (Isa isa : {Isa::Generic, Isa::Sse41, Isa::Avx2, Isa::Avx512})
+    {
+        const OnlineKernels *isa_kernels = kernels_for(isa);
+        if (!isa_kernels)
+        {
+            LOG_INFO("  {}: not supported by this host", isa_name(isa));
+            continue;
+        }
+
+        const LaneKernels<lane_t> *kernels = &isa_kernels->lanes<lane_t>();
+        for (uint run = 0; run < bench_reps; run++)
+        {
+            uint sink = 0;
+
+            std::string isa_label = isa_kernels->name;
+            PerfSection request_perf(isa_label + " request"), blind_eval_perf(isa_label + " blind eval"), batch_perf(isa_label + " batched blind eval");
+            PhaseMeter request_meter("request", isa_kernels->name), blind_eval_meter("blind eval", isa_kernels->name),
+                batch_meter("batched blind eval", isa_kernels->name);
+
+            osuCrypto::Timer timer;
+            auto start = timer.setTimePoint("request start");
+            request_meter.start();
+            request_perf.start();
+            for (uint k = 0; k < reps; k++)
+            {
+                uint r = k % batch;
+                sink += kernels->request(a.data(), &Sc0[r * n], &Sc1[r * n], b_bar.data(), &e_1[r * n], n, q - 1);
+            }
+            request_perf.stop(reps);
+            request_meter.stop();
+            auto req_end = timer.setTimePoint("request end");
+            blind_eval_meter.start();
+            blind_eval_perf.start();
+            for (uint k = 0; k < reps; k++)
+            {
+                uint r = k % batch;
+                uint atil_sum = kernels->blind_eval(&e_1[r * n], &Rs[r * n], sk.data(), n, q - 1);
+                kernels->y_table(&Ss[r * delta], bpr_bar[r], atil_sum, &y[r * delta], delta, lg_delta, q - 1, p - 1);
+                sink += y[r * delta];
+            }
+            blind_eval_perf.stop(reps);
+            blind_eval_meter.stop();
+            auto be_end = timer.setTimePoint("blind eval end");
+            batch_meter.start();
+            batch_perf.start();
+            for (uint k = 0; k < reps; k += batch)
+            {
+                kernels->blind_eval_batch(e_1.data(), Rs.data(), sk.data(), Ss.data(), bpr_bar.data(), y.data(), batch, n, delta, lg_delta, q - 1, p - 1);
+                sink += y[0];
+            }
+            batch_perf.stop((reps + batch - 1) / batch * batch);
+            batch_meter.stop();
+            auto batch_end = timer.setTimePoint("batched blind eval end");
+            for (uint k = 0; k < reps; k++)
+            {
+                sink += kernels->masked_sum(&e_1[(k % batch) * n], sk.data(), n, q - 1);
+            }
+            auto direct_end = timer.setTimePoint("direct eval end");
+
+            uint batched_rounds = (reps + batch - 1) / batch * batch;
+            auto ns = [](auto d, uint count)
+            { return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count() / count; };
+
+            LOG_INFO("  {}: request {}ns, blind eval {}ns, batched blind eval {}ns per round, direct eval sum {}ns",
+                     isa_kernels->name, ns(req_end - start, reps), ns(be_end - req_end, reps), ns(batch_end - be_end, batched_rounds), ns(direct_end - batch_end, reps));
+            request_perf.report();
+            blind_eval_perf.report();
+            batch_perf.report();
+            request_meter.finish();
+            blind_eval_meter.finish();
+            batch_meter.finish();
+
+            benchmark_sink = sink;
+        }
+    }
+}
+
+// Cost of one coroutine per request, as an asynchronous server spawning a task for each request would pay it, with the default
+// heap-allocated frames and with the frame pools of frame_pool.h. Requests are served by `connections` threads at once, so that the
+// default frames contend for the allocator as under load. Heap allocations are counted by the `operator new` above, and the time
+// of every request is recorded from the creation of its coroutine to its completion.
+void benchmark_coroutine_frames()
+{
+    const uint reps = 100000;
+    const uint rounds = 64;
+    const uint connections = std::max(2u, std::thread::hardware_concurrency());
+
+    LOG_INFO("Benchmarking coroutine frames over {} requests on {} connections...", reps, connections);
+
+    const OprfParams params{n, lg_q, lg_p};
+    osuCrypto::PRNG prng(osuCrypto::sysRandomSeed());
+
+    ServerPool<lane_t> pool;
+    pool.n = n;
+    pool.delta = delta;
+    pool.tau = rounds;
+    pool.rs.resize(n * rounds);
+    pool.ss.resize(delta * rounds);
+    prng.get(pool.rs.data(), pool.rs.size());
+    prng.get(pool.ss.data(), pool.ss.size());
+    osuCrypto::BitVector sk(n);
+    sk.randomize(prng);
+
+    std::vector<osuCrypto::u8> requests(rounds * params.request_size());
+    prng.get(requests.data(), requests.size());
+
+    // BlindEval of one round per coroutine, and an empty coroutine for the cost of the frame alone.
+    auto blind_eval = [&](OnlineScratch<lane_t> &scratch, osuCrypto::u8 *response, uint r) -> coproto::task<>
+    {
+        oprf_blind_eval(params, pool, sk, r % rounds, 1, &requests[(r % rounds) * params.request_size()], scratch, response);
+        co_return;
+    };
+    auto pooled_blind_eval = [&](pooled_frame_t, OnlineScratch<lane_t> &scratch, osuCrypto::u8 *response, uint r) -> coproto::task<>
+    {
+        oprf_blind_eval(params, pool, sk, r % rounds, 1, &requests[(r % rounds) * params.request_size()], scratch, response);
+        co_return;
+    };
+    auto empty = [](OnlineScratch<lane_t> &, osuCrypto::u8 *response, uint r) -> coproto::task<>
+    {
+        response[0] = static_cast<osuCrypto::u8>(r);
+        co_return;
+    };
+    auto pooled_empty = [](pooled_frame_t, OnlineScratch<lane_t> &, osuCrypto::u8 *response, uint r) -> coproto::task<>
+    {
+        response[0] = static_cast<osuCrypto::u8>(r);
+        co_return;
+    };
+
+    // Serves the requests with one coroutine each, made by `spawn(scratch, response, r)`, and reports the allocations and latencies.
+    auto run = [&](const char *name, auto spawn)
+    {
+        std::vector<uint64_t> heap_allocations(connections), reuses(connections);
+        std::vector<LatencyHistogram> latencies(connections);
+        std::vector<std::thread> threads;
+
+        auto start = std::chrono::steady_clock::now();
+        for (uint c = 0; c < connections; c++)
+        {
+            threads.emplace_back(
+                [&, c]
+                {
+                    OnlineScratch<lane_t> scratch(params);
+                    std::vector<osuCrypto::u8> response(params.response_size());
+                    uint64_t heap_before = thread_heap_allocations;
+                    FramePool::Stats before = FramePool::stats();
+                    for (uint r = c; r < reps; r += connections)
+                    {
+                        auto request_start = std::chrono::steady_clock::now();
+                        coproto::sync_wait(spawn(scratch, response.data(), r));
+                        latencies[c].record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - request_start).count());
+                    }
+                    heap_allocations[c] = thread_heap_allocations - heap_before;
+                    reuses[c] = FramePool::stats().reuses - before.reuses;
+                });
+        }
+        for (std::thread &thread : threads)
+        {
+            thread.join();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        LatencyHistogram latency;
+        uint64_t total_allocations = 0, total_reuses = 0;
+        for (uint c = 0; c < connections; c++)
+        {
+            latency.merge(latencies[c]);
+            total_allocations += heap_allocations[c];
+            total_reuses += reuses[c];
+        }
+        LOG_INFO("  {}: {} heap allocations ({} per request), {} frames reused, {} requests/s, latency p50 {}ns, p99 {}ns, p99.9 {}ns, max {}ns", name,
+                 total_allocations, double(total_allocations) / reps, total_reuses, reps / seconds, latency.percentile(0.5), latency.percentile(0.99),
+                 latency.percentile(0.999), latency.max());
+    };
+
+    run("default frames, blind eval", blind_eval);
+    run("default frames, empty coroutine", empty);
+    run("pooled frames, blind eval", [&](OnlineScratch<lane_t> &scratch, osuCrypto::u8 *response, uint r)
+        { return pooled_blind_eval(pooled_frame, scratch, response, r); });
+    run("pooled frames, empty coroutine", [&](OnlineScratch<lane_t> &scratch, osuCrypto::u8 *response, uint r)
+        { return pooled_empty(pooled_frame, scratch, response, r); });
+}
@@ -0,0 +1,280 @@
+/*
+Bulk mode (`--bulk=`): evaluates the OPRF on every record of a file through batched sessions between a `PoolOprfClient` and a `PoolOprfServer`
+(see pool_oprf.h), or directly from the key (`--direct`), and writes the outputs packed to a file.
+*/
+
+#include "libOTe/Tools/Coproto.h"
+#include "cryptoTools/Common/Timer.h"
+
+#include "kernels.h"
+#include "log.h"
+#include "online.h"
+#include "pool_oprf.h"
+#include "tool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Bulk mode input records are a pair of little-endian int64 seeds `(t, x)` for the random oracle.
+const size_t bulk_record_size = 2 * sizeof(int64_t);
+
+// Header of the bulk mode output file. It is followed by `count` outputs packed on `lg_p` bits (see `pack_bits` in kernels.h),
+// in the order of the input records.
+struct BulkOutputHeader
+{
+    char magic[8];
+    osuCrypto::u64 count;
+    osuCrypto::u32 lg_p;
+    osuCrypto::u32 reserved;
+};
+
+// Reads up to `max_count` records into `records`. Returns the number of records read, which is smaller than `max_count` only at the end of the input.
+size_t read_records(std::istream &input, std::vector<int64_t> &records, size_t max_count)
+{
+    input.read(reinterpret_cast<char *>(records.data()), max_count * bulk_record_size);
+    if (input.gcount() % bulk_record_size)
+    {
+        throw std::runtime_error("the input ends with a truncated record");
+    }
+    return input.gcount() / bulk_record_size;
+}
+
+// Writes `count` outputs packed on `lg_p` bits. `count` must be a multiple of 8 except for the last call.
+void write_outputs(std::ostream &output, const lane_t *z, size_t count, std::vector<osuCrypto::u8> &packed_z)
+{
+    packed_z.resize(packed_size(count, lg_p));
+    size_t bytes = online_kernels().lanes<lane_t>().pack_bits(z, count, lg_p, packed_z.data());
+    output.write(reinterpret_cast<const char *>(packed_z.data()), bytes);
+}
+
+// Writes the output header; the number of outputs is filled in by `end_outputs` once known.
+void begin_outputs(std::ostream &output)
+{
+    BulkOutputHeader header{{'P', 'O', 'O', 'L', 'O', 'P', 'R', 'F'}, 0, lg_p, 0};
+    output.write(reinterpret_cast<const char *>(&header), sizeof(header));
+}
+
+void end_outputs(std::ostream &output, size_t count)
+{
+    BulkOutputHeader header{{'P', 'O', 'O', 'L', 'O', 'P', 'R', 'F'}, count, lg_p, 0};
+    output.seekp(0);
+    output.write(reinterpret_cast<const char *>(&header), sizeof(header));
+}
+
+// Server side of the bulk mode. Answers batches of requests until the client ends the session.
+void serve_session(PoolOprfServer<lane_t, MemoryPoolStore> &server)
+{
+    set_trace_thread_name("server");
+
+    auto sock = connect_party(true);
+
+    try
+    {
+        coproto::sync_wait(server.serve(sock, bulk_batch));
+    }
+    catch (std::exception &e)
+    {
+        LOG_ERROR("{}", e.what());
+    }
+
+    LOG_INFO("online server, sent {} bytes and received {} bytes", sock.bytesSent(), sock.bytesReceived());
+}
+
+// Client side of the bulk mode. Evaluates the OPRF on every record of `input` and writes the outputs to `output`.
+// A fraction `verify_rate` of the outputs is checked against a direct evaluation from `sk`.
+// Returns 0 on success, 2 if the pool ran out before the end of the input and 3 if a checked output was wrong.
+int bulk_evaluate(std::istream &input, std::ostream &output, PoolOprfClient<lane_t> &client, const osuCrypto::BitVector &sk)
+{
+    const OprfParams params{n, lg_q, lg_p};
+
+    // records are read and evaluated a chunk at a time; the pipeline drains at the end of each chunk.
+    const size_t chunk = 16 * bulk_pipeline * bulk_batch;
+
+    OutputVerifier<lane_t> verifier(params, sk, verify_rate);
+
+    std::vector<int64_t> records(2 * chunk);
+    osuCrypto::AlignedVector<lane_t> z(chunk);
+    std::vector<osuCrypto::u8> packed_z;
+
+    begin_outputs(output);
+
+    size_t evaluated = 0;
+    bool exhausted = false;
+    WireBytes wire;
+
+    auto sock = connect_party(false);
+
+    osuCrypto::Timer timer;
+    auto start = timer.setTimePoint("bulk start");
+
+    auto clientRoutine = [&]() -> coproto::task<>
+    {
+        bool more = true;
+        while (more)
+        {
+            size_t count = read_records(input, records, chunk);
+            more = count == chunk;
+            if (count > client.remaining())
+            {
+                count = client.remaining();
+                exhausted = true;
+                more = false;
+            }
+
+            co_await (client.evaluate(sock, records.data(), count, z.data(), bulk_batch, bulk_pipeline, &verifier, &wire));
+
+            write_outputs(output, z.data(), count, packed_z);
+            evaluated += count;
+        }
+
+        co_await (client.end(sock, &wire));
+    };
+
+    try
+    {
+        coproto::sync_wait(clientRoutine());
+    }
+    catch (std::exception &e)
+    {
+        LOG_ERROR("{}", e.what());
+    }
+
+    auto end = timer.setTimePoint("bulk end");
+
+    end_outputs(output, evaluated);
+
+    double seconds = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1e6;
+    double rate = evaluated / seconds;
+    size_t remaining = client.remaining();
+    size_t used = tau - remaining;
+
+    LOG_INFO("bulk client, sent {} bytes and received {} bytes", sock.bytesSent(), sock.bytesReceived());
+    log_wire_bytes(params, wire, sock.bytesSent(), sock.bytesReceived());
+    LOG_INFO("Evaluated {} inputs in {}s, i.e. {} evaluations/s with batches of {} and {} batches in flight.",
+             evaluated, seconds, rate, bulk_batch, bulk_pipeline);
+    LOG_INFO("Pool consumption: {} of {} rounds used ({}%) at {} rounds/s; the remaining {} rounds last {}s at this rate.",
+             used, tau, 100.0 * used / tau, rate, remaining, remaining / rate);
+    LOG_INFO("Checked {} outputs against the direct evaluation, {} mismatches.", verifier.checked(), verifier.mismatches());
+
+    if (verifier.mismatches())
+    {
+        LOG_ERROR("{} of the checked outputs differ from the direct evaluation.", verifier.mismatches());
+        return 3;
+    }
+    if (exhausted)
+    {
+        LOG_ERROR("The pool was exhausted after {} evaluations; the remaining inputs were not evaluated.", evaluated);
+        return 2;
+    }
+    return 0;
+}
+
+// Direct bulk mode: the key holder evaluates the PRF on every record of `input` from its key `sk`, on all cores.
+// No preprocessing nor communication is involved; this is how a server evaluates its own set, e.g. for PSI.
+void bulk_direct(std::istream &input, std::ostream &output, const osuCrypto::BitVector &sk)
+{
+    const OprfParams params{n, lg_q, lg_p};
+    const size_t chunk = 1 << 16;
+    const size_t threads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<int64_t> records(2 * chunk);
+    osuCrypto::AlignedVector<lane_t> z(chunk);
+    std::vector<osuCrypto::u8> packed_z;
+
+    begin_outputs(output);
+
+    size_t evaluated = 0;
+
+    osuCrypto::Timer timer;
+    auto start = timer.setTimePoint("direct start");
+
+    try
+    {
+        size_t count;
+        do
+        {
+            count = read_records(input, records, chunk);
+            direct_eval_bulk(params, sk, records.data(), count, z.data(), threads);
+            write_outputs(output, z.data(), count, packed_z);
+            evaluated += count;
+        } while (count == chunk);
+    }
+    catch (std::exception &e)
+    {
+        LOG_ERROR("{}", e.what());
+    }
+
+    auto end = timer.setTimePoint("direct end");
+
+    end_outputs(output, evaluated);
+
+    double seconds = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1e6;
+    LOG_INFO("Evaluated {} inputs directly from the key in {}s, i.e. {} evaluations/s on {} threads.", evaluated, seconds, evaluated / seconds, threads);
+}
+
+// Bulk mode: runs the preprocessing, then evaluates the OPRF on every record of `input_path` ("-" for the standard input)
+// and writes the outputs to `output_path`. With `direct`, the records are evaluated directly from a key instead.
+int run_bulk(const std::string &input_path, const std::string &output_path, bool direct)
+{
+    std::ifstream input_file;
+    if (input_path != "-")
+    {
+        input_file.open(input_path, std::ios::binary);
+        if (!input_file)
+        {
+            LOG_ERROR("Cannot open {}", input_path);
+            return 1;
+        }
+    }
+    std::istream &input = input_path == "-" ? std::cin : input_file;
+
+    std::ofstream output(output_path, std::ios::binary);
+    if (!output)
+    {
+        LOG_ERROR("Cannot open {}", output_path);
+        return 1;
+    }
+
+    osuCrypto::BitVector sk = sample_key();
+
+    if (direct)
+    {
+        LOG_INFO("Evaluating the PRF on the records of {} from the key...", input_path);
+        bulk_direct(input, output, sk);
+        return 0;
+    }
+
+    LOG_INFO("Computing preprocessing for bulk mode...");
+
+    const OprfParams params{n, lg_q, lg_p};
+    MemoryPoolStore<lane_t> server_pools;
+    PoolOprfServer<lane_t, MemoryPoolStore> server(params, sk, server_pools, prefetch_rounds);
+    PoolOprfClient<lane_t> client(params, 0, prefetch_rounds);
+    try
+    {
+        run_client_server([&](coproto::Socket &sock)
+                          { client.preprocess(tau, sock, link_emulator()); },
+                          [&](coproto::Socket &sock)
+                          { server.preprocess(0, tau, sock, false, link_emulator()); });
+    }
+    catch (std::exception &e)
+    {
+        LOG_ERROR("Preprocessing failed: {}", e.what());
+        return 1;
+    }
+
+    LOG_INFO("\nEvaluating the Pool OPRF on the records of {}...", input_path);
+
+    auto server_thread = std::thread([&]
+                                     { serve_session(server); });
+
+    int status = bulk_evaluate(input, output, client, sk);
+    server_thread.join();
+
+    return status;
+}
@@ -0,0 +1,251 @@
+/*
+Benchmarks of the preprocessing algorithms presented in Figure 3 of the paper, with several combinations of OT extenders as building blocks.
+"Phase one" and "Phase two" refer to the two main phases of the preprocessing procedure, denoted (2) and (3) respectively in Figure 3.
+Every phase has a sender and a receiver, run by the drivers of preprocess.h for a specific OT extender.
+*/
+
+#include "libOTe/Tools/Coproto.h"
+
+#include "kernels.h"
+#include "log.h"
+#include "perf.h"
+#include "preprocess.h"
+#include "stats.h"
+#include "tool.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Runs the receiver of a phase in a new thread and its sender in the calling thread, and measures the CPU time of the other threads of the process
+// over the phase (see `HelperCpuMeter` in stats.h).
+template <typename Receiver, typename Sender>
+void run_parties(const char *phase, Receiver receiver, Sender sender)
+{
+    HelperCpuMeter helpers;
+    std::atomic<pid_t> receiver_tid{0};
+
+    auto receiver_thread = std::thread([&]
+                                       {
+       receiver_tid = current_tid();
+       set_trace_thread_name("receiver");
+       try {
+          receiver();
+       } catch (std::exception &e) {
+          LOG_ERROR("{}", e.what());
+       } });
+
+    try
+    {
+        sender();
+    }
+    catch (std::exception &e)
+    {
+        LOG_ERROR("{}", e.what());
+    }
+    receiver_thread.join();
+
+    helpers.finish(phase, {current_tid(), receiver_tid.load()});
+}
+
+// Runs a measured phase of random OTs over the current transport (see preprocess.h): the receiver writes to `Rs_r` the outputs for the choice bits `b`,
+// which `choose` draws if the extension takes them as inputs, and the sender writes the pairs of messages to `Sc`.
+// A failed phase is logged by `run_parties` and the benchmarks go on, its outputs being discarded anyway.
+template <typename Extension, typename Choose = RandomChoices>
+void run_ot_phase(const char *phase, const Extension &extension, osuCrypto::BitVector &b, osuCrypto::AlignedUnVector<osuCrypto::block> &Rs_r,
+                  osuCrypto::AlignedUnVector<std::array<osuCrypto::block, 2>> &Sc, Choose choose = {})
+{
+    run_parties(phase, [&]
+                {
+        auto sock = connect_party(false);
+        ot_phase_receive(PhaseParty{sock, phase, "receiver", true, link_emulator()}, extension, b, Rs_r, choose); }, [&]
+                {
+        auto sock = connect_party(true);
+        ot_phase_send(PhaseParty{sock, phase, "sender", true, link_emulator()}, extension, Sc);
+
+        // the connection stays open until the receiver is done with it
+        std::this_thread::sleep_for(std::chrono::seconds(1)); });
+}
+
+// contains examples for all preprocessing procedures.
+// these procedures were used to obtain the preprocessing measures given in the paper.
+// every phase records its measures in `phase_stats()`.
+void run_alt_preproc()
+{
+    // data structures for "unwasteful" IKNP phase one
+    osuCrypto::BitVector phase_one_iknp_b(n * kappa);
+    osuCrypto::AlignedUnVector<osuCrypto::block> phase_one_iknp_Rs_r(n * kappa);
+    osuCrypto::AlignedUnVector<std::array<osuCrypto::block, 2>> phase_one_iknp_Sc(n * kappa);
+
+    phase_stats().set_variant("iknp");
+    LOG_INFO("Benchmarking for phase one of preprocessing with \"unwasteful\" IKNP...");
+    run_ot_phase("phase one iknp unwasteful", IknpExtension{}, phase_one_iknp_b, phase_one_iknp_Rs_r, phase_one_iknp_Sc,
+                 [](osuCrypto::PRNG &prng, osuCrypto::BitVector &b)
+                 {
+                     osuCrypto::BitVector b_n(n);
+                     b_n.randomize(prng);
+                     online_kernels().tile_bits(b_n.data(), n, kappa, b.data());
+                 });
+
+    // data structures for Naor-Pinkas phase two with IKNP
+    osuCrypto::BitVector phase_two_iknp_b(lg_delta * tau);
+    osuCrypto::AlignedUnVector<osuCrypto::block> phase_two_iknp_Rs_r(lg_delta * tau);
+    osuCrypto::AlignedUnVector<std::array<osuCrypto::block, 2>> phase_two_iknp_Sc(lg_delta * tau);
+
+    LOG_INFO("\nBenchmarking for phase two of preprocessing with IKNP/Naor-Pinkas...");
+    run_ot_phase("phase two iknp", IknpExtension{}, phase_two_iknp_b, phase_two_iknp_Rs_r, phase_two_iknp_Sc);
+
+    // data structures for phase one with Silent OT (n)
+    osuCrypto::BitVector silent_ot_n_b_n(n);
+    osuCrypto::AlignedUnVector<osuCrypto::block> silent_ot_n_Rs_r_n(n);
+    osuCrypto::AlignedUnVector<std::array<osuCrypto::block, 2>> silent_ot_n_Sc_n(n);
+
+    phase_stats().set_variant("silent ot (n)");
+    LOG_INFO("\n\nBenchmarking for phase one of preprocessing with Silent OT (n OTs)...");
+    run_ot_phase("phase one silent ot", SilentExtension{n}, silent_ot_n_b_n, silent_ot_n_Rs_r_n, silent_ot_n_Sc_n);
+
+    // extension of phase 1 OT results to n * kappa useful values
+    LOG_INFO("Extending phase one results...");
+    PhaseMeter extension_meter("phase one silent ot extension", "both parties");
+    extension_meter.start();
+
+    // data structures for phase one with Silent OT (n) extension
+    osuCrypto::BitVector silent_ot_n_b(n * kappa);
+    osuCrypto::AlignedUnVector<osuCrypto::block> silent_ot_n_Rs_r(n * kappa);
+    osuCrypto::AlignedUnVector<std::array<osuCrypto::block, 2>> silent_ot_n_Sc(n * kappa);
+
+    const OnlineKernels &kernels = online_kernels();
+    kernels.tile_bits(silent_ot_n_b_n.data(), n, kappa, silent_ot_n_b.data());
+
+    // each OT result seeds a PRNG whose output is generated in bulk, then scattered to every n-th position.
+    // one operation per extended OT
+    PerfSection extension_perf("phase one silent ot extension");
+    uint64_t extension_start = trace_now();
+    extension_perf.start();
+    osuCrypto::AlignedUnVector<osuCrypto::block> column(kappa);
+    for (int i = 0; i < n; i++)
+    {
+        osuCrypto::PRNG prng_msg_0(silent_ot_n_Sc_n[i][0]);
+        prng_msg_0.get(column.data(), kappa);
+        kernels.scatter_blocks(column.data(), kappa, 2 * n, &silent_ot_n_Sc[i][0]);
+
+        osuCrypto::PRNG prng_msg_1(silent_ot_n_Sc_n[i][1]);
+        prng_msg_1.get(column.data(), kappa);
+        kernels.scatter_blocks(column.data(), kappa, 2 * n, &silent_ot_n_Sc[i][1]);
+
+        osuCrypto::PRNG prng_res(silent_ot_n_Rs_r_n[i]);
+        prng_res.get(column.data(), kappa);
+        kernels.scatter_blocks(column.data(), kappa, n, &silent_ot_n_Rs_r[i]);
+    }
+
+    extension_perf.stop(n * kappa);
+    trace_span("phase one silent ot extension", extension_start);
+    extension_perf.report();
+
+    extension_meter.stop();
+    extension_meter.finish();
+
+    // data structures for Naor-Pinkas phase two with Silent OT
+    osuCrypto::BitVector phase_two_sot_b(lg_delta * tau);
+    osuCrypto::AlignedUnVector<osuCrypto::block> phase_two_sot_Rs_r(lg_delta * tau);
+    osuCrypto::AlignedUnVector<std::array<osuCrypto::block, 2>> phase_two_sot_Sc(lg_delta * tau);
+
+    LOG_INFO("\nBenchmarking for phase two of preprocessing with Silent OT/Naor-Pinkas...");
+
+    run_ot_phase("phase two silent ot", SilentExtension{lg_delta * tau}, phase_two_sot_b, phase_two_sot_Rs_r, phase_two_sot_Sc);
+
+    phase_stats().set_variant("silent ot (n * kappa)");
+    LOG_INFO("\n\nBenchmarking for phase one of preprocessing with Silent OT (n * kappa OTs)...");
+
+    // data structures for phase one with Silent OT (n * kappa)
+    osuCrypto::BitVector phase_one_sot_unwasteful_b(n * kappa);
+    osuCrypto::AlignedUnVector<osuCrypto::block> phase_one_sot_unwasteful_Rs_r(n * kappa);
+    osuCrypto::AlignedUnVector<std::array<osuCrypto::block, 2>> phase_one_sot_unwasteful_Sc(n * kappa);
+
+    run_ot_phase("phase one silent ot unwasteful", SilentExtension{n * kappa}, phase_one_sot_unwasteful_b, phase_one_sot_unwasteful_Rs_r,
+                 phase_one_sot_unwasteful_Sc);
+
+    // data structures for Naor-Pinkas phase two with Silent OT
+    osuCrypto::BitVector second_phase_two_sot_b(lg_delta * tau);
+    osuCrypto::AlignedUnVector<osuCrypto::block> second_phase_two_sot_Rs_r(lg_delta * tau);
+    osuCrypto::AlignedUnVector<std::array<osuCrypto::block, 2>> second_phase_two_sot_Sc(lg_delta * tau);
+
+    LOG_INFO("\nBenchmarking for phase two of preprocessing with Silent OT/Naor-Pinkas...");
+
+    run_ot_phase("phase two silent ot", SilentExtension{lg_delta * tau}, second_phase_two_sot_b, second_phase_two_sot_Rs_r, second_phase_two_sot_Sc);
+}
+
+// Runs every preprocessing procedure `bench_warmup` times unmeasured, then `bench_reps` times, and reports the statistics of each phase
+// and of the client and server totals of each variant (see `counts_for` in stats.h).
+void benchmark_alt_preproc()
+{
+    LOG_INFO("Benchmarking alternative preprocessing procedures...");
+    LOG_INFO("Client complexity is taken as phase one sender + phase two receiver, and vice-versa for the server complexity.");
+
+    for (const std::string &warning : host_conditions())
+    {
+        LOG_WARN("Noisy conditions: {}", warning);
+    }
+
+    phase_stats().set_recording(false);
+    for (uint run = 0; run < bench_warmup; run++)
+    {
+        LOG_INFO("\nWarm-up run {} of {}...", run + 1, bench_warmup);
+        run_alt_preproc();
+    }
+
+    // the mean frequency of the cores before each run, which only changes between runs if it scales
+    std::vector<double> mhz;
+    phase_stats().set_recording(true);
+    for (uint run = 0; run < bench_reps; run++)
+    {
+        LOG_INFO("\nRun {} of {}...", run + 1, bench_reps);
+        mhz.push_back(cpu_mhz());
+        run_alt_preproc();
+    }
+
+    LOG_INFO("\nPreprocessing measures over {} runs:", bench_reps);
+    std::vector<PhaseSeries> series = phase_stats().series();
+    for (const PhaseSeries &phase : series)
+    {
+        std::vector<double> wall_ms, cpu_ms;
+        for (const PhaseSample &sample : phase.samples)
+        {
+            wall_ms.push_back(sample.wall_ms);
+            cpu_ms.push_back(sample.cpu_ms);
+        }
+
+        const PhaseKey &key = phase.key;
+        Summary s = summarize(wall_ms);
+        uint64_t peak_rss_kb = 0;
+        for (const PhaseSample &sample : phase.samples)
+        {
+            peak_rss_kb = std::max(peak_rss_kb, sample.memory.peak_rss_kb);
+        }
+
+        LOG_INFO("{}: {} {}: mean {}ms ({}ms of CPU), stddev {}ms, median {}ms, min {}ms, max {}ms, 95% CI [{}, {}]ms, sent {} bytes and received {} bytes, "
+                 "peak RSS {} kB",
+                 key.variant, key.phase, key.role, s.mean, summarize(cpu_ms).mean, s.stddev, s.median, s.min, s.max, s.mean - s.ci95, s.mean + s.ci95,
+                 phase.samples.front().bytes_sent, phase.samples.front().bytes_received, peak_rss_kb);
+        if (key.phase == "total" && key.role == "server")
+        {
+            // the number needed for capacity planning
+            LOG_INFO("{}: server CPU per preprocessed round {}µs", key.variant, 1e3 * summarize(cpu_ms).mean / tau);
+        }
+        if (s.count > 1 && s.stddev > bench_max_cv * s.mean)
+        {
+            LOG_WARN("{}: {} {}: noisy measures, the standard deviation is {}% of the mean", key.variant, key.phase, key.role, 100 * s.stddev / s.mean);
+        }
+    }
+
+    Summary freq = summarize(mhz);
+    if (freq.min > 0 && freq.max - freq.min > bench_max_cv * freq.min)
+    {
+        LOG_WARN("Noisy conditions: the mean CPU frequency varied from {} MHz to {} MHz between runs", freq.min, freq.max);
+    }
+}
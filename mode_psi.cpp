@@ -0,0 +1,409 @@
+/*
+Private set intersection (`--psi=`) and membership lookups (`--lookup=`): the client obtains the tags of its elements through batched sessions
+between a `PoolOprfClient` and a `PoolOprfServer` (see pool_oprf.h), and the server those of its set directly from the key, which it sends in
+a cuckoo table (cuckoo.h) or a cuckoo filter (filter.h).
+*/
+
+#include "libOTe/Tools/Coproto.h"
+#include "cryptoTools/Common/Timer.h"
+
+#include "cuckoo.h"
+#include "filter.h"
+#include "kernels.h"
+#include "log.h"
+#include "online.h"
+#include "pool_oprf.h"
+#include "tool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Tags of the PSI mode are the concatenation of `evals` OPRF outputs on `(t, x) = (j, element)` for j < evals, so that they are wide enough
+// for a client set of 2^lg_size elements: each client tag is compared to the `CuckooTable::num_hashes` tags of its slots.
+struct PsiTagFormat
+{
+    uint bits;
+    uint evals;
+    size_t bytes;
+
+    PsiTagFormat(uint lg_size)
+    {
+        bits = psi_stat_sec + lg_size + 2;
+        evals = (bits + lg_p - 1) / lg_p;
+        bytes = std::max<size_t>(packed_size(evals, lg_p), sizeof(osuCrypto::u64));
+    }
+};
+
+// Time and bytes spent by the client to obtain its tags through the online phase.
+struct TagStats
+{
+    double preprocessing_seconds = 0;
+    double online_seconds = 0;
+    osuCrypto::u64 online_bytes = 0;
+    size_t pools = 0;
+};
+
+// Computes the tags of `elements` through the batched online phase, for the server key `sk`.
+// The tag of an element is made of `evals` OPRF outputs on `(t, x) = (j, element)` for j < evals, packed on `lg_p` bits each into `tag_bytes` bytes.
+// The preprocessing is run again, with the same key, each time the pool is exhausted, i.e. every `tau / evals` elements: its cost grows
+// linearly with the set and usually dominates, so the number of pools is logged upfront and reported with the results.
+// Throws if a preprocessing or a session fails, since the tags would then be wrong.
+void online_tags(const osuCrypto::BitVector &sk, const std::vector<int64_t> &elements, uint evals, size_t tag_bytes, osuCrypto::u8 *tags, TagStats &stats)
+{
+    const OprfParams params{n, lg_q, lg_p};
+    const LaneKernels<lane_t> &kernels = online_kernels().lanes<lane_t>();
+
+    const size_t per_pool = tau / evals;
+    if (per_pool == 0)
+    {
+        throw std::invalid_argument("a pool of " + std::to_string(tau) + " rounds cannot hold the " + std::to_string(evals) + " evaluations of a tag");
+    }
+    size_t pools = (elements.size() + per_pool - 1) / per_pool;
+    LOG_INFO("  {} elements of {} evaluations each take {} preprocessings of {} rounds, one per {} elements", elements.size(), evals, pools, tau, per_pool);
+
+    std::vector<int64_t> records(2 * per_pool * evals);
+    OutputVerifier<lane_t> verifier(params, sk, verify_rate);
+    osuCrypto::AlignedVector<lane_t> z(per_pool * evals);
+
+    // each pool replaces the previous one in the store
+    MemoryPoolStore<lane_t> server_pools;
+    PoolOprfServer<lane_t, MemoryPoolStore> server(params, sk, server_pools, prefetch_rounds);
+    PoolOprfClient<lane_t> client(params, 0, prefetch_rounds);
+
+    for (size_t start = 0; start < elements.size(); start += per_pool)
+    {
+        size_t count = std::min(per_pool, elements.size() - start);
+
+        osuCrypto::Timer timer;
+        auto preprocessing_start = timer.setTimePoint("preprocessing start");
+
+        run_client_server([&](coproto::Socket &sock)
+                          { client.preprocess(tau, sock, link_emulator()); },
+                          [&](coproto::Socket &sock)
+                          { server.preprocess(0, tau, sock, true, link_emulator()); });
+        stats.pools++;
+
+        auto online_start = timer.setTimePoint("online start");
+
+        for (size_t i = 0; i < count; i++)
+        {
+            for (uint j = 0; j < evals; j++)
+            {
+                records[2 * (i * evals + j)] = j;
+                records[2 * (i * evals + j) + 1] = elements[start + i];
+            }
+        }
+
+        // a party that fails closes its socket, so that the other one stops waiting on it, and the error is thrown once both are done
+        run_client_server(
+            [&](coproto::Socket &sock)
+            {
+                auto clientRoutine = [&]() -> coproto::task<>
+                {
+                    co_await (client.evaluate(sock, records.data(), count * evals, z.data(), bulk_batch, bulk_pipeline, &verifier));
+                    co_await (client.end(sock));
+                };
+
+                try
+                {
+                    coproto::sync_wait(clientRoutine());
+                }
+                catch (...)
+                {
+                    coproto::sync_wait(sock.close());
+                    throw;
+                }
+                stats.online_bytes += sock.bytesSent() + sock.bytesReceived();
+            },
+            [&](coproto::Socket &sock)
+            {
+                try
+                {
+                    coproto::sync_wait(server.serve(sock, bulk_batch));
+                }
+                catch (...)
+                {
+                    coproto::sync_wait(sock.close());
+                    throw;
+                }
+            });
+
+        for (size_t i = 0; i < count; i++)
+        {
+            kernels.pack_bits(&z[i * evals], evals, lg_p, &tags[(start + i) * tag_bytes]);
+        }
+
+        auto online_end = timer.setTimePoint("online end");
+        stats.preprocessing_seconds += std::chrono::duration_cast<std::chrono::microseconds>(online_start - preprocessing_start).count() / 1e6;
+        stats.online_seconds += std::chrono::duration_cast<std::chrono::microseconds>(online_end - online_start).count() / 1e6;
+    }
+
+    if (verifier.mismatches())
+    {
+        LOG_ERROR("{} of {} checked outputs differ from the direct evaluation.", verifier.mismatches(), verifier.checked());
+    }
+}
+
+// Computes the tags of `elements` directly from the key on `threads` threads, as `online_tags` does through the online phase.
+void direct_tags(const osuCrypto::BitVector &sk, const int64_t *elements, size_t count, uint evals, size_t tag_bytes, osuCrypto::u8 *tags, size_t threads = 1)
+{
+    const OprfParams params{n, lg_q, lg_p};
+    const LaneKernels<lane_t> &kernels = online_kernels().lanes<lane_t>();
+
+    std::vector<int64_t> records(2 * count * evals);
+    for (size_t i = 0; i < count; i++)
+    {
+        for (uint j = 0; j < evals; j++)
+        {
+            records[2 * (i * evals + j)] = j;
+            records[2 * (i * evals + j) + 1] = elements[i];
+        }
+    }
+
+    osuCrypto::AlignedVector<lane_t> z(count * evals);
+    direct_eval_bulk(params, sk, records.data(), count * evals, z.data(), threads);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        kernels.pack_bits(&z[i * evals], evals, lg_p, &tags[i * tag_bytes]);
+    }
+}
+
+// Sends `blob` from the server to the client, preceded by its size. Returns what the client received.
+std::vector<osuCrypto::u8> transfer_to_client(std::vector<osuCrypto::u8> blob)
+{
+    auto server_thread = std::thread([&]
+                                     {
+        set_trace_thread_name("server");
+        auto sock = connect_party(true);
+        try {
+            coproto::sync_wait([&]() -> coproto::task<> {
+                co_await (sock.send(encode_header<osuCrypto::u64>(blob.size())));
+                co_await (sock.send(std::move(blob)));
+                co_await (sock.flush());
+            }());
+        } catch (std::exception &e) {
+            LOG_ERROR("{}", e.what());
+        } });
+
+    std::vector<osuCrypto::u8> received;
+    auto sock = connect_party(false);
+    try
+    {
+        coproto::sync_wait([&]() -> coproto::task<>
+                           {
+            std::vector<osuCrypto::u8> size_msg(sizeof(osuCrypto::u64));
+            co_await (sock.recv(size_msg));
+            received.resize(decode_header<osuCrypto::u64>(size_msg));
+            co_await (sock.recv(received)); }());
+    }
+    catch (std::exception &e)
+    {
+        LOG_ERROR("{}", e.what());
+    }
+
+    server_thread.join();
+    return received;
+}
+
+// PSI between two random sets of 2^lg_size elements sharing half of them.
+// The client obtains the tags of its elements through the batched online phase.
+// The server computes the tags of its elements directly from `sk`, inserts them into a cuckoo table and sends it to the client, which probes it.
+void run_psi(uint lg_size)
+{
+    const PsiTagFormat tag(lg_size);
+    const size_t set_size = size_t(1) << lg_size;
+
+    LOG_INFO("\nPSI between sets of 2^{} elements with {}-bit tags ({} evaluations per element)...", lg_size, tag.evals * lg_p, tag.evals);
+
+    osuCrypto::PRNG prng(osuCrypto::sysRandomSeed());
+
+    std::vector<int64_t> client_set(set_size), server_set(set_size);
+    for (size_t i = 0; i < set_size; i++)
+    {
+        client_set[i] = prng.get<int64_t>();
+        server_set[i] = i < set_size / 2 ? client_set[i] : prng.get<int64_t>();
+    }
+
+    osuCrypto::BitVector sk = sample_key();
+
+    // server: tags of its own set, evaluated directly, and the table sent to the client
+    osuCrypto::Timer server_timer;
+    auto server_start = server_timer.setTimePoint("server start");
+
+    std::vector<osuCrypto::u8> server_tags(set_size * tag.bytes);
+    direct_tags(sk, server_set.data(), set_size, tag.evals, tag.bytes, server_tags.data(), std::max(1u, std::thread::hardware_concurrency()));
+
+    CuckooTable server_table(set_size, tag.bytes);
+    for (size_t i = 0; i < set_size; i++)
+    {
+        server_table.insert(&server_tags[i * tag.bytes]);
+    }
+    std::vector<osuCrypto::u8> serialized_table = server_table.serialize();
+    osuCrypto::u64 table_bytes = serialized_table.size() + sizeof(osuCrypto::u64);
+
+    auto server_end = server_timer.setTimePoint("server end");
+
+    // client: tags of its set through the online phase
+    std::vector<osuCrypto::u8> client_tags(set_size * tag.bytes);
+    TagStats stats;
+    online_tags(sk, client_set, tag.evals, tag.bytes, client_tags.data(), stats);
+
+    osuCrypto::Timer probe_timer;
+    auto probe_start = probe_timer.setTimePoint("probe start");
+
+    CuckooTable client_table = CuckooTable::deserialize(transfer_to_client(std::move(serialized_table)));
+    size_t intersection = 0;
+    for (size_t i = 0; i < set_size; i++)
+    {
+        intersection += client_table.contains(&client_tags[i * tag.bytes]);
+    }
+
+    auto probe_end = probe_timer.setTimePoint("probe end");
+
+    auto seconds = [](auto d)
+    { return std::chrono::duration_cast<std::chrono::microseconds>(d).count() / 1e6; };
+
+    LOG_INFO("PSI 2^{}: found {} common elements (expected {}).", lg_size, intersection, set_size / 2);
+    LOG_INFO("  client: preprocessing {}s over {} pools, online {}s, table transfer and probing {}s",
+             stats.preprocessing_seconds, stats.pools, stats.online_seconds, seconds(probe_end - probe_start));
+    LOG_INFO("  server: tags and table {}s", seconds(server_end - server_start));
+    LOG_INFO("  communication: online {} bytes, table {} bytes (preprocessing reported above)", stats.online_bytes, table_bytes);
+}
+
+// Whether a server set of 2^`lg_size` elements keeps the `lookup_queries / 2` members queried by `run_lookup` after its update.
+bool lookup_size_valid(uint lg_size)
+{
+    if (lg_size >= 64)
+    {
+        return false;
+    }
+    size_t set_size = size_t(1) << lg_size;
+    return set_size - static_cast<size_t>(set_size * lookup_churn) >= lookup_queries / 2;
+}
+
+// Membership lookups against a server set of 2^lg_size elements, e.g. a breach database.
+// The server computes the 64-bit tags of its elements directly from `sk` and builds a cuckoo filter of their hashes on all cores.
+// It sends the filter to the client, followed by an update replacing `lookup_churn` of its elements. The client obtains the tags of
+// its queries through the online phase and probes the filter with them. The probe throughput is measured on random hashes.
+void run_lookup(uint lg_size)
+{
+    // lg_p divides 64, so that tags are exactly 8 bytes
+    const uint evals = 64 / lg_p;
+    const size_t tag_bytes = sizeof(osuCrypto::u64);
+    const size_t set_size = size_t(1) << lg_size;
+    const size_t churn = static_cast<size_t>(set_size * lookup_churn);
+    const size_t threads = std::max(1u, std::thread::hardware_concurrency());
+
+    LOG_INFO("\nLookups against a set of 2^{} elements...", lg_size);
+
+    osuCrypto::PRNG prng(osuCrypto::sysRandomSeed());
+
+    std::vector<int64_t> server_set(set_size), added(churn), queries(lookup_queries);
+    prng.get(server_set.data(), server_set.size());
+    prng.get(added.data(), added.size());
+    for (size_t i = 0; i < lookup_queries; i++)
+    {
+        // the first `churn` elements of the server set are removed by the update, so the members queried are taken after them
+        queries[i] = i % 2 ? server_set[churn + (i / 2) % (set_size - churn)] : prng.get<int64_t>();
+    }
+
+    osuCrypto::BitVector sk = sample_key();
+
+    // server: tags and filter, built in parallel
+    osuCrypto::Timer timer;
+    auto build_start = timer.setTimePoint("build start");
+
+    CuckooFilter filter(set_size);
+    std::vector<std::thread> builders;
+    for (size_t t = 0; t < threads; t++)
+    {
+        builders.emplace_back([&, t]
+                              {
+            const size_t chunk = 1 << 12;
+            std::vector<osuCrypto::u8> tags(chunk * tag_bytes);
+            for (size_t begin = set_size * t / threads, end = set_size * (t + 1) / threads; begin < end; begin += chunk)
+            {
+                size_t count = std::min(chunk, end - begin);
+                direct_tags(sk, &server_set[begin], count, evals, tag_bytes, tags.data());
+                for (size_t i = 0; i < count; i++)
+                {
+                    filter.insert(CuckooFilter::hash(&tags[i * tag_bytes]));
+                }
+            } });
+    }
+    for (auto &builder : builders)
+    {
+        builder.join();
+    }
+
+    auto build_end = timer.setTimePoint("build end");
+
+    std::vector<osuCrypto::u8> serialized = filter.serialize();
+    size_t filter_bytes = serialized.size();
+
+    // server: update replacing the first `churn` elements with new ones
+    CuckooFilter base = filter;
+    std::vector<osuCrypto::u8> tags(churn * tag_bytes);
+    direct_tags(sk, server_set.data(), churn, evals, tag_bytes, tags.data());
+    for (size_t i = 0; i < churn; i++)
+    {
+        filter.erase(CuckooFilter::hash(&tags[i * tag_bytes]));
+    }
+    direct_tags(sk, added.data(), churn, evals, tag_bytes, tags.data());
+    for (size_t i = 0; i < churn; i++)
+    {
+        filter.insert(CuckooFilter::hash(&tags[i * tag_bytes]));
+    }
+    std::vector<osuCrypto::u8> update = filter.diff(base);
+    size_t update_bytes = update.size();
+
+    // client: filter and update, then its queries
+    CuckooFilter client_filter = CuckooFilter::deserialize(transfer_to_client(std::move(serialized)));
+    client_filter.apply(transfer_to_client(std::move(update)));
+
+    std::vector<osuCrypto::u8> query_tags(lookup_queries * tag_bytes);
+    TagStats stats;
+    online_tags(sk, queries, evals, tag_bytes, query_tags.data(), stats);
+
+    std::vector<osuCrypto::u64> hashes(lookup_queries);
+    std::vector<osuCrypto::u8> found(lookup_queries);
+    for (size_t i = 0; i < lookup_queries; i++)
+    {
+        hashes[i] = CuckooFilter::hash(&query_tags[i * tag_bytes]);
+    }
+    client_filter.contains(hashes.data(), lookup_queries, found.data());
+    size_t hits = std::count(found.begin(), found.end(), 1);
+
+    // probe throughput, batched with the kernels in use and one query at a time
+    const size_t probes = 1 << 22;
+    std::vector<osuCrypto::u64> random_hashes(probes);
+    std::vector<osuCrypto::u8> random_found(probes);
+    prng.get(random_hashes.data(), probes);
+
+    auto probe_start = timer.setTimePoint("probe start");
+    client_filter.contains(random_hashes.data(), probes, random_found.data());
+    auto batch_end = timer.setTimePoint("batched probes end");
+    size_t scalar_hits = 0;
+    for (size_t k = 0; k < probes; k++)
+    {
+        scalar_hits += client_filter.contains(random_hashes[k]);
+    }
+    auto scalar_end = timer.setTimePoint("single probes end");
+    benchmark_sink = scalar_hits;
+
+    auto seconds = [](auto d)
+    { return std::chrono::duration_cast<std::chrono::microseconds>(d).count() / 1e6; };
+
+    LOG_INFO("Lookup 2^{}: {} of {} queries found (expected {}).", lg_size, hits, lookup_queries, lookup_queries / 2);
+    LOG_INFO("  server: tags and filter built in {}s on {} threads, {} stashed", seconds(build_end - build_start), threads, filter.stash_size());
+    LOG_INFO("  distribution: filter {} bytes ({} bits per element), update of {} removals and {} insertions {} bytes",
+             filter_bytes, 8.0 * filter_bytes / set_size, churn, churn, update_bytes);
+    LOG_INFO("  client: preprocessing {}s over {} pools, online {}s, {} bytes", stats.preprocessing_seconds, stats.pools, stats.online_seconds, stats.online_bytes);
+    LOG_INFO("  probes ({}): {}M/s batched, {}M/s one at a time",
+             online_kernels().name, probes / seconds(batch_end - probe_start) / 1e6, probes / seconds(scalar_end - batch_end) / 1e6);
+}
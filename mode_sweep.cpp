@@ -0,0 +1,306 @@
+/*
+Parameter sweep (`--sweep=`): the preprocessing benchmarks of mode_preprocess.cpp and timed online evaluations at every point of a grid of
+one parameter, and the scaling curves of their time, traffic and peak RSS.
+*/
+
+#include "libOTe/Tools/Coproto.h"
+
+#include "log.h"
+#include "online.h"
+#include "pool.h"
+#include "stats.h"
+#include "subprotocol.h"
+#include "tool.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+// Default values of a swept parameter (see `run_sweep`), or none if it cannot be swept.
+std::vector<uint> sweep_grid(const std::string &parameter)
+{
+    std::vector<uint> values;
+    if (parameter == "tau")
+    {
+        for (uint lg_tau = 10; lg_tau <= 22; lg_tau += 2)
+        {
+            values.push_back(1 << lg_tau);
+        }
+    }
+    else if (parameter == "n")
+    {
+        for (uint value = 128; value <= 2048; value *= 2)
+        {
+            values.push_back(value);
+        }
+    }
+    else if (parameter == "lg_delta")
+    {
+        for (uint value = 2; value <= 8; value++)
+        {
+            values.push_back(value);
+        }
+    }
+    else if (parameter == "kappa")
+    {
+        for (uint value = 1024; value <= 16384; value *= 2)
+        {
+            values.push_back(value);
+        }
+    }
+    return values;
+}
+
+// Times Request, BlindEval and Finalize of the current parameters over pools of `tau` rounds of random values rather than preprocessed ones:
+// outputs are meaningless, but the memory footprint of the pools and the work of an evaluation are those of real pools.
+// Rounds are used in order, with prefetching, as in the online example. Returns false without measuring if the pools would take more than
+// `sweep_memory_share` of the physical memory.
+bool sweep_online()
+{
+    size_t lanes = (3 * size_t(n) + delta + 1) * tau;
+    size_t bytes = lanes * sizeof(lane_t) + tau * sizeof(osuCrypto::u64);
+    size_t memory = size_t(sysconf(_SC_PHYS_PAGES)) * sysconf(_SC_PAGESIZE);
+    if (bytes > sweep_memory_share * memory)
+    {
+        LOG_WARN("Online evaluations not measured: the pools would take {} MB of the {} MB of memory", bytes >> 20, memory >> 20);
+        return false;
+    }
+
+    osuCrypto::PRNG prng(osuCrypto::sysRandomSeed());
+
+    ClientPool<lane_t> client_pool;
+    client_pool.n = n;
+    client_pool.delta = delta;
+    client_pool.tau = tau;
+    client_pool.sc0.resize(size_t(n) * tau);
+    client_pool.sc1.resize(size_t(n) * tau);
+    client_pool.rc.resize(tau);
+    client_pool.bpr.resize(tau);
+    client_pool.b_bar.resize(n);
+    prng.get(client_pool.sc0.data(), client_pool.sc0.size());
+    prng.get(client_pool.sc1.data(), client_pool.sc1.size());
+    prng.get(client_pool.rc.data(), client_pool.rc.size());
+    for (osuCrypto::u64 &choice : client_pool.bpr)
+    {
+        choice = prng.get<osuCrypto::u64>() & (delta - 1);
+    }
+    client_pool.b_bar.randomize(prng);
+
+    ServerPool<lane_t> server_pool;
+    server_pool.n = n;
+    server_pool.delta = delta;
+    server_pool.tau = tau;
+    server_pool.rs.resize(size_t(n) * tau);
+    server_pool.ss.resize(size_t(delta) * tau);
+    prng.get(server_pool.rs.data(), server_pool.rs.size());
+    prng.get(server_pool.ss.data(), server_pool.ss.size());
+
+    osuCrypto::BitVector sk = sample_key();
+    const OprfParams params{n, lg_q, lg_p};
+    std::vector<osuCrypto::u8> request_msg(params.request_size());
+    std::vector<osuCrypto::u8> response_msg(params.response_size());
+    OnlineScratch<lane_t> client_scratch(params);
+    OnlineScratch<lane_t> server_scratch(params);
+    PoolCursor<ClientPool<lane_t>> client_cursor(client_pool, prefetch_rounds);
+    PoolCursor<ServerPool<lane_t>> server_cursor(server_pool, prefetch_rounds);
+
+    PhaseMeter meter("evaluations", "both parties");
+    meter.start();
+    for (uint i = 0; i < std::min(tau, sweep_online_evals); i++)
+    {
+        derive_coefficients(params, prng.get<int64_t>(), prng.get<int64_t>(), client_scratch, client_scratch.a.data());
+        uint ctr = client_cursor.reserve();
+        uint c_sum = oprf_request(params, client_pool, ctr, client_scratch.a.data(), client_scratch, request_msg.data());
+        oprf_blind_eval(params, server_pool, sk, server_cursor.reserve(), 1, request_msg.data(), server_scratch, response_msg.data());
+        benchmark_sink = oprf_finalize(params, client_pool, ctr, c_sum, response_msg.data(), client_scratch);
+    }
+    meter.stop();
+    meter.finish();
+    return true;
+}
+
+// Measures of one curve of a sweep at one point: the median time over the runs, the traffic and the peak RSS of the process.
+struct SweepMeasure
+{
+    uint value;
+    double size;
+    double wall_ms;
+    double bytes;
+    double peak_rss_kb;
+};
+
+// Adds the measures of the current point to the curves of a sweep: the client and server totals of every preprocessing variant,
+// and one online evaluation.
+void add_sweep_point(uint value, double size, std::map<std::string, std::vector<SweepMeasure>> &curves)
+{
+    const OprfParams params{n, lg_q, lg_p};
+    for (const PhaseSeries &series : phase_stats().series())
+    {
+        bool online = series.key.variant == "online";
+        if (!online && series.key.phase != "total")
+        {
+            continue;
+        }
+
+        std::vector<double> wall_ms;
+        uint64_t peak_rss_kb = 0;
+        for (const PhaseSample &sample : series.samples)
+        {
+            wall_ms.push_back(sample.wall_ms);
+            peak_rss_kb = std::max(peak_rss_kb, sample.memory.peak_rss_kb);
+        }
+
+        const PhaseSample &sample = series.samples.front();
+        if (online)
+        {
+            // messages of the evaluation, which are not sent in the online measures
+            double evals = std::min(tau, sweep_online_evals);
+            curves["online evaluation"].push_back({value, size, summarize(wall_ms).median / evals, double(params.request_size() + params.response_size()),
+                                                   double(peak_rss_kb)});
+        }
+        else
+        {
+            curves[series.key.variant + " " + series.key.role].push_back(
+                {value, size, summarize(wall_ms).median, double(sample.bytes_sent + sample.bytes_received), double(peak_rss_kb)});
+        }
+    }
+}
+
+// Logs the curves of a sweep over `parameter` and warns where a cost grows faster than expected between two consecutive points.
+// Preprocessing costs are expected to grow at most linearly with the size, and so is an online evaluation with `n` and `delta`, which set
+// its work, while it should not grow at all with `tau` or `kappa`.
+void report_sweep(const std::string &parameter, const char *transport_name, const std::map<std::string, std::vector<SweepMeasure>> &curves)
+{
+    LOG_INFO("\nScaling with {} ({}):", parameter, transport_name);
+    for (const auto &[name, points] : curves)
+    {
+        bool constant = name == "online evaluation" && (parameter == "tau" || parameter == "kappa");
+        for (size_t i = 0; i < points.size(); i++)
+        {
+            const SweepMeasure &point = points[i];
+            LOG_INFO("{} = {}: {}: {}ms, {} bytes, peak RSS {} kB", parameter, point.value, name, point.wall_ms, point.bytes, point.peak_rss_kb);
+            if (i == 0)
+            {
+                continue;
+            }
+
+            const SweepMeasure &previous = points[i - 1];
+            double expected = constant ? 1 : point.size / previous.size;
+            for (auto [metric, now, before] : {std::make_tuple("time", point.wall_ms, previous.wall_ms), std::make_tuple("traffic", point.bytes, previous.bytes),
+                                                std::make_tuple("peak RSS", point.peak_rss_kb, previous.peak_rss_kb)})
+            {
+                if (before > 0 && now > expected * (1 + sweep_max_growth) * before)
+                {
+                    LOG_WARN("{}: {} grows superlinearly from {} = {} to {}: x{} where x{} is expected", name, metric, parameter, previous.value, point.value,
+                             now / before, expected);
+                }
+            }
+        }
+    }
+}
+
+// Runs the preprocessing benchmarks (`bench_warmup` unmeasured runs and `bench_reps` measured ones, as `benchmark_alt_preproc`) and the
+// online evaluations at every value of `parameter`, the other parameters keeping their values, and reports the scaling curves.
+// The size of a point is the value of the parameter, or `delta` for `lg_delta`. The preprocessing runs over in-process sockets, for the
+// cost of the computation alone, and again over the emulated link if one is set (`--link=`) for network-bound costs. Records of every point
+// go to `results_path`, if set, with an `emulated_link` parameter.
+int run_sweep(const std::string &parameter, std::vector<uint> values)
+{
+    if (values.empty())
+    {
+        values = sweep_grid(parameter);
+    }
+    if (values.empty())
+    {
+        LOG_ERROR("Unknown sweep parameter: {} (tau, n, lg_delta or kappa)", parameter);
+        return 1;
+    }
+    for (uint value : values)
+    {
+        if (value == 0 || (parameter == "lg_delta" && value >= lg_q))
+        {
+            LOG_ERROR("Invalid value of {}: {}", parameter, value);
+            return 1;
+        }
+    }
+
+    const uint default_n = n, default_tau = tau, default_lg_delta = lg_delta, default_kappa = kappa;
+    std::vector<Transport> transports = {Transport::Local};
+    if (transport == Transport::Link)
+    {
+        transports.push_back(Transport::Link);
+    }
+
+    std::ofstream results;
+    if (!results_path.empty())
+    {
+        results.open(results_path);
+    }
+    bool first_record = true;
+
+    for (Transport sweep_transport : transports)
+    {
+        transport = sweep_transport;
+        const char *transport_name = transport == Transport::Local ? "in-process" : "emulated link";
+        std::map<std::string, std::vector<SweepMeasure>> curves;
+
+        for (uint value : values)
+        {
+            set_params(parameter == "n" ? value : default_n, parameter == "tau" ? value : default_tau, parameter == "lg_delta" ? value : default_lg_delta,
+                       parameter == "kappa" ? value : default_kappa);
+            LOG_INFO("\n\nSweep over {} ({}): {} = {}...", parameter, transport_name, parameter, value);
+            log_wire_budget({n, lg_q, lg_p});
+
+            phase_stats().clear();
+            subprotocol_stats().clear();
+            reset_peak_rss();
+            phase_stats().set_recording(false);
+            for (uint run = 0; run < bench_warmup; run++)
+            {
+                run_alt_preproc();
+            }
+            phase_stats().set_recording(true);
+            for (uint run = 0; run < bench_reps; run++)
+            {
+                run_alt_preproc();
+            }
+
+            // the online evaluations do not communicate, so they are only measured in-process
+            phase_stats().set_variant("online");
+            for (uint run = 0; transport == Transport::Local && run < bench_reps; run++)
+            {
+                if (!sweep_online())
+                {
+                    break;
+                }
+            }
+
+            if (subprotocol_report)
+            {
+                subprotocol_stats().log();
+            }
+            add_sweep_point(value, parameter == "lg_delta" ? delta : value, curves);
+            if (results.is_open())
+            {
+                ResultContext context = result_context();
+                context.params.push_back({"emulated_link", transport == Transport::Link});
+                write_results(results, phase_stats().series(), context, results_as_csv(), first_record);
+                first_record = false;
+            }
+        }
+
+        report_sweep(parameter, transport_name, curves);
+    }
+
+    set_params(default_n, default_tau, default_lg_delta, default_kappa);
+    if (results.is_open() && !results)
+    {
+        LOG_ERROR("Could not write the results to {}", results_path);
+    }
+    return 0;
+}
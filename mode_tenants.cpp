@@ -0,0 +1,442 @@
+/*
+Multi-tenant server (`--tenants=`) and load generator (`--load=`): many users, each with its own `PoolOprfClient`, are served by
+`PoolOprfServer`s sharing a `PoolRegistry` (see pool_oprf.h and registry.h), which keeps the server pools in memory up to a budget.
+*/
+
+#include "libOTe/Tools/Coproto.h"
+#include "cryptoTools/Common/Timer.h"
+
+#include "latency.h"
+#include "log.h"
+#include "online.h"
+#include "pool_oprf.h"
+#include "registry.h"
+#include "tool.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Multi-tenant server: `users` clients, each with its own pool, are served from a registry holding at most `tenant_budget` bytes of pools
+// in memory (see registry.h). Clients take turns over the same connection, so that cold pools are spilled to disk and loaded back.
+// Returns 3 if a checked output was wrong, as the bulk mode does.
+int run_tenants(uint users)
+{
+    const OprfParams params{n, lg_q, lg_p};
+
+    LOG_INFO("\nServing {} users with {} MB of server pools in memory...", users, tenant_budget >> 20);
+
+    osuCrypto::BitVector sk = sample_key();
+    PoolRegistry<lane_t> registry(tenant_pool_dir, tenant_budget, users);
+
+    // clients keep their own pools in memory; only the server pools go through the registry.
+    PoolOprfServer<lane_t> server(params, sk, registry, prefetch_rounds);
+    std::vector<std::unique_ptr<PoolOprfClient<lane_t>>> clients;
+    osuCrypto::Timer timer;
+    auto preprocessing_start = timer.setTimePoint("preprocessing start");
+    try
+    {
+        for (uint uid = 0; uid < users; uid++)
+        {
+            clients.push_back(std::make_unique<PoolOprfClient<lane_t>>(params, uid, prefetch_rounds));
+            run_client_server([&](coproto::Socket &sock)
+                              { clients[uid]->preprocess(tau, sock, link_emulator()); },
+                              [&](coproto::Socket &sock)
+                              { server.preprocess(uid, tau, sock, false, link_emulator()); });
+        }
+    }
+    catch (std::exception &e)
+    {
+        LOG_ERROR("Preprocessing failed: {}", e.what());
+        return 1;
+    }
+    auto online_start = timer.setTimePoint("online start");
+
+    OutputVerifier<lane_t> verifier(params, sk, verify_rate);
+    osuCrypto::PRNG prng(osuCrypto::sysRandomSeed());
+    std::vector<int64_t> records(2 * tenant_evals);
+    osuCrypto::AlignedVector<lane_t> z(tenant_evals);
+    WireBytes wire;
+
+    auto server_thread = std::thread([&]
+                                     {
+        set_trace_thread_name("server");
+        auto sock = connect_party(true);
+        try
+        {
+            coproto::sync_wait(server.serve(sock, bulk_batch));
+        }
+        catch (std::exception &e)
+        {
+            LOG_ERROR("{}", e.what());
+        } });
+
+    auto sock = connect_party(false);
+
+    auto clientRoutine = [&]() -> coproto::task<>
+    {
+        for (uint pass = 0; pass < tenant_passes; pass++)
+        {
+            for (uint uid = 0; uid < users; uid++)
+            {
+                prng.get(records.data(), records.size());
+                co_await (clients[uid]->evaluate(sock, records.data(), tenant_evals, z.data(), bulk_batch, bulk_pipeline, &verifier, &wire));
+            }
+        }
+        co_await (end_online(pooled_frame, sock, 0, &wire));
+    };
+
+    try
+    {
+        coproto::sync_wait(clientRoutine());
+    }
+    catch (std::exception &e)
+    {
+        LOG_ERROR("{}", e.what());
+    }
+    server_thread.join();
+
+    auto end = timer.setTimePoint("online end");
+    auto seconds = [](auto d)
+    { return std::chrono::duration_cast<std::chrono::microseconds>(d).count() / 1e6; };
+
+    auto stats = registry.stats();
+    size_t evaluations = size_t(tenant_passes) * users * tenant_evals;
+    LOG_INFO("Tenants: {} evaluations for {} users in {}s, i.e. {} evaluations/s (preprocessing took {}s).",
+             evaluations, users, seconds(end - online_start), evaluations / seconds(end - online_start), seconds(online_start - preprocessing_start));
+    LOG_INFO("  registry: {} batches on resident pools, {} pools loaded and {} spilled; {} pools ({} MB) resident at the end",
+             stats.hits, stats.loads, stats.evictions, stats.resident_pools, stats.resident_bytes >> 20);
+    log_wire_bytes(params, wire, sock.bytesSent(), sock.bytesReceived());
+    LOG_INFO("  checked {} outputs against the direct evaluation, {} mismatches.", verifier.checked(), verifier.mismatches());
+
+    return verifier.mismatches() ? 3 : 0;
+}
+
+// Draws users 0 to `users - 1` with probability proportional to 1 / (rank + 1)^exponent, from the inverse of the cumulative distribution.
+class ZipfSampler
+{
+public:
+    ZipfSampler(size_t users, double exponent) : cdf(users)
+    {
+        double sum = 0;
+        for (size_t rank = 0; rank < users; rank++)
+        {
+            sum += 1 / std::pow(rank + 1.0, exponent);
+            cdf[rank] = sum;
+        }
+        for (double &c : cdf)
+        {
+            c /= sum;
+        }
+    }
+
+    // `u` is uniform in [0, 1)
+    uint64_t sample(double u) const
+    {
+        return std::min<size_t>(std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin(), cdf.size() - 1);
+    }
+
+private:
+    std::vector<double> cdf;
+};
+
+// uniform in [0, 1)
+double uniform(osuCrypto::PRNG &prng)
+{
+    return (prng.get<osuCrypto::u64>() >> 11) * 0x1p-53;
+}
+
+// Load generator: `users` client sessions, each with its own pool and uid, drive a multi-tenant server (see `run_tenants`) over `load_clients`
+// connections for `load_duration_s` seconds, through the wire protocol of online.h. Each request evaluates the OPRF `load_request_evals` times
+// for a user drawn with Zipf popularity, so that every user sends requests at its own rate.
+// In closed loop, each connection sends its next request as soon as the previous one is answered. In open loop, requests arrive as a Poisson
+// process of rate `load_rate` and wait for a free connection, and their latency counts from their arrival so that queueing is included.
+// The requests of a user are served one at a time, in pool order. A connection that finds the pool of its user exhausted preprocesses both
+// pools again (a refill, one at a time since they all listen on the same port); requests arriving meanwhile for that user, and requests
+// arriving while `load_max_queue` others wait, are rejected.
+// Returns 3 if a checked output was wrong, as the bulk mode does.
+int run_load(uint users)
+{
+    const uint default_tau = tau;
+    set_params(n, load_pool_rounds, lg_delta, kappa);
+    const OprfParams params{n, lg_q, lg_p};
+    bool open_loop = load_rate > 0;
+
+    struct Session
+    {
+        std::mutex mutex;
+        std::unique_ptr<PoolOprfClient<lane_t>> client;
+
+        // set from the start of a refill until both pools are replaced, so that a failed refill is run again before the next request
+        bool needs_refill = false;
+        std::atomic<bool> refilling{false};
+    };
+
+    LOG_INFO("\nPreprocessing pools of {} rounds for {} users...", tau, users);
+    osuCrypto::BitVector sk = sample_key();
+    PoolRegistry<lane_t> registry(tenant_pool_dir, tenant_budget, users);
+    std::vector<Session> sessions(users);
+
+    // the server side of the preprocessing, which refills run one at a time
+    PoolOprfServer<lane_t> preprocessing_server(params, sk, registry, prefetch_rounds);
+    try
+    {
+        for (uint uid = 0; uid < users; uid++)
+        {
+            sessions[uid].client = std::make_unique<PoolOprfClient<lane_t>>(params, uid, prefetch_rounds);
+            run_client_server([&](coproto::Socket &sock)
+                              { sessions[uid].client->preprocess(tau, sock, link_emulator()); },
+                              [&](coproto::Socket &sock)
+                              { preprocessing_server.preprocess(uid, tau, sock, false, link_emulator()); });
+        }
+    }
+    catch (std::exception &e)
+    {
+        LOG_ERROR("Preprocessing failed: {}", e.what());
+        return 1;
+    }
+
+    // one server thread per connection, all serving from the same registry
+    std::vector<coproto::Socket> sockets;
+    std::vector<std::thread> servers;
+    std::atomic<uint> connected{0};
+    for (uint c = 0; c < load_clients; c++)
+    {
+        servers.emplace_back([&]
+                             {
+            set_trace_thread_name("server");
+            auto sock = connect_party(true);
+            connected++;
+            PoolOprfServer<lane_t> server(params, sk, registry, prefetch_rounds);
+            try
+            {
+                coproto::sync_wait(server.serve(sock, bulk_batch));
+            }
+            catch (std::exception &e)
+            {
+                // the client stops waiting on the closed socket
+                LOG_ERROR("{}", e.what());
+                coproto::sync_wait(sock.close());
+            } });
+
+        // connections are made one after the other, so that each client reaches its own server
+        sockets.push_back(connect_party(false));
+        while (connected.load() <= c)
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    std::mutex refill_mutex;
+    std::atomic<uint64_t> refill_us{0};
+
+    // Evaluates one request of `uid`, after refilling the pools of the user if they are exhausted. Returns false, leaving the session
+    // in step with the server, if the refill failed; throws `RejectedBatch` if the server rejected the request.
+    auto evaluate = [&](coproto::Socket &sock, uint64_t uid, OutputVerifier<lane_t> &verifier, osuCrypto::PRNG &prng)
+    {
+        Session &session = sessions[uid];
+        std::lock_guard<std::mutex> lock(session.mutex);
+        if (session.needs_refill || session.client->remaining() < load_request_evals)
+        {
+            session.refilling = true;
+            session.needs_refill = true;
+            auto refill_start = std::chrono::steady_clock::now();
+            try
+            {
+                std::lock_guard<std::mutex> refill_lock(refill_mutex);
+                run_client_server([&](coproto::Socket &sock)
+                                  { session.client->preprocess(tau, sock, link_emulator()); },
+                                  [&](coproto::Socket &sock)
+                                  { preprocessing_server.preprocess(uid, tau, sock, true, link_emulator()); });
+            }
+            catch (std::exception &e)
+            {
+                LOG_ERROR("Could not refill the pools of user {}: {}", uid, e.what());
+                session.refilling = false;
+                return false;
+            }
+            session.needs_refill = false;
+            refill_us += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - refill_start).count();
+            session.refilling = false;
+        }
+
+        std::array<int64_t, 2 * load_request_evals> records;
+        std::array<lane_t, load_request_evals> z;
+        prng.get(records.data(), records.size());
+        coproto::sync_wait(session.client->evaluate(sock, records.data(), load_request_evals, z.data(), bulk_batch, 1, &verifier));
+        return true;
+    };
+
+    struct Arrival
+    {
+        uint64_t uid;
+        std::chrono::steady_clock::time_point at;
+    };
+    std::deque<Arrival> arrivals;
+    std::mutex arrivals_mutex;
+    std::condition_variable arrival_ready;
+    bool arrivals_done = false;
+
+    ZipfSampler zipf(users, load_zipf);
+    LatencyHistogram latency;
+    uint64_t completed = 0, refill_failures = 0, rejected_by_server = 0;
+    uint dropped_connections = 0;
+    size_t checked = 0, mismatches = 0;
+    std::mutex totals_mutex;
+
+    LOG_INFO("\nGenerating {} load on {} connections for {}s...", open_loop ? "open-loop" : "closed-loop", load_clients, load_duration_s);
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(load_duration_s));
+
+    std::vector<std::thread> clients;
+    for (uint c = 0; c < load_clients; c++)
+    {
+        clients.emplace_back([&, c]
+                             {
+            set_trace_thread_name("client");
+            osuCrypto::PRNG prng(osuCrypto::sysRandomSeed());
+            OutputVerifier<lane_t> verifier(params, sk, verify_rate);
+            LatencyHistogram client_latency;
+            uint64_t client_completed = 0, client_refill_failures = 0, client_rejected = 0;
+            bool dropped = false;
+
+            try
+            {
+                while (true)
+                {
+                    Arrival arrival;
+                    if (open_loop)
+                    {
+                        std::unique_lock<std::mutex> lock(arrivals_mutex);
+                        arrival_ready.wait(lock, [&] { return !arrivals.empty() || arrivals_done; });
+                        if (arrivals.empty())
+                        {
+                            break;
+                        }
+                        arrival = arrivals.front();
+                        arrivals.pop_front();
+                    }
+                    else
+                    {
+                        arrival = {zipf.sample(uniform(prng)), std::chrono::steady_clock::now()};
+                        if (arrival.at >= deadline)
+                        {
+                            break;
+                        }
+                    }
+
+                    // a failed refill or a rejected request leaves the session in step with the server, which goes on
+                    try
+                    {
+                        if (!evaluate(sockets[c], arrival.uid, verifier, prng))
+                        {
+                            client_refill_failures++;
+                            continue;
+                        }
+                    }
+                    catch (RejectedBatch &e)
+                    {
+                        LOG_WARN("{}", e.what());
+                        client_rejected++;
+                        continue;
+                    }
+                    client_latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - arrival.at).count());
+                    client_completed++;
+                }
+                coproto::sync_wait(end_online(pooled_frame, sockets[c], 0));
+            }
+            catch (std::exception &e)
+            {
+                // the session is broken: the server stops waiting on the closed socket
+                LOG_ERROR("Connection {} failed: {}", c, e.what());
+                coproto::sync_wait(sockets[c].close());
+                dropped = true;
+            }
+
+            std::lock_guard<std::mutex> lock(totals_mutex);
+            latency.merge(client_latency);
+            completed += client_completed;
+            refill_failures += client_refill_failures;
+            rejected_by_server += client_rejected;
+            dropped_connections += dropped;
+            checked += verifier.checked();
+            mismatches += verifier.mismatches(); });
+    }
+
+    // open loop: Poisson arrivals, i.e. exponential inter-arrival times
+    uint64_t offered = 0, rejected_waiting = 0, rejected_refilling = 0;
+    if (open_loop)
+    {
+        osuCrypto::PRNG prng(osuCrypto::sysRandomSeed());
+        auto next = start;
+        while (true)
+        {
+            next += std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(-std::log(1 - uniform(prng)) / load_rate));
+            if (next >= deadline)
+            {
+                break;
+            }
+            std::this_thread::sleep_until(next);
+
+            offered++;
+            uint64_t uid = zipf.sample(uniform(prng));
+            if (sessions[uid].refilling)
+            {
+                rejected_refilling++;
+                continue;
+            }
+            std::lock_guard<std::mutex> lock(arrivals_mutex);
+            if (arrivals.size() >= load_max_queue)
+            {
+                rejected_waiting++;
+                continue;
+            }
+            arrivals.push_back({uid, next});
+            arrival_ready.notify_one();
+        }
+
+        std::lock_guard<std::mutex> lock(arrivals_mutex);
+        arrivals_done = true;
+        arrival_ready.notify_all();
+    }
+
+    for (std::thread &client : clients)
+    {
+        client.join();
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (std::thread &server : servers)
+    {
+        server.join();
+    }
+
+    auto stats = registry.stats();
+    LOG_INFO("Load: {} requests of {} evaluations for {} users (Zipf {}) in {}s, i.e. {} requests/s", completed, load_request_evals, users, load_zipf, elapsed,
+             completed / elapsed);
+    if (open_loop)
+    {
+        LOG_INFO("  offered {} requests/s: {} rejected while {} requests were waiting, {} during a refill of their pool", offered / load_duration_s,
+                 rejected_waiting, load_max_queue, rejected_refilling);
+    }
+    LOG_INFO("  latency: p50 {}µs, p99 {}µs, p99.9 {}µs, max {}µs", latency.percentile(0.5) / 1e3, latency.percentile(0.99) / 1e3,
+             latency.percentile(0.999) / 1e3, latency.max() / 1e3);
+    LOG_INFO("  refills: {} pools preprocessed again in {}s; registry: {} batches on resident pools, {} pools loaded and {} spilled", stats.refills,
+             refill_us.load() / 1e6, stats.hits, stats.loads, stats.evictions);
+    LOG_INFO("  checked {} outputs against the direct evaluation, {} mismatches.", checked, mismatches);
+    if (refill_failures || rejected_by_server || dropped_connections)
+    {
+        LOG_ERROR("  failures: {} requests not made after a failed refill, {} rejected by the server, {} of {} connections dropped", refill_failures,
+                  rejected_by_server, dropped_connections, load_clients);
+    }
+
+    set_params(n, default_tau, lg_delta, kappa);
+    return mismatches ? 3 : refill_failures || rejected_by_server || dropped_connections ? 1 : 0;
+}
@@ -0,0 +1,615 @@
+/*
+Online phase of the Pool OPRF (Figure 4).
+
+The three algorithms of Figure 4 are provided for a single round (`oprf_request`, `oprf_blind_eval`, `oprf_finalize`),
+with the messages packed as they are sent: values of e_1 on lg_q bits followed by bpr_bar on lg_delta bits, and values of y on lg_p bits.
+
+For bulk workloads, requests are sent in batches of consecutive rounds over a coproto socket.
+Each batch is made of two messages, a fixed-size header followed by the packed requests (resp. responses) of the batch:
+
+    request header:  uid (u64) | first round (u64) | count (u32) | reserved (u32)
+    response header: first round (u64) | count (u32) | status (u32)
+
+A request header with a count of 0 ends the session. All integers are little-endian. A response header with a status other than
+`ResponseOk` rejects its batch and is not followed by responses; the session goes on.
+
+The session coroutines allocate their frames from the pools of frame_pool.h, hence their leading `pooled_frame` argument.
+The algorithms run under a `NoIoGuard` (see log.h): any console I/O made from them is reported when the executable exits.
+They and the messages of the sessions are recorded as spans when tracing is on (see trace.h), and the sessions record the latency of
+every evaluation by stage when latency recording is on (see latency.h).
+*/
+
+#pragma once
+
+#include "libOTe/Tools/Coproto.h"
+#include "cryptoTools/Common/BitVector.h"
+#include <cryptoTools/Crypto/RandomOracle.h>
+
+#include "frame_pool.h"
+#include "kernels.h"
+#include "latency.h"
+#include "log.h"
+#include "pool.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct OprfParams
+{
+    size_t n;
+    uint32_t lg_q;
+    uint32_t lg_p;
+
+    uint32_t lg_delta() const
+    {
+        return lg_q - lg_p;
+    }
+
+    size_t delta() const
+    {
+        return size_t(1) << lg_delta();
+    }
+
+    uint32_t q_mask() const
+    {
+        return (1u << lg_q) - 1;
+    }
+
+    uint32_t p_mask() const
+    {
+        return (1u << lg_p) - 1;
+    }
+
+    // size of one packed request, `(e_1, ..., e_n), bpr_bar`
+    size_t request_size() const
+    {
+        return packed_size(n, lg_q) + packed_size(1, lg_delta());
+    }
+
+    // size of one packed response, `y_0, ..., y_{delta-1}`
+    size_t response_size() const
+    {
+        return packed_size(delta(), lg_p);
+    }
+
+    // bits of information of one request and one response, as counted by the communication complexity of the paper
+    size_t request_bits() const
+    {
+        return n * lg_q + lg_delta();
+    }
+
+    size_t response_bits() const
+    {
+        return delta() * lg_p;
+    }
+};
+
+struct RequestHeader
+{
+    osuCrypto::u64 uid;
+    osuCrypto::u64 first_round;
+    osuCrypto::u32 count;
+    osuCrypto::u32 reserved;
+};
+
+// Status of a response batch.
+enum ResponseStatus : osuCrypto::u32
+{
+    ResponseOk = 0,
+
+    // the server has no pool for the user, or could not load it
+    ResponseNoPool = 1,
+
+    // the rounds are not the next ones of the pool of the user, e.g. once the pool is exhausted
+    ResponseRoundsUnavailable = 2,
+};
+
+inline const char *response_status_name(osuCrypto::u32 status)
+{
+    switch (status)
+    {
+    case ResponseOk:
+        return "ok";
+    case ResponseNoPool:
+        return "no pool for the user";
+    case ResponseRoundsUnavailable:
+        return "rounds unavailable";
+    default:
+        return "unknown status";
+    }
+}
+
+struct ResponseHeader
+{
+    osuCrypto::u64 first_round;
+    osuCrypto::u32 count;
+    osuCrypto::u32 status;
+};
+
+// Thrown by `evaluate_online` when the server rejected a batch. The session is still usable: the batches that were in flight are received.
+class RejectedBatch : public std::runtime_error
+{
+public:
+    RejectedBatch(osuCrypto::u64 uid, size_t first_round, size_t count, osuCrypto::u32 status)
+        : std::runtime_error("the server rejected rounds " + std::to_string(first_round) + " to " + std::to_string(first_round + count) + " of user " +
+                             std::to_string(uid) + ": " + response_status_name(status)),
+          status(status)
+    {
+    }
+
+    osuCrypto::u32 status;
+};
+
+static_assert(sizeof(RequestHeader) == 24 && sizeof(ResponseHeader) == 16, "headers are sent as is");
+
+// Bytes of the messages of batched sessions in one direction, split into the bits of the packed values counted by the communication
+// complexity, the padding of the packed values to whole bytes, and the headers of the batches (including the one ending the session).
+struct WireDirection
+{
+    uint64_t payload_bits = 0;
+    uint64_t padding_bits = 0;
+    uint64_t header_bytes = 0;
+
+    void add_values(size_t count, size_t bits, size_t packed_bytes)
+    {
+        payload_bits += count * bits;
+        padding_bits += count * (8 * packed_bytes - bits);
+    }
+
+    uint64_t bytes() const
+    {
+        return (payload_bits + padding_bits) / 8 + header_bytes;
+    }
+};
+
+// Bytes on the wire of the batched sessions of a client, counted message by message as they are sent and received.
+struct WireBytes
+{
+    uint64_t evaluations = 0;
+    uint64_t batches = 0;
+    WireDirection requests;
+    WireDirection responses;
+};
+
+template <typename Header>
+std::vector<osuCrypto::u8> encode_header(const Header &header)
+{
+    std::vector<osuCrypto::u8> msg(sizeof(Header));
+    memcpy(msg.data(), &header, sizeof(Header));
+    return msg;
+}
+
+template <typename Header>
+Header decode_header(const std::vector<osuCrypto::u8> &msg)
+{
+    Header header;
+    memcpy(&header, msg.data(), sizeof(Header));
+    return header;
+}
+
+// Scratch buffers for one party, so that evaluations do not allocate.
+template <typename Lane>
+struct OnlineScratch
+{
+    osuCrypto::AlignedVector<Lane> a, e_1, y;
+    std::vector<osuCrypto::u32> bpr_bar;
+    std::vector<osuCrypto::u8> ro;
+
+    // sized for batches of up to `batch` rounds
+    OnlineScratch(const OprfParams &params, size_t batch = 1)
+        : a(params.n), e_1(params.n * batch), y(params.delta() * batch), bpr_bar(batch), ro(params.n * sizeof(Lane))
+    {
+    }
+};
+
+// a = H(t, x), the coefficients of the LWR sample derived from the random oracle.
+template <typename Lane>
+void derive_coefficients(const OprfParams &params, int64_t t, int64_t x, OnlineScratch<Lane> &scratch, Lane *a)
+{
+    NoIoGuard no_io;
+    TRACE_SCOPE("derive coefficients");
+
+    osuCrypto::RandomOracle ro(scratch.ro.size());
+    ro.Update(t);
+    ro.Update(x);
+    ro.Final(scratch.ro.data());
+
+    online_kernels().lanes<Lane>().coeffs_from_bytes(scratch.ro.data(), params.n, params.q_mask(), a);
+}
+
+// Request (Fig. 4) for coefficients `a` on round `round`. Writes `request_size()` bytes to `msg` and returns c_sum, which Finalize needs.
+template <typename Lane>
+uint32_t oprf_request(const OprfParams &params, const ClientPool<Lane> &pool, size_t round, const Lane *a, OnlineScratch<Lane> &scratch, osuCrypto::u8 *msg)
+{
+    NoIoGuard no_io;
+    TRACE_SCOPE("request");
+
+    const LaneKernels<Lane> &kernels = online_kernels().lanes<Lane>();
+    const size_t n = params.n;
+    const uint32_t delta_mask = static_cast<uint32_t>(params.delta() - 1);
+
+    // e_0 is all zeros and is not sent.
+    uint32_t c_sum = kernels.request(a, &pool.sc0[round * n], &pool.sc1[round * n], pool.b_bar.data(), scratch.e_1.data(), n, params.q_mask());
+
+    Lane bpr_bar = static_cast<Lane>(((c_sum & delta_mask) - pool.bpr[round]) & delta_mask);
+
+    size_t e_1_bytes = kernels.pack_bits(scratch.e_1.data(), n, params.lg_q, msg);
+    kernels.pack_bits(&bpr_bar, 1, params.lg_delta(), msg + e_1_bytes);
+
+    return c_sum;
+}
+
+// BlindEval (Fig. 4) for `count` consecutive rounds starting at `first_round`.
+// Reads `count` packed requests from `requests` and writes `count` packed responses to `responses`.
+template <typename Lane>
+void oprf_blind_eval(const OprfParams &params, const ServerPool<Lane> &pool, const osuCrypto::BitVector &sk, size_t first_round, size_t count,
+                     const osuCrypto::u8 *requests, OnlineScratch<Lane> &scratch, osuCrypto::u8 *responses)
+{
+    NoIoGuard no_io;
+    TRACE_SCOPE("blind eval");
+
+    const LaneKernels<Lane> &kernels = online_kernels().lanes<Lane>();
+    const size_t n = params.n;
+    const size_t delta = params.delta();
+
+    for (size_t r = 0; r < count; r++)
+    {
+        const osuCrypto::u8 *req = requests + r * params.request_size();
+        Lane bpr_bar;
+        kernels.unpack_bits(req, n, params.lg_q, &scratch.e_1[r * n]);
+        kernels.unpack_bits(req + packed_size(n, params.lg_q), 1, params.lg_delta(), &bpr_bar);
+        scratch.bpr_bar[r] = bpr_bar;
+    }
+
+    kernels.blind_eval_batch(scratch.e_1.data(), &pool.rs[first_round * n], sk.data(), &pool.ss[first_round * delta], scratch.bpr_bar.data(), scratch.y.data(),
+                             count, n, delta, params.lg_delta(), params.q_mask(), params.p_mask());
+
+    for (size_t r = 0; r < count; r++)
+    {
+        kernels.pack_bits(&scratch.y[r * delta], delta, params.lg_p, responses + r * params.response_size());
+    }
+}
+
+// Finalize (Fig. 4) for round `round`, given the c_sum returned by the Request of that round and the packed response.
+template <typename Lane>
+uint32_t oprf_finalize(const OprfParams &params, const ClientPool<Lane> &pool, size_t round, uint32_t c_sum, const osuCrypto::u8 *response, OnlineScratch<Lane> &scratch)
+{
+    NoIoGuard no_io;
+    TRACE_SCOPE("finalize");
+
+    const uint32_t delta_mask = static_cast<uint32_t>(params.delta() - 1);
+
+    // only y_{c_sum mod delta} is needed: unpack the values up to it.
+    uint32_t index = c_sum & delta_mask;
+    online_kernels().lanes<Lane>().unpack_bits(response, index + 1, params.lg_p, scratch.y.data());
+
+    uint32_t y_final = scratch.y[index] - static_cast<uint32_t>(pool.rc[round]);
+    uint32_t temp_val = (c_sum - index) >> params.lg_delta();
+
+    return (y_final - temp_val) & params.p_mask();
+}
+
+// Evaluates the PRF directly from the key, as the server can do on its own inputs: z = floor((sum of a[i] for sk[i] = 1) mod q / delta).
+template <typename Lane>
+uint32_t direct_eval(const OprfParams &params, const osuCrypto::BitVector &sk, int64_t t, int64_t x, OnlineScratch<Lane> &scratch)
+{
+    derive_coefficients(params, t, x, scratch, scratch.a.data());
+
+    uint32_t sum = online_kernels().lanes<Lane>().masked_sum(scratch.a.data(), sk.data(), params.n, params.q_mask());
+
+    return (sum >> params.lg_delta()) & params.p_mask();
+}
+
+// Evaluates the PRF directly from the key on the `count` pairs `(records[2 * i], records[2 * i + 1])`, split over `threads` threads.
+template <typename Lane>
+void direct_eval_bulk(const OprfParams &params, const osuCrypto::BitVector &sk, const int64_t *records, size_t count, Lane *z, size_t threads)
+{
+    auto evaluate = [&](size_t begin, size_t end)
+    {
+        OnlineScratch<Lane> scratch(params);
+        for (size_t i = begin; i < end; i++)
+        {
+            z[i] = static_cast<Lane>(direct_eval(params, sk, records[2 * i], records[2 * i + 1], scratch));
+        }
+    };
+
+    threads = std::max<size_t>(1, std::min(threads, count / 64));
+    std::vector<std::thread> workers;
+    for (size_t t = 1; t < threads; t++)
+    {
+        workers.emplace_back(evaluate, count * t / threads, count * (t + 1) / threads);
+    }
+    evaluate(0, count / threads);
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+}
+
+// Cross-checks a sampled fraction `rate` of the OPRF outputs against a direct evaluation from the key, in every build type.
+// This requires the key and is meant for test deployments where both parties run together; each checked output costs one `direct_eval`.
+// Samples are drawn from a fixed sequence so that runs check the same outputs.
+template <typename Lane>
+class OutputVerifier
+{
+public:
+    OutputVerifier(const OprfParams &params, const osuCrypto::BitVector &sk, double rate)
+        : params(params), sk(sk), scratch(params),
+          threshold(rate >= 1 ? UINT64_MAX : static_cast<uint64_t>(std::max(rate, 0.0) * 18446744073709551616.0))
+    {
+    }
+
+    // Returns false if the output was checked and is wrong.
+    bool check(int64_t t, int64_t x, uint32_t z)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        if (state > threshold)
+        {
+            return true;
+        }
+
+        num_checked++;
+        uint32_t expected = direct_eval(params, sk, t, x, scratch);
+        if (expected != z)
+        {
+            num_mismatches++;
+            return false;
+        }
+        return true;
+    }
+
+    size_t checked() const
+    {
+        return num_checked;
+    }
+
+    size_t mismatches() const
+    {
+        return num_mismatches;
+    }
+
+private:
+    const OprfParams params;
+    const osuCrypto::BitVector &sk;
+    OnlineScratch<Lane> scratch;
+    uint64_t threshold;
+    uint64_t state = 0x9e3779b97f4a7c15ull;
+    size_t num_checked = 0;
+    size_t num_mismatches = 0;
+};
+
+// Server side of a batched session: answers request batches until the client ends the session.
+// Batches must follow each other in pool order; the cursor prefetches the rounds expected next.
+template <typename Lane>
+coproto::task<> serve_online(pooled_frame_t, const OprfParams &params, const ServerPool<Lane> &pool, const osuCrypto::BitVector &sk, coproto::Socket &sock,
+                             size_t max_batch, size_t prefetch_depth)
+{
+    PoolCursor<ServerPool<Lane>> cursor(pool, prefetch_depth);
+    OnlineScratch<Lane> scratch(params, max_batch);
+
+    while (true)
+    {
+        std::vector<osuCrypto::u8> header_msg(sizeof(RequestHeader));
+        {
+            TraceSpan span("recv request header");
+            co_await sock.recv(header_msg);
+        }
+
+        RequestHeader header = decode_header<RequestHeader>(header_msg);
+        if (header.count == 0)
+        {
+            break;
+        }
+        if (header.count > max_batch || header.first_round != cursor.position())
+        {
+            throw std::runtime_error("unexpected request batch for rounds " + std::to_string(header.first_round) + " to " +
+                                     std::to_string(header.first_round + header.count));
+        }
+
+        std::vector<osuCrypto::u8> requests(header.count * params.request_size());
+        {
+            TraceSpan span("recv requests");
+            co_await sock.recv(requests);
+        }
+
+        for (size_t r = 0; r < header.count; r++)
+        {
+            cursor.reserve();
+        }
+
+        std::vector<osuCrypto::u8> responses(header.count * params.response_size());
+        uint64_t blind_eval_start = latency_now();
+        oprf_blind_eval(params, pool, sk, header.first_round, header.count, requests.data(), scratch, responses.data());
+        if (blind_eval_start)
+        {
+            record_latency(LatencyBlindEval, (latency_now() - blind_eval_start) / header.count, header.count);
+        }
+
+        TraceSpan span("send responses");
+        co_await sock.send(encode_header(ResponseHeader{header.first_round, header.count, ResponseOk}));
+        co_await sock.send(std::move(responses));
+    }
+
+    co_await sock.flush();
+}
+
+// Client side of a batched session: evaluates the OPRF on the `count` inputs `(records[2 * i], records[2 * i + 1])`, i.e. pairs `(t, x)`,
+// and writes the outputs to `z`. Up to `pipeline` batches of at most `max_batch` rounds are in flight, so that the client computes
+// the requests of the next batches while the server answers the previous ones. The pool must hold `count` more rounds.
+// Can be called several times on the same session, which `end_online` closes. Outputs are passed to `verifier`, if any.
+// Requests carry `uid`, which selects the pool of the client on a server holding the pools of many users (see registry.h).
+// The messages are counted in `wire`, if any. If the server rejects a batch, no more batches are sent, those in flight are received,
+// and `RejectedBatch` is thrown; the outputs of the other batches are written.
+template <typename Lane>
+coproto::task<> evaluate_online(pooled_frame_t, const OprfParams &params, const ClientPool<Lane> &pool, PoolCursor<ClientPool<Lane>> &cursor, coproto::Socket &sock,
+                                const int64_t *records, size_t count, Lane *z, size_t max_batch, size_t pipeline, OutputVerifier<Lane> *verifier = nullptr,
+                                osuCrypto::u64 uid = 0, WireBytes *wire = nullptr)
+{
+    struct Batch
+    {
+        size_t first_round;
+        size_t offset;
+        std::vector<uint32_t> c_sum;
+
+        // when the requests were sent and when the Request of each evaluation started (see latency.h)
+        uint64_t sent_at = 0;
+        std::vector<uint64_t> started;
+    };
+
+    if (count > cursor.remaining())
+    {
+        throw std::runtime_error("the pool holds " + std::to_string(cursor.remaining()) + " rounds but " + std::to_string(count) + " evaluations were requested");
+    }
+
+    OnlineScratch<Lane> scratch(params);
+    std::deque<Batch> in_flight;
+    size_t sent = 0;
+    std::optional<RejectedBatch> rejected;
+
+    while ((!rejected && sent < count) || !in_flight.empty())
+    {
+        if (!rejected && sent < count && in_flight.size() < pipeline)
+        {
+            size_t batch_count = std::min(max_batch, count - sent);
+
+            // Request (Fig. 4) for every input of the batch
+            Batch batch{cursor.position(), sent, std::vector<uint32_t>(batch_count)};
+            std::vector<osuCrypto::u8> requests(batch_count * params.request_size());
+            uint64_t request_start = latency_now();
+            if (request_start)
+            {
+                batch.started.resize(batch_count);
+            }
+            for (size_t r = 0; r < batch_count; r++)
+            {
+                derive_coefficients(params, records[2 * (sent + r)], records[2 * (sent + r) + 1], scratch, scratch.a.data());
+                size_t round = cursor.reserve();
+                batch.c_sum[r] = oprf_request(params, pool, round, scratch.a.data(), scratch, &requests[r * params.request_size()]);
+
+                if (request_start)
+                {
+                    uint64_t request_end = latency_now();
+                    record_latency(LatencyRequest, request_end - request_start);
+                    batch.started[r] = request_start;
+                    request_start = request_end;
+                }
+            }
+
+            {
+                TraceSpan span("send requests");
+                batch.sent_at = latency_now();
+                co_await sock.send(encode_header(RequestHeader{uid, batch.first_round, static_cast<osuCrypto::u32>(batch_count), 0}));
+                co_await sock.send(std::move(requests));
+            }
+            if (wire)
+            {
+                wire->evaluations += batch_count;
+                wire->batches++;
+                wire->requests.header_bytes += sizeof(RequestHeader);
+                wire->requests.add_values(batch_count, params.request_bits(), params.request_size());
+            }
+
+            sent += batch_count;
+            in_flight.push_back(std::move(batch));
+        }
+        else
+        {
+            Batch &batch = in_flight.front();
+            size_t batch_count = batch.c_sum.size();
+
+            std::vector<osuCrypto::u8> header_msg(sizeof(ResponseHeader));
+            {
+                TraceSpan span("recv response header");
+                co_await sock.recv(header_msg);
+            }
+
+            ResponseHeader header = decode_header<ResponseHeader>(header_msg);
+            if (header.first_round != batch.first_round || header.count != batch_count)
+            {
+                throw std::runtime_error("unexpected response batch for rounds " + std::to_string(header.first_round) + " to " +
+                                         std::to_string(header.first_round + header.count));
+            }
+            if (header.status != ResponseOk)
+            {
+                if (wire)
+                {
+                    wire->responses.header_bytes += sizeof(ResponseHeader);
+                }
+                if (!rejected)
+                {
+                    rejected.emplace(uid, batch.first_round, batch_count, header.status);
+                }
+                in_flight.pop_front();
+                continue;
+            }
+
+            std::vector<osuCrypto::u8> responses(batch_count * params.response_size());
+            {
+                TraceSpan span("recv responses");
+                co_await sock.recv(responses);
+            }
+            if (wire)
+            {
+                wire->responses.header_bytes += sizeof(ResponseHeader);
+                wire->responses.add_values(batch_count, params.response_bits(), params.response_size());
+            }
+            uint64_t finalize_start = latency_now();
+            if (batch.sent_at)
+            {
+                record_latency(LatencyNetwork, finalize_start - batch.sent_at, batch_count);
+            }
+
+            // Finalize (Fig. 4) for every input of the batch
+            for (size_t r = 0; r < batch_count; r++)
+            {
+                z[batch.offset + r] = static_cast<Lane>(oprf_finalize(params, pool, batch.first_round + r, batch.c_sum[r], &responses[r * params.response_size()], scratch));
+            }
+
+            if (finalize_start && !batch.started.empty())
+            {
+                uint64_t finalize_end = latency_now();
+                record_latency(LatencyFinalize, (finalize_end - finalize_start) / batch_count, batch_count);
+                for (uint64_t started : batch.started)
+                {
+                    record_latency(LatencyEndToEnd, finalize_end - started);
+                }
+            }
+
+            if (verifier)
+            {
+                for (size_t r = 0; r < batch_count; r++)
+                {
+                    size_t i = batch.offset + r;
+                    verifier->check(records[2 * i], records[2 * i + 1], z[i]);
+                }
+            }
+
+            in_flight.pop_front();
+        }
+    }
+
+    if (rejected)
+    {
+        throw *rejected;
+    }
+}
+
+// Ends a batched session: a batch of 0 requests tells the server to stop.
+inline coproto::task<> end_online(pooled_frame_t, coproto::Socket &sock, size_t position, WireBytes *wire = nullptr)
+{
+    if (wire)
+    {
+        wire->requests.header_bytes += sizeof(RequestHeader);
+    }
+    co_await sock.send(encode_header(RequestHeader{0, position, 0, 0}));
+    co_await sock.flush();
+}
@@ -0,0 +1,244 @@
+/*
+Hardware performance counters of hot loops, with `perf_event_open`.
+
+Counting is off unless `--perf` is given. Each thread that uses a `PerfSection` then opens its own counters, once, which count the
+user-space events of that thread only: cycles, instructions, L1 data cache and last-level cache read misses, dTLB read misses and branch
+misses. A section reads them when it starts and stops, and accumulates the differences; `report` logs the counts per operation.
+Counters are read by thread rather than by section, since a coroutine may resume on another thread between two sections.
+
+When the PMU has fewer counters than events, the kernel multiplexes them and the counts are scaled by the share of time each one ran.
+Events the host does not support, e.g. in a VM, are left out of the report.
+*/
+
+#pragma once
+
+#include "log.h"
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <utility>
+
+enum PerfEvent
+{
+    PerfCycles,
+    PerfInstructions,
+    PerfL1dMisses,
+    PerfLlcMisses,
+    PerfDtlbMisses,
+    PerfBranchMisses,
+    NumPerfEvents,
+};
+
+namespace perf_detail
+{
+
+inline std::atomic<bool> enabled{false};
+
+// value of a counter along with the time it was enabled and running, in ns
+struct Reading
+{
+    uint64_t value = 0;
+    uint64_t enabled = 0;
+    uint64_t running = 0;
+};
+
+inline const char *event_name(int event)
+{
+    static const char *names[] = {"cycles", "instructions", "L1d misses", "LLC misses", "dTLB misses", "branch misses"};
+    return names[event];
+}
+
+inline uint64_t cache_miss(uint64_t cache)
+{
+    return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+
+// The counters of the calling thread, opened on first use.
+class ThreadCounters
+{
+public:
+    ThreadCounters()
+    {
+        const std::pair<uint32_t, uint64_t> events[NumPerfEvents] = {
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_L1D)},
+            {PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_LL)},
+            {PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_DTLB)},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        };
+
+        for (int e = 0; e < NumPerfEvents; e++)
+        {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = events[e].first;
+            attr.config = events[e].second;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+            fds[e] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+            if (e == PerfCycles && fds[e] < 0)
+            {
+                warn_unavailable(errno);
+            }
+        }
+    }
+
+    ~ThreadCounters()
+    {
+        for (int fd : fds)
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+        }
+    }
+
+    bool open(int event) const
+    {
+        return fds[event] >= 0;
+    }
+
+    void read_all(Reading *readings) const
+    {
+        for (int e = 0; e < NumPerfEvents; e++)
+        {
+            if (fds[e] < 0 || read(fds[e], &readings[e], sizeof(Reading)) != sizeof(Reading))
+            {
+                readings[e] = {};
+            }
+        }
+    }
+
+    static ThreadCounters &local()
+    {
+        static thread_local ThreadCounters counters;
+        return counters;
+    }
+
+private:
+    int fds[NumPerfEvents];
+
+    static void warn_unavailable(int error)
+    {
+        static std::atomic<bool> warned{false};
+        if (!warned.exchange(true))
+        {
+            bool denied = error == EACCES || error == EPERM;
+            LOG_WARN("Hardware counters are not available: {}{}", strerror(error), denied ? " (see /proc/sys/kernel/perf_event_paranoid)" : "");
+        }
+    }
+};
+
+}
+
+inline void set_perf_enabled(bool on)
+{
+    perf_detail::enabled = on;
+}
+
+inline bool perf_enabled()
+{
+    return perf_detail::enabled.load(std::memory_order_relaxed);
+}
+
+// Counts of the events over every run of a hot loop, e.g. every Request of the online example.
+// A section is used by one thread at a time; `start` and `stop` do nothing unless counting is on.
+class PerfSection
+{
+public:
+    explicit PerfSection(std::string name) : name(std::move(name))
+    {
+    }
+
+    void start()
+    {
+        if (perf_enabled())
+        {
+            perf_detail::ThreadCounters::local().read_all(begin);
+        }
+    }
+
+    // Ends a run of the section, which performed `ops` operations.
+    void stop(uint64_t ops = 1)
+    {
+        if (!perf_enabled())
+        {
+            return;
+        }
+
+        perf_detail::ThreadCounters &counters = perf_detail::ThreadCounters::local();
+        perf_detail::Reading end[NumPerfEvents];
+        counters.read_all(end);
+        for (int e = 0; e < NumPerfEvents; e++)
+        {
+            available[e] = counters.open(e);
+            total[e].value += end[e].value - begin[e].value;
+            total[e].enabled += end[e].enabled - begin[e].enabled;
+            total[e].running += end[e].running - begin[e].running;
+        }
+        operations += ops;
+    }
+
+    // Count of `event` per operation, scaled for multiplexing, or -1 if the event is not available.
+    double per_operation(PerfEvent event) const
+    {
+        const perf_detail::Reading &r = total[event];
+        if (!available[event] || r.running == 0 || operations == 0)
+        {
+            return -1;
+        }
+        return static_cast<double>(r.value) * r.enabled / r.running / operations;
+    }
+
+    // Logs the counts per operation.
+    void report() const
+    {
+        if (!perf_enabled() || operations == 0)
+        {
+            return;
+        }
+
+        std::string counts;
+        for (int e = 0; e < NumPerfEvents; e++)
+        {
+            double count = per_operation(static_cast<PerfEvent>(e));
+            if (count >= 0)
+            {
+                char buffer[64];
+                snprintf(buffer, sizeof(buffer), "%s%.1f %s", counts.empty() ? "" : ", ", count, perf_detail::event_name(e));
+                counts += buffer;
+            }
+        }
+        if (per_operation(PerfCycles) > 0 && per_operation(PerfInstructions) >= 0)
+        {
+            char buffer[32];
+            snprintf(buffer, sizeof(buffer), " (IPC %.2f)", per_operation(PerfInstructions) / per_operation(PerfCycles));
+            counts += buffer;
+        }
+
+        if (!counts.empty())
+        {
+            LOG_INFO("perf {}: {} per operation over {} operations", name, counts, operations);
+        }
+    }
+
+private:
+    std::string name;
+    perf_detail::Reading begin[NumPerfEvents];
+    perf_detail::Reading total[NumPerfEvents];
+    bool available[NumPerfEvents] = {};
+    uint64_t operations = 0;
+};
@@ -0,0 +1,267 @@
+/*
+Preprocessed pools consumed by the online phase (Figure 4).
+
+A pool keeps, for every round, the low bits of the OT results of both preprocessing phases in lanes (see kernels.h).
+The client holds the phase one sender messages and the phase two receiver outputs, and the server holds the phase one receiver outputs
+and the phase two sender messages. Rounds are handed out in order by a `PoolCursor`, which plays the role of the state variable `ctr`.
+Server pools can be written to and read from disk in the format described below.
+*/
+
+#pragma once
+
+#include "cryptoTools/Common/Aligned.h"
+#include "cryptoTools/Common/BitVector.h"
+#include "cryptoTools/Common/Matrix.h"
+
+#include "kernels.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Prefetches `bytes` bytes starting at `ptr` into the L2 cache, one cache line at a time.
+inline void prefetch_l2(const void *ptr, size_t bytes)
+{
+    const char *p = static_cast<const char *>(ptr);
+    for (size_t off = 0; off < bytes; off += 64)
+    {
+        __builtin_prefetch(p + off, 0, 2);
+    }
+}
+
+template <typename Lane>
+struct ClientPool
+{
+    size_t n = 0;
+    size_t delta = 0;
+    size_t tau = 0;
+
+    // phase one sender messages Sc[.][0] and Sc[.][1], n per round
+    osuCrypto::AlignedUnVector<Lane> sc0;
+    osuCrypto::AlignedUnVector<Lane> sc1;
+
+    // b xor sk, identical for every round
+    osuCrypto::BitVector b_bar;
+
+    // phase two receiver choices and outputs, one per round
+    std::vector<osuCrypto::u64> bpr;
+    osuCrypto::AlignedUnVector<Lane> rc;
+
+    void prefetch(size_t round) const
+    {
+        prefetch_l2(&sc0[round * n], n * sizeof(Lane));
+        prefetch_l2(&sc1[round * n], n * sizeof(Lane));
+        prefetch_l2(&bpr[round], sizeof(osuCrypto::u64));
+        prefetch_l2(&rc[round], sizeof(Lane));
+    }
+};
+
+template <typename Lane>
+struct ServerPool
+{
+    size_t n = 0;
+    size_t delta = 0;
+    size_t tau = 0;
+
+    // phase one receiver outputs, n per round
+    osuCrypto::AlignedUnVector<Lane> rs;
+
+    // phase two sender messages, delta per round
+    osuCrypto::AlignedUnVector<Lane> ss;
+
+    void prefetch(size_t round) const
+    {
+        prefetch_l2(&rs[round * n], n * sizeof(Lane));
+        prefetch_l2(&ss[round * delta], delta * sizeof(Lane));
+    }
+};
+
+// Builds the client pool from the outputs of the phase one sender and phase two receiver.
+template <typename Lane>
+ClientPool<Lane> make_client_pool(size_t n, size_t delta, size_t tau, const osuCrypto::AlignedUnVector<std::array<osuCrypto::block, 2>> &Sc,
+                                  const osuCrypto::BitVector &b_bar, const std::vector<osuCrypto::u64> &bpr, const osuCrypto::AlignedVector<osuCrypto::block> &Rc_r)
+{
+    const LaneKernels<Lane> &kernels = online_kernels().lanes<Lane>();
+
+    ClientPool<Lane> pool;
+    pool.n = n;
+    pool.delta = delta;
+    pool.tau = tau;
+
+    // only the low bits of each OT message matter since every value is reduced mod q or mod p.
+    pool.sc0.resize(n * tau);
+    pool.sc1.resize(n * tau);
+    kernels.unpack_lo(&Sc[0][0], sizeof(Sc[0]), pool.sc0.data(), n * tau);
+    kernels.unpack_lo(&Sc[0][1], sizeof(Sc[0]), pool.sc1.data(), n * tau);
+
+    pool.b_bar = b_bar;
+    pool.bpr = bpr;
+
+    pool.rc.resize(tau);
+    kernels.unpack_lo(Rc_r.data(), sizeof(osuCrypto::block), pool.rc.data(), tau);
+
+    return pool;
+}
+
+// Builds the server pool from the outputs of the phase one receiver and phase two sender.
+template <typename Lane>
+ServerPool<Lane> make_server_pool(size_t n, size_t delta, size_t tau, const osuCrypto::AlignedUnVector<osuCrypto::block> &Rs_r, const osuCrypto::Matrix<osuCrypto::block> &Ss)
+{
+    const LaneKernels<Lane> &kernels = online_kernels().lanes<Lane>();
+
+    ServerPool<Lane> pool;
+    pool.n = n;
+    pool.delta = delta;
+    pool.tau = tau;
+
+    pool.rs.resize(n * tau);
+    kernels.unpack_lo(Rs_r.data(), sizeof(osuCrypto::block), pool.rs.data(), n * tau);
+
+    pool.ss.resize(tau * delta);
+    kernels.unpack_lo(Ss.data(), sizeof(osuCrypto::block), pool.ss.data(), tau * delta);
+
+    return pool;
+}
+
+/*
+Persistent format of a server pool, used to spill the pools of idle users to disk (see registry.h):
+
+    magic "POOLSRV1" | lane bytes (u32) | reserved (u32) | n (u64) | delta (u64) | tau (u64) | next round (u64) | rs | ss
+
+followed by the lanes of `rs` (n per round) and `ss` (delta per round). All integers are little-endian.
+The next round is the first round not yet handed out, so that a reloaded pool never serves a round twice.
+*/
+struct PoolFileHeader
+{
+    char magic[8];
+    osuCrypto::u32 lane_bytes;
+    osuCrypto::u32 reserved;
+    osuCrypto::u64 n;
+    osuCrypto::u64 delta;
+    osuCrypto::u64 tau;
+    osuCrypto::u64 next_round;
+};
+static_assert(sizeof(PoolFileHeader) == 48, "pool file header is 48 bytes long");
+
+inline constexpr char pool_file_magic[8] = {'P', 'O', 'O', 'L', 'S', 'R', 'V', '1'};
+
+// Bytes held in memory by a server pool.
+template <typename Lane>
+size_t pool_bytes(const ServerPool<Lane> &pool)
+{
+    return (pool.rs.size() + pool.ss.size()) * sizeof(Lane);
+}
+
+template <typename Lane>
+void write_server_pool(const std::string &path, const ServerPool<Lane> &pool, size_t next_round)
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    PoolFileHeader header{{}, sizeof(Lane), 0, pool.n, pool.delta, pool.tau, next_round};
+    memcpy(header.magic, pool_file_magic, sizeof(header.magic));
+
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(pool.rs.data()), pool.rs.size() * sizeof(Lane));
+    file.write(reinterpret_cast<const char *>(pool.ss.data()), pool.ss.size() * sizeof(Lane));
+    if (!file)
+    {
+        throw std::runtime_error("cannot write pool file " + path);
+    }
+}
+
+// Rewrites the next round of a pool file, leaving the pool itself as is.
+inline void write_pool_position(const std::string &path, size_t next_round)
+{
+    std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+    osuCrypto::u64 value = next_round;
+    file.seekp(offsetof(PoolFileHeader, next_round));
+    file.write(reinterpret_cast<const char *>(&value), sizeof(value));
+    if (!file)
+    {
+        throw std::runtime_error("cannot write pool file " + path);
+    }
+}
+
+template <typename Lane>
+ServerPool<Lane> read_server_pool(const std::string &path, size_t &next_round)
+{
+    std::ifstream file(path, std::ios::binary);
+    PoolFileHeader header;
+    if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)))
+    {
+        throw std::runtime_error("cannot read pool file " + path);
+    }
+    if (memcmp(header.magic, pool_file_magic, sizeof(header.magic)) != 0 || header.lane_bytes != sizeof(Lane) || header.next_round > header.tau)
+    {
+        throw std::runtime_error("malformed pool file " + path);
+    }
+
+    ServerPool<Lane> pool;
+    pool.n = header.n;
+    pool.delta = header.delta;
+    pool.tau = header.tau;
+    pool.rs.resize(pool.n * pool.tau);
+    pool.ss.resize(pool.tau * pool.delta);
+    file.read(reinterpret_cast<char *>(pool.rs.data()), pool.rs.size() * sizeof(Lane));
+    file.read(reinterpret_cast<char *>(pool.ss.data()), pool.ss.size() * sizeof(Lane));
+    if (!file)
+    {
+        throw std::runtime_error("truncated pool file " + path);
+    }
+
+    next_round = header.next_round;
+    return pool;
+}
+
+// Hands out the rounds of a pool in order.
+// Reserving a round prefetches the data of the round `depth` rounds ahead, so that under a steady stream of requests
+// each round is already in L2 when it is used. A depth of 0 disables prefetching.
+template <typename Pool>
+class PoolCursor
+{
+public:
+    PoolCursor(const Pool &pool, size_t depth, size_t ctr = 0)
+        : pool(pool), depth(depth), ctr(ctr), prefetched(ctr)
+    {
+    }
+
+    // Returns the index of the next round. Throws once the pool is exhausted.
+    size_t reserve()
+    {
+        if (ctr >= pool.tau)
+        {
+            throw std::runtime_error("pool exhausted after " + std::to_string(pool.tau) + " rounds");
+        }
+
+        size_t round = ctr++;
+
+        // rounds up to `prefetched` were already requested by earlier reservations
+        size_t until = std::min(round + depth + 1, pool.tau);
+        for (prefetched = std::max(prefetched, round + 1); prefetched < until; prefetched++)
+        {
+            pool.prefetch(prefetched);
+        }
+
+        return round;
+    }
+
+    size_t position() const
+    {
+        return ctr;
+    }
+
+    size_t remaining() const
+    {
+        return pool.tau - ctr;
+    }
+
+private:
+    const Pool &pool;
+    size_t depth;
+    size_t ctr;
+    size_t prefetched;
+};
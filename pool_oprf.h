@@ -0,0 +1,263 @@
+/*
+Client and server of the Pool OPRF, for embedding the protocol in other programs.
+
+`PoolOprfClient` holds the pool of one user and `PoolOprfServer` the key, with the server pools of its users in a store. Both preprocess a pool
+with the other party over a coproto socket (see preprocess.h), so that any transport coproto supports can carry the protocol, then evaluate:
+
+- one round at a time, with `request`, `blind_eval` and `finalize` on the packed messages of online.h, which the caller carries;
+- or in batched sessions over a socket, with `evaluate` and `end` on the client and `serve` on the server (see `evaluate_online` in online.h).
+
+The store is a template parameter of the server: `PoolRegistry` (registry.h) keeps the pools in memory up to a budget and spills the others to
+disk, and `MemoryPoolStore` below keeps them all in memory. Any class template with the same `add`, `refill` and `acquire` can be used.
+Client pools are small and stay in memory.
+
+An object is used by one thread at a time. Several servers, e.g. one per connection, can share a store and a key.
+*/
+
+#pragma once
+
+#include "frame_pool.h"
+#include "link.h"
+#include "online.h"
+#include "pool.h"
+#include "preprocess.h"
+#include "registry.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+// Server pools of many users, all kept in memory.
+template <typename Lane>
+class MemoryPoolStore
+{
+    struct Entry
+    {
+        std::unique_ptr<ServerPool<Lane>> pool;
+
+        // first round not yet handed out
+        std::atomic<uint64_t> next_round{0};
+    };
+
+public:
+    // A pool, with the same interface as the handles of `PoolRegistry`.
+    class Handle
+    {
+    public:
+        const ServerPool<Lane> &pool() const
+        {
+            return *entry->pool;
+        }
+
+        size_t position() const
+        {
+            return entry->next_round.load(std::memory_order_relaxed);
+        }
+
+        // Hands out rounds `first_round` to `first_round + count - 1`, if they are the next rounds of the pool.
+        bool claim(size_t first_round, size_t count)
+        {
+            uint64_t expected = first_round;
+            return first_round + count <= entry->pool->tau && entry->next_round.compare_exchange_strong(expected, first_round + count);
+        }
+
+    private:
+        friend class MemoryPoolStore;
+
+        explicit Handle(Entry *entry) : entry(entry)
+        {
+        }
+
+        Entry *entry;
+    };
+
+    // Registers the freshly preprocessed pool of `uid`, which then starts at round 0.
+    void add(uint64_t uid, ServerPool<Lane> &&pool)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::unique_ptr<Entry> &entry = entries[uid];
+        if (entry)
+        {
+            throw std::runtime_error("user " + std::to_string(uid) + " already has a pool");
+        }
+        entry = std::make_unique<Entry>();
+        entry->pool = std::make_unique<ServerPool<Lane>>(std::move(pool));
+    }
+
+    // Replaces the pool of `uid` with a freshly preprocessed pool which starts at round 0. No batch of that user may run meanwhile.
+    void refill(uint64_t uid, ServerPool<Lane> &&pool)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::unique_ptr<Entry> &entry = entries[uid];
+        if (!entry)
+        {
+            entry = std::make_unique<Entry>();
+        }
+        entry->pool = std::make_unique<ServerPool<Lane>>(std::move(pool));
+        entry->next_round.store(0);
+    }
+
+    // The pool of `uid`. Throws if the user has no pool.
+    Handle acquire(uint64_t uid)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = entries.find(uid);
+        if (found == entries.end())
+        {
+            throw std::runtime_error("user " + std::to_string(uid) + " has no pool");
+        }
+        return Handle(found->second.get());
+    }
+
+private:
+    std::mutex mutex;
+    std::unordered_map<uint64_t, std::unique_ptr<Entry>> entries;
+};
+
+template <typename Lane>
+class PoolOprfClient
+{
+public:
+    // A round in progress, from its Request to its Finalize.
+    struct Round
+    {
+        size_t round;
+        uint32_t c_sum;
+    };
+
+    // The client of user `uid`. Pool data is prefetched `prefetch_depth` rounds ahead.
+    PoolOprfClient(const OprfParams &params, osuCrypto::u64 uid = 0, size_t prefetch_depth = 2)
+        : params(params), uid(uid), prefetch_depth(prefetch_depth), scratch(params)
+    {
+    }
+
+    // the cursor refers to the pool
+    PoolOprfClient(const PoolOprfClient &) = delete;
+    PoolOprfClient &operator=(const PoolOprfClient &) = delete;
+
+    // Preprocesses a pool of `tau` rounds with the server, in place of the current one. `link` is the emulated link the socket goes through, if any.
+    void preprocess(size_t tau, coproto::Socket &sock, const LinkEmulator *link = nullptr)
+    {
+        cursor.reset();
+        client_pool = preprocess_client_pool<Lane>(params, tau, sock, link);
+        cursor.emplace(client_pool, prefetch_depth);
+    }
+
+    // Request (Fig. 4) for the input (t, x) on the next round of the pool. Writes `params.request_size()` bytes to `msg`.
+    // Throws once the pool is exhausted.
+    Round request(int64_t t, int64_t x, osuCrypto::u8 *msg)
+    {
+        derive_coefficients(params, t, x, scratch, scratch.a.data());
+        size_t round = active_cursor().reserve();
+        return {round, oprf_request(params, client_pool, round, scratch.a.data(), scratch, msg)};
+    }
+
+    // Finalize (Fig. 4) of a round, given the response of the server to its request. Returns the output.
+    uint32_t finalize(const Round &round, const osuCrypto::u8 *response)
+    {
+        return oprf_finalize(params, client_pool, round.round, round.c_sum, response, scratch);
+    }
+
+    // Evaluates the OPRF on `count` records in batches of up to `max_batch` rounds, `pipeline` batches in flight, over a session with `serve`.
+    // Outputs are written to `z` and passed to `verifier`, if any, and the messages are counted in `wire`, if any.
+    coproto::task<> evaluate(coproto::Socket &sock, const int64_t *records, size_t count, Lane *z, size_t max_batch, size_t pipeline,
+                             OutputVerifier<Lane> *verifier = nullptr, WireBytes *wire = nullptr)
+    {
+        return evaluate_online(pooled_frame, params, client_pool, active_cursor(), sock, records, count, z, max_batch, pipeline, verifier, uid, wire);
+    }
+
+    // Ends a session started by `evaluate`.
+    coproto::task<> end(coproto::Socket &sock, WireBytes *wire = nullptr)
+    {
+        return end_online(pooled_frame, sock, active_cursor().position(), wire);
+    }
+
+    // number of rounds left before the pool has to be preprocessed again
+    size_t remaining() const
+    {
+        return cursor ? cursor->remaining() : 0;
+    }
+
+    const ClientPool<Lane> &pool() const
+    {
+        return client_pool;
+    }
+
+private:
+    OprfParams params;
+    osuCrypto::u64 uid;
+    size_t prefetch_depth;
+    ClientPool<Lane> client_pool;
+    std::optional<PoolCursor<ClientPool<Lane>>> cursor;
+    OnlineScratch<Lane> scratch;
+
+    PoolCursor<ClientPool<Lane>> &active_cursor()
+    {
+        if (!cursor)
+        {
+            throw std::runtime_error("the client has no pool");
+        }
+        return *cursor;
+    }
+};
+
+template <typename Lane, template <typename> class Store = PoolRegistry>
+class PoolOprfServer
+{
+public:
+    // A server with the key `sk`, answering from the pools of `store`. Pool data is prefetched `prefetch_depth` rounds ahead.
+    PoolOprfServer(const OprfParams &params, const osuCrypto::BitVector &sk, Store<Lane> &store, size_t prefetch_depth = 2)
+        : params(params), sk(sk), store(store), prefetch_depth(prefetch_depth), scratch(params)
+    {
+    }
+
+    // Preprocesses a pool of `tau` rounds with the client of `uid` and adds it to the store, or replaces the pool of that user if `replace`.
+    // `link` is the emulated link the socket goes through, if any.
+    void preprocess(osuCrypto::u64 uid, size_t tau, coproto::Socket &sock, bool replace = false, const LinkEmulator *link = nullptr)
+    {
+        ServerPool<Lane> pool = preprocess_server_pool<Lane>(params, tau, sk, sock, link);
+        if (replace)
+        {
+            store.refill(uid, std::move(pool));
+        }
+        else
+        {
+            store.add(uid, std::move(pool));
+        }
+    }
+
+    // BlindEval (Fig. 4) of the packed request of `uid` on round `round`, which must be the next round of its pool.
+    // Writes `params.response_size()` bytes to `response`.
+    void blind_eval(osuCrypto::u64 uid, size_t round, const osuCrypto::u8 *request, osuCrypto::u8 *response)
+    {
+        auto handle = store.acquire(uid);
+        if (!handle.claim(round, 1))
+        {
+            throw std::runtime_error("unexpected request for round " + std::to_string(round) + " of user " + std::to_string(uid));
+        }
+
+        // prefetches the rounds that follow
+        PoolCursor<ServerPool<Lane>> cursor(handle.pool(), prefetch_depth, round);
+        cursor.reserve();
+
+        oprf_blind_eval(params, handle.pool(), sk, round, 1, request, scratch, response);
+    }
+
+    // Serves a batched session of `evaluate` calls, from any users, with batches of up to `max_batch` rounds.
+    coproto::task<> serve(coproto::Socket &sock, size_t max_batch)
+    {
+        return serve_tenants(pooled_frame, params, store, sk, sock, max_batch, prefetch_depth);
+    }
+
+private:
+    OprfParams params;
+    osuCrypto::BitVector sk;
+    Store<Lane> &store;
+    size_t prefetch_depth;
+    OnlineScratch<Lane> scratch;
+};
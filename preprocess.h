@@ -0,0 +1,424 @@
+/*
+Preprocessing phases of the Pool OPRF (Figure 3), for one party over a coproto socket.
+
+Every phase of random OTs runs base OTs (`MasnyRindalKyber`) followed by an OT extension. `ot_phase_receive` and `ot_phase_send` drive
+either party of such a phase for any extension with the interface of `IknpExtension` and `SilentExtension`, and `kkrt_phase_receive` and
+`kkrt_phase_send` drive phase two with KKRT. A party is described by a `PhaseParty`: its socket, the names under which it is traced and
+measured, and whether it records a `PhaseMeter` sample (see stats.h); every party attributes its traffic to sub-protocols (see subprotocol.h).
+A party that fails closes its socket, so that the other one fails too, and throws, since the outputs of a failed phase are not usable.
+
+`preprocess_client_pool` and `preprocess_server_pool` run the preprocessing used by the online phase, phase one with IKNP and phase two with
+KKRT, on a single connection between the client and the server, and build the pools of pool.h from the resulting OTs.
+*/
+
+#pragma once
+
+#include "libOTe/Base/MasnyRindalKyber.h"
+#include "libOTe/TwoChooseOne/Iknp/IknpOtExtReceiver.h"
+#include "libOTe/TwoChooseOne/Iknp/IknpOtExtSender.h"
+#include "libOTe/TwoChooseOne/Silent/SilentOtExtReceiver.h"
+#include "libOTe/TwoChooseOne/Silent/SilentOtExtSender.h"
+#include "libOTe/NChooseOne/Kkrt/KkrtNcoOtReceiver.h"
+#include "libOTe/NChooseOne/Kkrt/KkrtNcoOtSender.h"
+#include "libOTe/Tools/Coproto.h"
+#include "cryptoTools/Common/BitVector.h"
+#include "cryptoTools/Common/Matrix.h"
+
+#include "kernels.h"
+#include "link.h"
+#include "log.h"
+#include "online.h"
+#include "perf.h"
+#include "pool.h"
+#include "stats.h"
+#include "subprotocol.h"
+#include "trace.h"
+
+#include <array>
+#include <cstring>
+#include <vector>
+
+// base OT count for Silent OTs
+const uint32_t baseOtCount = 128;
+
+// statistical security parameter of the KKRT check
+const uint32_t kkrt_stat_sec = 40;
+
+// number of KKRT OTs encoded before each correction is sent
+const size_t kkrt_step = 1 << 10;
+
+// One party of a phase. A measured party records a sample in `phase_stats()`; the others log their traffic.
+struct PhaseParty
+{
+    coproto::Socket &sock;
+    const char *phase;
+    const char *role;
+    bool measured = false;
+
+    // emulated link the connection goes through, if any (see subprotocol.h)
+    const LinkEmulator *link = nullptr;
+};
+
+// Random OTs extended with IKNP from as many base OTs as its security parameter. The choice bits of the receiver are inputs.
+struct IknpExtension
+{
+    static const bool chosen_inputs = true;
+
+    size_t base_ots() const
+    {
+        return osuCrypto::IknpOtExtReceiver().baseOtCount();
+    }
+
+    void receive(std::vector<std::array<osuCrypto::block, 2>> &base_msgs, osuCrypto::BitVector &b, osuCrypto::AlignedUnVector<osuCrypto::block> &Rs_r,
+                 osuCrypto::PRNG &prng, coproto::Socket &sock) const
+    {
+        osuCrypto::IknpOtExtReceiver receiver;
+        receiver.setBaseOts(base_msgs);
+        coproto::sync_wait(receiver.receive(b, Rs_r, prng, sock));
+    }
+
+    void send(std::vector<osuCrypto::block> &base_msgs, const osuCrypto::BitVector &base_choices, osuCrypto::AlignedUnVector<std::array<osuCrypto::block, 2>> &Sc,
+              osuCrypto::PRNG &prng, coproto::Socket &sock) const
+    {
+        osuCrypto::IknpOtExtSender sender;
+        sender.setBaseOts(base_msgs, base_choices);
+        coproto::sync_wait(sender.send(Sc, prng, sock));
+    }
+};
+
+// `count` random OTs extended with Silent OT (semi-honest) from `baseOtCount` base OTs. The choice bits of the receiver are outputs.
+struct SilentExtension
+{
+    static const bool chosen_inputs = false;
+
+    size_t count;
+
+    size_t base_ots() const
+    {
+        return baseOtCount;
+    }
+
+    void receive(std::vector<std::array<osuCrypto::block, 2>> &base_msgs, osuCrypto::BitVector &b, osuCrypto::AlignedUnVector<osuCrypto::block> &Rs_r,
+                 osuCrypto::PRNG &prng, coproto::Socket &sock) const
+    {
+        osuCrypto::SilentOtExtReceiver receiver;
+        receiver.setBaseOts(base_msgs);
+        receiver.configure(count, 2, 1, osuCrypto::SilentSecType::SemiHonest);
+        coproto::sync_wait(receiver.silentReceive(b, Rs_r, prng, sock, osuCrypto::OTType::Random));
+    }
+
+    void send(std::vector<osuCrypto::block> &base_msgs, const osuCrypto::BitVector &base_choices, osuCrypto::AlignedUnVector<std::array<osuCrypto::block, 2>> &Sc,
+              osuCrypto::PRNG &prng, coproto::Socket &sock) const
+    {
+        osuCrypto::SilentOtExtSender sender;
+        sender.configure(count, 2, 1, osuCrypto::SilentSecType::SemiHonest);
+        sender.setBaseOts(base_msgs, base_choices);
+        coproto::sync_wait(sender.silentSend(Sc, prng, sock));
+    }
+};
+
+// Uniformly random choice bits, for the extensions that take them as inputs.
+struct RandomChoices
+{
+    void operator()(osuCrypto::PRNG &prng, osuCrypto::BitVector &b) const
+    {
+        b.randomize(prng);
+    }
+};
+
+// Records the measure of a party over its phase, or logs the traffic of the phase for the parties that are not measured.
+inline void finish_party(const PhaseParty &party, PhaseMeter &meter, uint64_t sent_before, uint64_t received_before)
+{
+    uint64_t sent = party.sock.bytesSent() - sent_before;
+    uint64_t received = party.sock.bytesReceived() - received_before;
+    if (party.measured)
+    {
+        meter.finish(sent, received);
+        return;
+    }
+    LOG_INFO("{} {}, sent {} bytes and received {} bytes", party.phase, party.role, sent, received);
+}
+
+// Receiver of a phase of random OTs: the base OTs as their sender, then the extension, which writes the outputs to `Rs_r` for the choice bits `b`.
+// `choose` draws the choice bits between the two if the extension takes them as inputs; it is not measured.
+template <typename Extension, typename Choose = RandomChoices>
+void ot_phase_receive(const PhaseParty &party, const Extension &extension, osuCrypto::BitVector &b, osuCrypto::AlignedUnVector<osuCrypto::block> &Rs_r,
+                      Choose choose = {})
+{
+    TRACE_SCOPE(party.phase);
+    PhaseMeter meter(party.phase, party.role);
+    SubprotocolMeter traffic(party.phase, party.role, party.sock, party.link);
+    uint64_t sent_before = party.sock.bytesSent(), received_before = party.sock.bytesReceived();
+
+    osuCrypto::PRNG prng(osuCrypto::sysRandomSeed());
+    std::vector<std::array<osuCrypto::block, 2>> base_msgs(extension.base_ots());
+    osuCrypto::MasnyRindalKyber baseOt;
+
+    meter.start();
+    traffic.begin("base ot");
+    uint64_t base_ot_start = trace_now();
+    coproto::sync_wait(baseOt.send(base_msgs, prng, party.sock));
+    trace_span("base ot", base_ot_start);
+    meter.stop();
+
+    if constexpr (Extension::chosen_inputs)
+    {
+        choose(prng, b);
+    }
+
+    meter.start();
+    try
+    {
+        // perform random OTs and write results to Rs_r
+        traffic.begin("ot extension");
+        uint64_t extension_start = trace_now();
+        extension.receive(base_msgs, b, Rs_r, prng, party.sock);
+        trace_span("ot extension", extension_start);
+    }
+    catch (...)
+    {
+        // the other party stops waiting on the closed socket
+        coproto::sync_wait(party.sock.close());
+        throw;
+    }
+
+    coproto::sync_wait(party.sock.flush());
+    meter.stop();
+
+    traffic.finish();
+    finish_party(party, meter, sent_before, received_before);
+}
+
+// Sender of a phase of random OTs: the base OTs as their receiver, then the extension, which writes the pairs of messages to `Sc`.
+template <typename Extension>
+void ot_phase_send(const PhaseParty &party, const Extension &extension, osuCrypto::AlignedUnVector<std::array<osuCrypto::block, 2>> &Sc)
+{
+    TRACE_SCOPE(party.phase);
+    PhaseMeter meter(party.phase, party.role);
+    SubprotocolMeter traffic(party.phase, party.role, party.sock, party.link);
+    uint64_t sent_before = party.sock.bytesSent(), received_before = party.sock.bytesReceived();
+
+    osuCrypto::PRNG prng(osuCrypto::sysRandomSeed());
+    osuCrypto::BitVector base_choices(extension.base_ots());
+    base_choices.randomize(prng);
+    std::vector<osuCrypto::block> base_msgs(extension.base_ots());
+    osuCrypto::MasnyRindalKyber baseOt;
+
+    meter.start();
+    traffic.begin("base ot");
+    uint64_t base_ot_start = trace_now();
+    coproto::sync_wait(baseOt.receive(base_choices, base_msgs, prng, party.sock));
+    trace_span("base ot", base_ot_start);
+    meter.stop();
+
+    meter.start();
+    try
+    {
+        // perform random OTs and write the random OTs to Sc
+        traffic.begin("ot extension");
+        uint64_t extension_start = trace_now();
+        extension.send(base_msgs, base_choices, Sc, prng, party.sock);
+        trace_span("ot extension", extension_start);
+    }
+    catch (...)
+    {
+        // the other party stops waiting on the closed socket
+        coproto::sync_wait(party.sock.close());
+        throw;
+    }
+
+    coproto::sync_wait(party.sock.flush());
+    meter.stop();
+
+    traffic.finish();
+    finish_party(party, meter, sent_before, received_before);
+}
+
+// Receiver of phase two with KKRT: `tau` 1-out-of-2^`lg_delta` OTs for the random choices it writes to `bpr`, with outputs `Rc_r`.
+inline void kkrt_phase_receive(const PhaseParty &party, size_t tau, uint32_t lg_delta, std::vector<osuCrypto::u64> &bpr, osuCrypto::AlignedVector<osuCrypto::block> &Rc_r)
+{
+    TRACE_SCOPE(party.phase);
+    PhaseMeter meter(party.phase, party.role);
+    SubprotocolMeter traffic(party.phase, party.role, party.sock, party.link);
+    uint64_t sent_before = party.sock.bytesSent(), received_before = party.sock.bytesReceived();
+
+    osuCrypto::PRNG prng(osuCrypto::sysRandomSeed());
+    osuCrypto::KkrtNcoOtReceiver receiver;
+    const osuCrypto::u64 delta_mask = (osuCrypto::u64(1) << lg_delta) - 1;
+
+    auto receiveRoutine = [&]() -> coproto::task<>
+    {
+        receiver.configure(false, kkrt_stat_sec, lg_delta);
+
+        traffic.begin("kkrt init");
+        co_await (receiver.init(tau, prng, party.sock));
+
+        PerfSection encode_perf("kkrt receiver encode");
+        for (size_t i = 0; i < tau;)
+        {
+            size_t min = std::min(tau - i, kkrt_step);
+            uint64_t encode_start = trace_now();
+            encode_perf.start();
+            for (size_t j = 0; j < min; j++, i++)
+            {
+                bpr[i] = prng.get<osuCrypto::u64>() & delta_mask;
+                receiver.encode(i, &bpr[i], &Rc_r[i]);
+            }
+            encode_perf.stop(min);
+            trace_span("kkrt encode", encode_start);
+
+            traffic.begin("kkrt correction");
+            uint64_t correction_start = trace_now();
+            co_await (receiver.sendCorrection(party.sock, min));
+            trace_span("kkrt send correction", correction_start);
+        }
+
+        encode_perf.report();
+
+        traffic.begin("kkrt check");
+        co_await (receiver.check(party.sock, prng.get()));
+
+        co_await (party.sock.flush());
+    };
+
+    meter.start();
+    try
+    {
+        coproto::sync_wait(receiveRoutine());
+    }
+    catch (...)
+    {
+        // the other party stops waiting on the closed socket
+        coproto::sync_wait(party.sock.close());
+        throw;
+    }
+    meter.stop();
+
+    traffic.finish();
+    finish_party(party, meter, sent_before, received_before);
+}
+
+// Sender of phase two with KKRT: the 2^`lg_delta` outputs of each of the `tau` OTs, in the rows of `Ss`.
+inline void kkrt_phase_send(const PhaseParty &party, size_t tau, uint32_t lg_delta, osuCrypto::Matrix<osuCrypto::block> &Ss)
+{
+    TRACE_SCOPE(party.phase);
+    PhaseMeter meter(party.phase, party.role);
+    SubprotocolMeter traffic(party.phase, party.role, party.sock, party.link);
+    uint64_t sent_before = party.sock.bytesSent(), received_before = party.sock.bytesReceived();
+
+    osuCrypto::PRNG prng(osuCrypto::sysRandomSeed());
+    osuCrypto::KkrtNcoOtSender sender;
+    const size_t delta = size_t(1) << lg_delta;
+
+    auto sendRoutine = [&]() -> coproto::task<>
+    {
+        sender.configure(false, kkrt_stat_sec, lg_delta);
+
+        traffic.begin("kkrt init");
+        co_await (sender.init(tau, prng, party.sock));
+
+        // one operation per encoded choice
+        PerfSection encode_perf("kkrt sender encode");
+        for (size_t i = 0; i < tau;)
+        {
+            size_t min = std::min(tau - i, kkrt_step);
+
+            traffic.begin("kkrt correction");
+            uint64_t correction_start = trace_now();
+            co_await (sender.recvCorrection(party.sock, min));
+            trace_span("kkrt recv correction", correction_start);
+
+            uint64_t encode_start = trace_now();
+            encode_perf.start();
+            for (size_t j = 0; j < min; j++, i++)
+            {
+                for (size_t k = 0; k < delta; k++)
+                {
+                    osuCrypto::block choice = static_cast<osuCrypto::block>(k);
+                    sender.encode(i, &choice, &Ss[i][k]);
+                }
+            }
+            encode_perf.stop(min * delta);
+            trace_span("kkrt encode", encode_start);
+        }
+        encode_perf.report();
+
+        traffic.begin("kkrt check");
+        co_await (sender.check(party.sock, osuCrypto::ZeroBlock));
+
+        co_await (party.sock.flush());
+    };
+
+    meter.start();
+    try
+    {
+        coproto::sync_wait(sendRoutine());
+    }
+    catch (...)
+    {
+        // the other party stops waiting on the closed socket
+        coproto::sync_wait(party.sock.close());
+        throw;
+    }
+    meter.stop();
+
+    traffic.finish();
+    finish_party(party, meter, sent_before, received_before);
+}
+
+// Client side of the preprocessing used by the online phase for a pool of `tau` rounds: phase one sender with IKNP, phase two receiver
+// with KKRT, then b_bar from the server. `link` is the emulated link the connection goes through, if any.
+template <typename Lane>
+ClientPool<Lane> preprocess_client_pool(const OprfParams &params, size_t tau, coproto::Socket &sock, const LinkEmulator *link = nullptr)
+{
+    const size_t n = params.n;
+
+    osuCrypto::AlignedUnVector<std::array<osuCrypto::block, 2>> Sc(n * tau);
+    ot_phase_send(PhaseParty{sock, "phase one iknp", "sender", false, link}, IknpExtension{}, Sc);
+
+    std::vector<osuCrypto::u64> bpr(tau);
+    osuCrypto::AlignedVector<osuCrypto::block> Rc_r(tau);
+    kkrt_phase_receive(PhaseParty{sock, "phase two kkrt", "receiver", false, link}, tau, params.lg_delta(), bpr, Rc_r);
+
+    osuCrypto::BitVector b_bar(n);
+    std::vector<osuCrypto::u8> b_bar_msg(b_bar.sizeBytes());
+    coproto::sync_wait(sock.recv(b_bar_msg));
+    memcpy(b_bar.data(), b_bar_msg.data(), b_bar_msg.size());
+
+    // parse values from OTs
+    return make_client_pool<Lane>(n, params.delta(), tau, Sc, b_bar, bpr, Rc_r);
+}
+
+// Server side of the preprocessing used by the online phase for a pool of `tau` rounds and the key `sk`: phase one receiver with IKNP
+// on choice bits repeating n random bits b, phase two sender with KKRT, then b_bar = b xor sk to the client.
+template <typename Lane>
+ServerPool<Lane> preprocess_server_pool(const OprfParams &params, size_t tau, const osuCrypto::BitVector &sk, coproto::Socket &sock,
+                                        const LinkEmulator *link = nullptr)
+{
+    const size_t n = params.n;
+
+    osuCrypto::BitVector b(n * tau);
+    osuCrypto::AlignedUnVector<osuCrypto::block> Rs_r(n * tau);
+    ot_phase_receive(PhaseParty{sock, "phase one iknp", "receiver", false, link}, IknpExtension{}, b, Rs_r,
+                     [&](osuCrypto::PRNG &prng, osuCrypto::BitVector &b)
+                     {
+                         // initialize bit vector `b` with repeated random bits
+                         osuCrypto::BitVector b_n(n);
+                         b_n.randomize(prng);
+                         online_kernels().tile_bits(b_n.data(), n, tau, b.data());
+                     });
+
+    osuCrypto::Matrix<osuCrypto::block> Ss(tau, params.delta());
+    kkrt_phase_send(PhaseParty{sock, "phase two kkrt", "sender", false, link}, tau, params.lg_delta(), Ss);
+
+    osuCrypto::BitVector b_bar(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        b_bar[i] = b[i] ^ sk[i];
+    }
+    coproto::sync_wait(sock.send(std::vector<osuCrypto::u8>(b_bar.data(), b_bar.data() + b_bar.sizeBytes())));
+    coproto::sync_wait(sock.flush());
+
+    // parse values from OTs
+    return make_server_pool<Lane>(n, params.delta(), tau, Rs_r, Ss);
+}
@@ -0,0 +1,536 @@
+/*
+Server pools of many users, keyed by the `uid` of the request headers (see online.h).
+
+Pools are held in RAM up to a memory budget. When the budget is exceeded, the least recently used pools that no batch is using are
+spilled to `<directory>/<uid>.pool` in the persistent format of pool.h and freed; a spilled pool is loaded back on the next request of its user.
+An exhausted pool is replaced by a freshly preprocessed one with `refill`.
+
+Looking a pool up takes no lock. Users are found in an open-addressing table of atomic keys, and a batch pins the pool it uses with a counter.
+Only `add` and `refill` insert users in the table, so that requests for unknown users neither take slots nor touch the disk.
+Eviction moves a pool from Resident to Evicting with a compare-and-swap and backs off if the pool turns out to be pinned, so that a pinned pool is
+never freed.
+
+Requests only wait on the disk to load a spilled pool: the request that loads it reads the file, and the other requests of that user spin until
+the loading is done. Spilling runs on an evictor thread, which a load that takes the pools over the budget wakes up, so that the resident pools
+may exceed the budget until it catches up. `add` and `refill`, which run with the preprocessing, spill synchronously instead, so that the
+preprocessing cannot outpace the evictor.
+*/
+
+#pragma once
+
+#include "log.h"
+#include "online.h"
+#include "pool.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+
+template <typename Lane>
+class PoolRegistry
+{
+    enum State : uint32_t
+    {
+        Unloaded,
+        Loading,
+        Resident,
+        Evicting,
+    };
+
+    struct Entry
+    {
+        // uid + 1, or 0 for a free slot
+        std::atomic<uint64_t> key{0};
+        std::atomic<uint32_t> state{Unloaded};
+        std::atomic<uint32_t> pins{0};
+        std::atomic<uint64_t> last_use{0};
+
+        // first round not yet handed out
+        std::atomic<uint64_t> next_round{0};
+
+        // only written by the thread that moved the entry to Loading or Evicting
+        std::unique_ptr<ServerPool<Lane>> pool;
+        bool on_disk = false;
+    };
+
+public:
+    // A pinned pool. The pool stays in memory until the handle is destroyed.
+    class Handle
+    {
+    public:
+        Handle(Handle &&other) noexcept : entry(std::exchange(other.entry, nullptr))
+        {
+        }
+
+        ~Handle()
+        {
+            if (entry)
+            {
+                entry->pins.fetch_sub(1);
+            }
+        }
+
+        const ServerPool<Lane> &pool() const
+        {
+            return *entry->pool;
+        }
+
+        size_t position() const
+        {
+            return entry->next_round.load(std::memory_order_relaxed);
+        }
+
+        // Hands out rounds `first_round` to `first_round + count - 1`, if they are the next rounds of the pool.
+        // Concurrent batches of the same user thus never share a round.
+        bool claim(size_t first_round, size_t count)
+        {
+            uint64_t expected = first_round;
+            return first_round + count <= entry->pool->tau && entry->next_round.compare_exchange_strong(expected, first_round + count);
+        }
+
+    private:
+        friend class PoolRegistry;
+
+        explicit Handle(Entry *entry) : entry(entry)
+        {
+        }
+
+        Entry *entry;
+    };
+
+    struct Stats
+    {
+        size_t hits;
+        size_t loads;
+        size_t evictions;
+        size_t resident_pools;
+        size_t resident_bytes;
+        size_t refills;
+    };
+
+    // A registry for up to `max_users` users, holding at most `memory_budget` bytes of pools in memory unless they are all pinned.
+    PoolRegistry(const std::string &directory, size_t memory_budget, size_t max_users)
+        : directory(directory), memory_budget(memory_budget)
+    {
+        size_t capacity = 1;
+        while (capacity < 2 * max_users)
+        {
+            capacity <<= 1;
+        }
+        mask = capacity - 1;
+        entries = std::make_unique<Entry[]>(capacity);
+
+        std::filesystem::create_directories(directory);
+
+        evictor = std::thread([this]
+                              { run_evictor(); });
+    }
+
+    ~PoolRegistry()
+    {
+        {
+            std::lock_guard<std::mutex> lock(evictor_mutex);
+            stopping = true;
+        }
+        evictor_wakeup.notify_one();
+        evictor.join();
+    }
+
+    PoolRegistry(const PoolRegistry &) = delete;
+    PoolRegistry &operator=(const PoolRegistry &) = delete;
+
+    // Registers the freshly preprocessed pool of `uid`, which then starts at round 0.
+    void add(uint64_t uid, ServerPool<Lane> &&pool)
+    {
+        Entry &entry = insert(uid);
+        uint32_t expected = Unloaded;
+        if (!entry.state.compare_exchange_strong(expected, Loading))
+        {
+            throw std::runtime_error("the pool of user " + std::to_string(uid) + " is in use");
+        }
+
+        entry.pool = std::make_unique<ServerPool<Lane>>(std::move(pool));
+        entry.next_round.store(0);
+        entry.on_disk = false;
+        publish(entry);
+        evict_over_budget();
+    }
+
+    // Pins the pool of `uid`, loading it from disk if it was spilled. Throws if the user has no pool.
+    Handle acquire(uint64_t uid)
+    {
+        Entry *found = find(uid);
+        if (!found)
+        {
+            throw std::runtime_error("user " + std::to_string(uid) + " has no pool");
+        }
+        Entry &entry = *found;
+        while (true)
+        {
+            // pinning before reading the state pairs with `evict_over_budget`, which moves the state before reading the pins.
+            entry.pins.fetch_add(1);
+            uint32_t state = entry.state.load();
+            if (state == Resident)
+            {
+                entry.last_use.store(clock.fetch_add(1, std::memory_order_relaxed), std::memory_order_relaxed);
+                num_hits.fetch_add(1, std::memory_order_relaxed);
+                return Handle(&entry);
+            }
+            entry.pins.fetch_sub(1);
+
+            if (state == Unloaded && entry.state.compare_exchange_strong(state, Loading))
+            {
+                load(uid, entry);
+                Handle handle(&entry);
+
+                // the new pool is pinned, so that it is not the one evicted
+                wake_evictor();
+                return handle;
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    // Replaces the pool of `uid`, e.g. once its rounds are exhausted, with a freshly preprocessed pool which starts at round 0.
+    // Waits for the batches using the current pool to end; the caller must not start new ones for that user meanwhile.
+    void refill(uint64_t uid, ServerPool<Lane> &&pool)
+    {
+        Entry &entry = insert(uid);
+        while (true)
+        {
+            uint32_t state = entry.state.load();
+            if (state == Unloaded && entry.state.compare_exchange_strong(state, Loading))
+            {
+                break;
+            }
+            if (state == Resident && entry.state.compare_exchange_strong(state, Loading))
+            {
+                // as in `evict_over_budget`, the state moves before the pins are read
+                if (entry.pins.load() == 0)
+                {
+                    resident_bytes.fetch_sub(pool_bytes(*entry.pool));
+                    resident_pools.fetch_sub(1);
+                    break;
+                }
+                entry.state.store(Resident);
+            }
+            std::this_thread::yield();
+        }
+
+        entry.pool = std::make_unique<ServerPool<Lane>>(std::move(pool));
+        entry.next_round.store(0);
+        // a spilled copy, if any, is that of the previous pool
+        entry.on_disk = false;
+        num_refills.fetch_add(1, std::memory_order_relaxed);
+        publish(entry);
+        evict_over_budget();
+    }
+
+    Stats stats() const
+    {
+        return {num_hits.load(), num_loads.load(), num_evictions.load(), resident_pools.load(), resident_bytes.load(), num_refills.load()};
+    }
+
+private:
+    std::string directory;
+    size_t memory_budget;
+
+    size_t mask;
+    std::unique_ptr<Entry[]> entries;
+
+    // logical time of the last use of each pool, for the LRU order
+    std::atomic<uint64_t> clock{0};
+
+    std::atomic<size_t> num_hits{0};
+    std::atomic<size_t> num_loads{0};
+    std::atomic<size_t> num_evictions{0};
+    std::atomic<size_t> num_refills{0};
+    std::atomic<size_t> resident_pools{0};
+    std::atomic<size_t> resident_bytes{0};
+
+    std::mutex evictor_mutex;
+    std::condition_variable evictor_wakeup;
+    bool eviction_pending = false;
+    bool stopping = false;
+    std::thread evictor;
+
+    std::string path(uint64_t uid) const
+    {
+        return directory + "/" + std::to_string(uid) + ".pool";
+    }
+
+    size_t first_probe(uint64_t key) const
+    {
+        uint64_t h = key * 0x9e3779b97f4a7c15ull;
+        return (h ^ (h >> 32)) & mask;
+    }
+
+    // Slot of `uid`, or nullptr if it was never added. Slots are claimed in probe order and never freed, so the first free slot ends the search.
+    Entry *find(uint64_t uid)
+    {
+        const uint64_t key = uid + 1;
+        for (size_t probe = 0, i = first_probe(key); probe <= mask; probe++, i = (i + 1) & mask)
+        {
+            uint64_t current = entries[i].key.load(std::memory_order_acquire);
+            if (current == key)
+            {
+                return &entries[i];
+            }
+            if (current == 0)
+            {
+                return nullptr;
+            }
+        }
+        return nullptr;
+    }
+
+    // Slot of `uid`, claimed with a compare-and-swap on first use.
+    Entry &insert(uint64_t uid)
+    {
+        const uint64_t key = uid + 1;
+        for (size_t probe = 0, i = first_probe(key); probe <= mask; probe++, i = (i + 1) & mask)
+        {
+            uint64_t current = entries[i].key.load(std::memory_order_acquire);
+            if (current == 0)
+            {
+                entries[i].key.compare_exchange_strong(current, key);
+                current = entries[i].key.load(std::memory_order_acquire);
+            }
+            if (current == key)
+            {
+                return entries[i];
+            }
+        }
+        throw std::runtime_error("pool registry full");
+    }
+
+    // Reads the pool of an entry in the Loading state, and makes it resident and pinned.
+    void load(uint64_t uid, Entry &entry)
+    {
+        try
+        {
+            size_t next_round;
+            entry.pool = std::make_unique<ServerPool<Lane>>(read_server_pool<Lane>(path(uid), next_round));
+            entry.next_round.store(next_round);
+            entry.on_disk = true;
+        }
+        catch (...)
+        {
+            entry.state.store(Unloaded);
+            throw;
+        }
+
+        num_loads.fetch_add(1, std::memory_order_relaxed);
+        entry.pins.fetch_add(1);
+        publish(entry);
+    }
+
+    void publish(Entry &entry)
+    {
+        entry.last_use.store(clock.fetch_add(1, std::memory_order_relaxed), std::memory_order_relaxed);
+        resident_bytes.fetch_add(pool_bytes(*entry.pool));
+        resident_pools.fetch_add(1);
+        entry.state.store(Resident);
+    }
+
+    // Has the evictor spill pools if the resident pools exceed the budget.
+    void wake_evictor()
+    {
+        if (resident_bytes.load() <= memory_budget)
+        {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(evictor_mutex);
+            eviction_pending = true;
+        }
+        evictor_wakeup.notify_one();
+    }
+
+    void run_evictor()
+    {
+        std::unique_lock<std::mutex> lock(evictor_mutex);
+        while (true)
+        {
+            evictor_wakeup.wait(lock, [this]
+                                { return eviction_pending || stopping; });
+            if (stopping)
+            {
+                return;
+            }
+            eviction_pending = false;
+
+            lock.unlock();
+            try
+            {
+                evict_over_budget();
+            }
+            catch (std::exception &e)
+            {
+                LOG_ERROR("Could not spill a pool: {}", e.what());
+            }
+            lock.lock();
+        }
+    }
+
+    // Spills the least recently used unpinned pools until the resident pools fit in the budget.
+    // The scan of the whole table is negligible next to writing a pool to disk.
+    void evict_over_budget()
+    {
+        while (resident_bytes.load() > memory_budget)
+        {
+            Entry *victim = nullptr;
+            for (size_t i = 0; i <= mask; i++)
+            {
+                Entry &entry = entries[i];
+                if (entry.state.load(std::memory_order_relaxed) == Resident && entry.pins.load(std::memory_order_relaxed) == 0 &&
+                    (!victim || entry.last_use.load(std::memory_order_relaxed) < victim->last_use.load(std::memory_order_relaxed)))
+                {
+                    victim = &entry;
+                }
+            }
+            if (!victim)
+            {
+                // every resident pool is in use
+                return;
+            }
+
+            uint32_t expected = Resident;
+            if (!victim->state.compare_exchange_strong(expected, Evicting))
+            {
+                continue;
+            }
+            if (victim->pins.load() != 0)
+            {
+                victim->state.store(Resident);
+                continue;
+            }
+
+            spill(*victim);
+        }
+    }
+
+    // Writes the pool of an entry in the Evicting state to disk, the whole pool only the first time, and frees it.
+    void spill(Entry &entry)
+    {
+        std::string file = path(entry.key.load() - 1);
+        try
+        {
+            if (entry.on_disk)
+            {
+                write_pool_position(file, entry.next_round.load());
+            }
+            else
+            {
+                write_server_pool(file, *entry.pool, entry.next_round.load());
+                entry.on_disk = true;
+            }
+        }
+        catch (...)
+        {
+            entry.state.store(Resident);
+            throw;
+        }
+
+        resident_bytes.fetch_sub(pool_bytes(*entry.pool));
+        resident_pools.fetch_sub(1);
+        entry.pool.reset();
+        num_evictions.fetch_add(1, std::memory_order_relaxed);
+        entry.state.store(Unloaded);
+    }
+};
+
+// BlindEval of a batch of `serve_tenants` from the pool of its user, writing `responses`. Returns the status of the response.
+template <template <typename> class Registry, typename Lane>
+osuCrypto::u32 answer_tenant_batch(const OprfParams &params, Registry<Lane> &registry, const osuCrypto::BitVector &sk, const RequestHeader &header,
+                                   const osuCrypto::u8 *requests, OnlineScratch<Lane> &scratch, size_t prefetch_depth, osuCrypto::u8 *responses)
+{
+    uint64_t acquire_start = trace_now();
+    std::optional<decltype(registry.acquire(header.uid))> handle;
+    try
+    {
+        handle.emplace(registry.acquire(header.uid));
+    }
+    catch (std::exception &e)
+    {
+        LOG_WARN("Rejected a batch: {}", e.what());
+        return ResponseNoPool;
+    }
+    trace_span("acquire pool", acquire_start);
+
+    if (!handle->claim(header.first_round, header.count))
+    {
+        LOG_WARN("Rejected a batch for rounds {} to {} of user {}", header.first_round, header.first_round + header.count, header.uid);
+        return ResponseRoundsUnavailable;
+    }
+
+    PoolCursor<ServerPool<Lane>> cursor(handle->pool(), prefetch_depth, header.first_round);
+    for (size_t r = 0; r < header.count; r++)
+    {
+        cursor.reserve();
+    }
+
+    uint64_t blind_eval_start = latency_now();
+    oprf_blind_eval(params, handle->pool(), sk, header.first_round, header.count, requests, scratch, responses);
+    if (blind_eval_start)
+    {
+        record_latency(LatencyBlindEval, (latency_now() - blind_eval_start) / header.count, header.count);
+    }
+    return ResponseOk;
+}
+
+// Server side of a batched session (see `serve_online` in online.h) on behalf of many users: each batch is answered from the pool
+// of the `uid` of its header, which stays pinned while the batch is evaluated. Batches of a user must follow each other in pool order.
+// A batch of a user without a pool, or for rounds that are not the next ones of its pool, is rejected with the status of its response
+// header, and the session goes on for the other users.
+// `Registry` is `PoolRegistry` or any store of server pools with the same `acquire` and handles (e.g. `MemoryPoolStore` in pool_oprf.h).
+template <template <typename> class Registry, typename Lane>
+coproto::task<> serve_tenants(pooled_frame_t, const OprfParams &params, Registry<Lane> &registry, const osuCrypto::BitVector &sk, coproto::Socket &sock,
+                              size_t max_batch, size_t prefetch_depth)
+{
+    OnlineScratch<Lane> scratch(params, max_batch);
+
+    while (true)
+    {
+        std::vector<osuCrypto::u8> header_msg(sizeof(RequestHeader));
+        {
+            TraceSpan span("recv request header");
+            co_await sock.recv(header_msg);
+        }
+
+        RequestHeader header = decode_header<RequestHeader>(header_msg);
+        if (header.count == 0)
+        {
+            break;
+        }
+        if (header.count > max_batch)
+        {
+            throw std::runtime_error("request batch of " + std::to_string(header.count) + " rounds");
+        }
+
+        std::vector<osuCrypto::u8> requests(header.count * params.request_size());
+        {
+            TraceSpan span("recv requests");
+            co_await sock.recv(requests);
+        }
+
+        std::vector<osuCrypto::u8> responses(header.count * params.response_size());
+        osuCrypto::u32 status = answer_tenant_batch(params, registry, sk, header, requests.data(), scratch, prefetch_depth, responses.data());
+
+        TraceSpan span("send responses");
+        co_await sock.send(encode_header(ResponseHeader{header.first_round, header.count, status}));
+        if (status == ResponseOk)
+        {
+            co_await sock.send(std::move(responses));
+        }
+    }
+
+    co_await sock.flush();
+}
@@ -0,0 +1,165 @@
+/*
+Machine-readable benchmark results.
+
+Every sample of `phase_stats()` (see stats.h), per-role totals included, is written as one record with the parameters of the build,
+the git revision and a description of the host, so that results of several runs and machines can be collected without parsing the log.
+Records are JSON lines, or CSV rows after a header line when the output file name ends in `.csv`.
+*/
+
+#pragma once
+
+#include "stats.h"
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// git revision of the sources, set by CMakeLists.txt
+#ifndef OPRF_GIT_REV
+#define OPRF_GIT_REV "unknown"
+#endif
+
+// What the records of one execution have in common.
+struct ResultContext
+{
+    // e.g. ("n", 482)
+    std::vector<std::pair<std::string, uint64_t>> params;
+    std::string git_rev = OPRF_GIT_REV;
+    std::string hostname;
+    std::string cpu;
+    unsigned cores = std::thread::hardware_concurrency();
+
+    ResultContext()
+    {
+        char name[256] = {};
+        gethostname(name, sizeof(name) - 1);
+        hostname = name;
+
+        std::ifstream cpuinfo("/proc/cpuinfo");
+        for (std::string line; std::getline(cpuinfo, line);)
+        {
+            if (line.rfind("model name", 0) == 0 && line.find(':') != std::string::npos)
+            {
+                cpu = line.substr(line.find(':') + 2);
+                break;
+            }
+        }
+    }
+};
+
+inline std::string json_string(const std::string &s)
+{
+    std::string out = "\"";
+    for (char c : s)
+    {
+        switch (c)
+        {
+        case '"':
+            out += "\\\"";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        case '\n':
+            out += "\\n";
+            break;
+        case '\r':
+            out += "\\r";
+            break;
+        case '\t':
+            out += "\\t";
+            break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20)
+            {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                out += escaped;
+            }
+            else
+            {
+                out += c;
+            }
+        }
+    }
+    return out + "\"";
+}
+
+// A CSV field as in RFC 4180: quoted if it holds a comma, a quote or a line break, with its quotes doubled.
+inline std::string csv_field(const std::string &s)
+{
+    if (s.find_first_of(",\"\r\n") == std::string::npos)
+    {
+        return s;
+    }
+
+    std::string out = "\"";
+    for (char c : s)
+    {
+        if (c == '"')
+        {
+            out += '"';
+        }
+        out += c;
+    }
+    return out + "\"";
+}
+
+inline std::string number(double v)
+{
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.3f", v);
+    return buffer;
+}
+
+// Writes one record per run of every series, after the CSV header line unless `header` is false, e.g. when appending the records of another context.
+inline void write_results(std::ostream &out, const std::vector<PhaseSeries> &series, const ResultContext &context, bool csv, bool header = true)
+{
+    if (csv && header)
+    {
+        out << "variant,phase,role,run,wall_ms,cpu_ms,bytes_sent,bytes_received,rss_kb,peak_rss_kb,huge_kb,minor_faults,major_faults";
+        for (const auto &[name, value] : context.params)
+        {
+            out << "," << csv_field(name);
+        }
+        out << ",git_rev,hostname,cpu,cores\n";
+    }
+
+    for (const PhaseSeries &s : series)
+    {
+        for (size_t run = 0; run < s.samples.size(); run++)
+        {
+            const PhaseSample &sample = s.samples[run];
+            if (csv)
+            {
+                out << csv_field(s.key.variant) << "," << csv_field(s.key.phase) << "," << csv_field(s.key.role) << "," << run << "," << number(sample.wall_ms) << ","
+                    << number(sample.cpu_ms) << "," << sample.bytes_sent << "," << sample.bytes_received << "," << sample.memory.rss_kb << ","
+                    << sample.memory.peak_rss_kb << "," << sample.memory.huge_kb << "," << sample.minor_faults << "," << sample.major_faults;
+                for (const auto &[name, value] : context.params)
+                {
+                    out << "," << value;
+                }
+                out << "," << csv_field(context.git_rev) << "," << csv_field(context.hostname) << "," << csv_field(context.cpu) << "," << context.cores << "\n";
+                continue;
+            }
+
+            out << "{\"variant\":" << json_string(s.key.variant) << ",\"phase\":" << json_string(s.key.phase) << ",\"role\":" << json_string(s.key.role)
+                << ",\"run\":" << run << ",\"wall_ms\":" << number(sample.wall_ms) << ",\"cpu_ms\":" << number(sample.cpu_ms)
+                << ",\"bytes_sent\":" << sample.bytes_sent << ",\"bytes_received\":" << sample.bytes_received << ",\"rss_kb\":" << sample.memory.rss_kb
+                << ",\"peak_rss_kb\":" << sample.memory.peak_rss_kb << ",\"huge_kb\":" << sample.memory.huge_kb << ",\"minor_faults\":" << sample.minor_faults
+                << ",\"major_faults\":" << sample.major_faults << ",\"params\":{";
+            for (size_t i = 0; i < context.params.size(); i++)
+            {
+                out << (i ? "," : "") << json_string(context.params[i].first) << ":" << context.params[i].second;
+            }
+            out << "},\"git_rev\":" << json_string(context.git_rev) << ",\"host\":{\"hostname\":" << json_string(context.hostname)
+                << ",\"cpu\":" << json_string(context.cpu) << ",\"cores\":" << context.cores << "}}\n";
+        }
+    }
+}
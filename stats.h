@@ -0,0 +1,468 @@
+/*
+Measures of the preprocessing phases over repeated runs.
+
+Each benchmarked phase measures itself with a `PhaseMeter`, which accumulates wall time, CPU time and page faults of the calling thread
+between `start` and `stop` (so that the setup left out of the measures of the paper stays out), and reads the traffic of its socket and
+the resident memory of the process (current, peak and huge pages) when it is done.
+The other threads of the process that run during a phase, e.g. socket I/O, are measured together by a `HelperCpuMeter`.
+Samples go to `phase_stats()`, keyed by variant, phase and role, unless recording is off, e.g. during warm-up runs.
+`PhaseStats::series` adds the per-run totals of the client, of the server and of what they share of every variant to the measured phases.
+
+`summarize` gives the mean, standard deviation, median, extremes and a 95% confidence interval of the mean (Student's t).
+`host_conditions` reports what makes measures noisy on this host: a CPU frequency governor other than `performance`, turbo boost, and load.
+*/
+
+#pragma once
+
+#include "log.h"
+
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <initializer_list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// Memory of the whole process, in kB, when a phase ends.
+struct MemoryUsage
+{
+    uint64_t rss_kb = 0;
+    uint64_t peak_rss_kb = 0;
+
+    // transparent huge pages and hugetlbfs pages mapped by the process
+    uint64_t huge_kb = 0;
+};
+
+struct PhaseSample
+{
+    double wall_ms = 0;
+    double cpu_ms = 0;
+    uint64_t bytes_sent = 0;
+    uint64_t bytes_received = 0;
+    MemoryUsage memory;
+
+    // page faults of the measuring thread between `start` and `stop`
+    uint64_t minor_faults = 0;
+    uint64_t major_faults = 0;
+};
+
+// e.g. ("iknp", "phase one iknp unwasteful", "sender")
+struct PhaseKey
+{
+    std::string variant;
+    std::string phase;
+    std::string role;
+
+    bool operator<(const PhaseKey &other) const
+    {
+        return std::tie(variant, phase, role) < std::tie(other.variant, other.phase, other.role);
+    }
+};
+
+// Samples of one key, one per measured run.
+struct PhaseSeries
+{
+    PhaseKey key;
+    std::vector<PhaseSample> samples;
+};
+
+// Client complexity is taken as phase one sender + phase two receiver, and vice-versa for the server complexity.
+// Local computations of both parties, and the threads serving both of them (e.g. socket I/O), cannot be split between the parties,
+// so they count for neither and are totalled as "shared" instead.
+inline bool counts_for(const PhaseKey &key, const std::string &party)
+{
+    bool shared = key.role == "both parties" || key.role == "helper threads";
+    if (shared || party == "shared")
+    {
+        return shared && party == "shared";
+    }
+    bool phase_one = key.phase.rfind("phase one", 0) == 0;
+    return (party == "client") == (phase_one == (key.role == "sender"));
+}
+
+struct Summary
+{
+    size_t count = 0;
+    double mean = 0;
+    double stddev = 0;
+    double median = 0;
+    double min = 0;
+    double max = 0;
+
+    // half-width of the 95% confidence interval of the mean
+    double ci95 = 0;
+};
+
+// two-sided 95% quantiles of Student's t distribution for 1 to 30 degrees of freedom
+inline double student_t95(size_t dof)
+{
+    static const double table[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228, 2.201, 2.179, 2.160, 2.145, 2.131,
+                                   2.120, 2.110, 2.101, 2.093, 2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+    return dof == 0 ? 0 : dof <= 30 ? table[dof - 1] : 1.960;
+}
+
+inline Summary summarize(std::vector<double> values)
+{
+    Summary s;
+    s.count = values.size();
+    if (values.empty())
+    {
+        return s;
+    }
+
+    std::sort(values.begin(), values.end());
+    s.min = values.front();
+    s.max = values.back();
+    s.median = values.size() % 2 ? values[values.size() / 2] : (values[values.size() / 2 - 1] + values[values.size() / 2]) / 2;
+
+    for (double v : values)
+    {
+        s.mean += v;
+    }
+    s.mean /= values.size();
+
+    if (values.size() > 1)
+    {
+        double sq = 0;
+        for (double v : values)
+        {
+            sq += (v - s.mean) * (v - s.mean);
+        }
+        s.stddev = std::sqrt(sq / (values.size() - 1));
+        s.ci95 = student_t95(values.size() - 1) * s.stddev / std::sqrt(double(values.size()));
+    }
+    return s;
+}
+
+// Samples of every variant, phase and role, in the order they were first measured.
+class PhaseStats
+{
+public:
+    // Variant of the phases measured from now on.
+    void set_variant(const std::string &name)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        variant = name;
+    }
+
+    void record(const std::string &phase, const std::string &role, const PhaseSample &sample)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!recording)
+        {
+            return;
+        }
+        PhaseKey key{variant, phase, role};
+        auto [it, added] = index.emplace(key, measured.size());
+        if (added)
+        {
+            measured.push_back({key, {}});
+        }
+        measured[it->second].samples.push_back(sample);
+    }
+
+    void set_recording(bool on)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        recording = on;
+    }
+
+    // Forgets every sample, e.g. between the points of a parameter sweep.
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        index.clear();
+        measured.clear();
+    }
+
+    // The measured phases, followed by the totals of the client and of the server of each variant (phase "total").
+    std::vector<PhaseSeries> series()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<PhaseSeries> all = measured;
+
+        std::vector<std::string> variants;
+        for (const PhaseSeries &s : measured)
+        {
+            if (std::find(variants.begin(), variants.end(), s.key.variant) == variants.end())
+            {
+                variants.push_back(s.key.variant);
+            }
+        }
+
+        for (const std::string &v : variants)
+        {
+            // variants measured as a whole, e.g. the online example, have no per-party phases
+            bool per_party = std::any_of(measured.begin(), measured.end(), [&](const PhaseSeries &s)
+                                         { return s.key.variant == v && (s.key.role == "sender" || s.key.role == "receiver"); });
+            if (!per_party)
+            {
+                continue;
+            }
+
+            for (const char *party : {"client", "server", "shared"})
+            {
+                PhaseSeries total{{v, "total", party}, {}};
+                for (const PhaseSeries &s : measured)
+                {
+                    if (s.key.variant != v || !counts_for(s.key, party))
+                    {
+                        continue;
+                    }
+                    total.samples.resize(std::max(total.samples.size(), s.samples.size()));
+                    for (size_t run = 0; run < s.samples.size(); run++)
+                    {
+                        PhaseSample &t = total.samples[run];
+                        const PhaseSample &phase = s.samples[run];
+                        t.wall_ms += phase.wall_ms;
+                        t.cpu_ms += phase.cpu_ms;
+                        t.bytes_sent += phase.bytes_sent;
+                        t.bytes_received += phase.bytes_received;
+                        t.minor_faults += phase.minor_faults;
+                        t.major_faults += phase.major_faults;
+
+                        // both parties share the process, so the memory of a party is bounded by the largest of its phases
+                        t.memory.rss_kb = std::max(t.memory.rss_kb, phase.memory.rss_kb);
+                        t.memory.peak_rss_kb = std::max(t.memory.peak_rss_kb, phase.memory.peak_rss_kb);
+                        t.memory.huge_kb = std::max(t.memory.huge_kb, phase.memory.huge_kb);
+                    }
+                }
+                if (!total.samples.empty())
+                {
+                    all.push_back(std::move(total));
+                }
+            }
+        }
+        return all;
+    }
+
+private:
+    std::mutex mutex;
+    bool recording = true;
+    std::string variant;
+    std::map<PhaseKey, size_t> index;
+    std::vector<PhaseSeries> measured;
+};
+
+inline PhaseStats &phase_stats()
+{
+    static PhaseStats stats;
+    return stats;
+}
+
+// CPU time of the calling thread in ms.
+inline double thread_cpu_ms()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+inline pid_t current_tid()
+{
+    return static_cast<pid_t>(syscall(SYS_gettid));
+}
+
+// CPU time in ms of every thread of the process but its service threads, whose names start with `oprf-` (the logger and the latency exporter),
+// from the run time of /proc/self/task/<tid>/schedstat.
+inline std::map<pid_t, double> threads_cpu_ms()
+{
+    std::map<pid_t, double> cpu;
+    for (const auto &task : std::filesystem::directory_iterator("/proc/self/task"))
+    {
+        std::string name;
+        std::getline(std::ifstream(task.path() / "comm"), name);
+        uint64_t run_ns;
+        if (name.rfind("oprf-", 0) != 0 && std::ifstream(task.path() / "schedstat") >> run_ns)
+        {
+            cpu[std::stoi(task.path().filename())] = run_ns / 1e6;
+        }
+    }
+    return cpu;
+}
+
+// CPU time spent over a phase by the threads that are not one of its parties, such as the I/O threads of the sockets or threads started
+// by an OT extender. Threads that exit before the phase ends are not accounted for.
+class HelperCpuMeter
+{
+public:
+    HelperCpuMeter() : before(threads_cpu_ms())
+    {
+    }
+
+    // Records the CPU time of the threads other than `parties` as role "helper threads" of `phase`.
+    PhaseSample finish(const char *phase, std::initializer_list<pid_t> parties)
+    {
+        PhaseSample sample;
+        for (auto [tid, cpu_ms] : threads_cpu_ms())
+        {
+            if (std::find(parties.begin(), parties.end(), tid) == parties.end())
+            {
+                sample.cpu_ms += cpu_ms - (before.count(tid) ? before[tid] : 0);
+            }
+        }
+        phase_stats().record(phase, "helper threads", sample);
+        LOG_INFO("{} helper threads: {}ms of CPU", phase, sample.cpu_ms);
+        return sample;
+    }
+
+private:
+    std::map<pid_t, double> before;
+};
+
+// Reads the memory of the process from /proc/self/status and /proc/self/smaps_rollup.
+inline MemoryUsage memory_usage()
+{
+    MemoryUsage usage;
+    auto read = [](const char *path, std::initializer_list<std::pair<const char *, uint64_t *>> fields)
+    {
+        std::ifstream file(path);
+        for (std::string line; std::getline(file, line);)
+        {
+            for (auto [name, value] : fields)
+            {
+                if (line.rfind(name, 0) == 0)
+                {
+                    *value += std::stoull(line.substr(strlen(name)));
+                }
+            }
+        }
+    };
+
+    read("/proc/self/status", {{"VmRSS:", &usage.rss_kb}, {"VmHWM:", &usage.peak_rss_kb}, {"HugetlbPages:", &usage.huge_kb}});
+    read("/proc/self/smaps_rollup", {{"AnonHugePages:", &usage.huge_kb}, {"ShmemPmdMapped:", &usage.huge_kb}, {"FilePmdMapped:", &usage.huge_kb}});
+    return usage;
+}
+
+// Resets the peak RSS of the process to its current RSS (Linux 4.0 and later), so that the peaks measured afterwards are not those of earlier work.
+inline void reset_peak_rss()
+{
+    std::ofstream("/proc/self/clear_refs") << "5";
+}
+
+// Measure of one party in one phase, e.g. ("phase one iknp unwasteful", "sender").
+class PhaseMeter
+{
+public:
+    PhaseMeter(const char *phase, const char *role) : phase(phase), role(role)
+    {
+    }
+
+    void start()
+    {
+        begin = std::chrono::steady_clock::now();
+        cpu_begin = thread_cpu_ms();
+        faults_begin = thread_faults();
+    }
+
+    void stop()
+    {
+        elapsed += std::chrono::steady_clock::now() - begin;
+        cpu_ms += thread_cpu_ms() - cpu_begin;
+        auto [minor, major] = thread_faults();
+        minor_faults += minor - faults_begin.first;
+        major_faults += major - faults_begin.second;
+    }
+
+    // Records the sample with the traffic of `sock` and logs it.
+    template <typename Socket>
+    PhaseSample finish(Socket &sock)
+    {
+        return finish(sock.bytesSent(), sock.bytesReceived());
+    }
+
+    // Records the sample of a local computation, which sends nothing, and logs it.
+    PhaseSample finish()
+    {
+        return finish(0, 0);
+    }
+
+    // Records the sample with the given traffic, e.g. that of a phase sharing its connection with others, and logs it.
+    PhaseSample finish(uint64_t bytes_sent, uint64_t bytes_received)
+    {
+        PhaseSample sample{std::chrono::duration<double, std::milli>(elapsed).count(), cpu_ms, bytes_sent, bytes_received, memory_usage(), minor_faults,
+                           major_faults};
+        phase_stats().record(phase, role, sample);
+        LOG_INFO("{} {} in {}ms ({}ms of CPU), sent {} bytes and received {} bytes, RSS {} kB (peak {} kB, {} kB of huge pages), {} minor and {} major page faults",
+                 phase, role, sample.wall_ms, sample.cpu_ms, sample.bytes_sent, sample.bytes_received, sample.memory.rss_kb, sample.memory.peak_rss_kb,
+                 sample.memory.huge_kb, sample.minor_faults, sample.major_faults);
+        return sample;
+    }
+
+private:
+    const char *phase;
+    const char *role;
+    std::chrono::steady_clock::time_point begin;
+    std::chrono::steady_clock::duration elapsed{0};
+    double cpu_begin = 0;
+    double cpu_ms = 0;
+    std::pair<uint64_t, uint64_t> faults_begin;
+    uint64_t minor_faults = 0;
+    uint64_t major_faults = 0;
+
+    // (minor, major) page faults of the calling thread so far
+    static std::pair<uint64_t, uint64_t> thread_faults()
+    {
+        rusage usage;
+        getrusage(RUSAGE_THREAD, &usage);
+        return {usage.ru_minflt, usage.ru_majflt};
+    }
+};
+
+// Mean current frequency of the cores in MHz, or 0 if cpufreq is not available.
+inline double cpu_mhz()
+{
+    double total = 0;
+    unsigned cores = 0;
+    for (unsigned cpu = 0; cpu < std::thread::hardware_concurrency(); cpu++)
+    {
+        std::ifstream file("/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/cpufreq/scaling_cur_freq");
+        double khz;
+        if (file >> khz)
+        {
+            total += khz / 1e3;
+            cores++;
+        }
+    }
+    return cores ? total / cores : 0;
+}
+
+// Warnings about the conditions of the host that make measures noisy.
+inline std::vector<std::string> host_conditions()
+{
+    std::vector<std::string> warnings;
+
+    std::string governor;
+    if (std::ifstream("/sys/devices/system/cpu/cpu0/cpufreq/scaling_governor") >> governor && governor != "performance")
+    {
+        warnings.push_back("the CPU frequency governor is '" + governor + "': the frequency scales with the load (use 'performance')");
+    }
+
+    int flag;
+    if ((std::ifstream("/sys/devices/system/cpu/intel_pstate/no_turbo") >> flag && flag == 0) ||
+        (std::ifstream("/sys/devices/system/cpu/cpufreq/boost") >> flag && flag == 1))
+    {
+        warnings.push_back("turbo boost is enabled: the frequency depends on temperature and on the number of active cores");
+    }
+
+    double load;
+    if (std::ifstream("/proc/loadavg") >> load && load > 0.5)
+    {
+        warnings.push_back("the load average is " + std::to_string(load) + ": other processes compete for the cores");
+    }
+
+    return warnings;
+}
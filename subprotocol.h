@@ -0,0 +1,208 @@
+/*
+Traffic of the sub-protocols of the preprocessing phases: base OTs, OT extension, and the initialization, corrections and check of KKRT.
+
+A phase attributes the traffic of its socket to named scopes with a `SubprotocolMeter`, between `begin(name)` and `end()` (or the next `begin`).
+Bytes are read from the counters of the socket, so they are exact on every transport. Flights and reads are counted by the emulated link
+(see link.h), which sees the whole connection, so they are only known with `--link=` (`--link=0,0` relays without delay nor bandwidth limit):
+a flight is a run of traffic in one direction, and a read what the relay received at once, a lower bound of the number of messages when they
+are sent in turn and an upper bound when they are large. Each party sees the flights of the connection during its own scopes. The socket
+of coproto only exposes byte counters, so the messages of the libraries are not counted directly; a scope entered once per message, as
+the KKRT corrections are, counts its messages by its number of entries.
+
+Totals accumulate over the runs of every phase in `subprotocol_stats()`, and `SubprotocolStats::log` logs them per run.
+*/
+
+#pragma once
+
+#include "link.h"
+#include "log.h"
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct SubprotocolTraffic
+{
+    uint64_t entries = 0;
+    uint64_t bytes_sent = 0;
+    uint64_t bytes_received = 0;
+    uint64_t reads = 0;
+    uint64_t flights = 0;
+};
+
+class SubprotocolStats
+{
+public:
+    void add(const std::string &phase, const std::string &role, const std::string &scope, const SubprotocolTraffic &traffic, bool relayed)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Entry &entry = find(phase, role, scope);
+        entry.traffic.entries += traffic.entries;
+        entry.traffic.bytes_sent += traffic.bytes_sent;
+        entry.traffic.bytes_received += traffic.bytes_received;
+        entry.traffic.reads += traffic.reads;
+        entry.traffic.flights += traffic.flights;
+        entry.relayed = entry.relayed || relayed;
+    }
+
+    // Counts one run of a phase, over which its scopes are averaged.
+    void add_run(const std::string &phase, const std::string &role)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        find(phase, role, "").traffic.entries++;
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.clear();
+    }
+
+    // Logs the traffic of every scope per run of its phase, followed by the total of the phase, in the order the scopes were first entered.
+    void log() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (entries.empty())
+        {
+            return;
+        }
+
+        LOG_INFO("\nSub-protocol traffic per run:");
+        for (const Entry &run : entries)
+        {
+            if (!run.scope.empty() || run.traffic.entries == 0)
+            {
+                continue;
+            }
+
+            double runs = run.traffic.entries;
+            SubprotocolTraffic total;
+            bool relayed = false;
+            LOG_INFO("{} {} ({} runs):", run.phase, run.role, run.traffic.entries);
+            for (const Entry &entry : entries)
+            {
+                if (entry.scope.empty() || entry.phase != run.phase || entry.role != run.role)
+                {
+                    continue;
+                }
+                log_scope(entry.scope, entry.traffic, entry.relayed, runs);
+                total.entries += entry.traffic.entries;
+                total.bytes_sent += entry.traffic.bytes_sent;
+                total.bytes_received += entry.traffic.bytes_received;
+                total.reads += entry.traffic.reads;
+                total.flights += entry.traffic.flights;
+                relayed = relayed || entry.relayed;
+            }
+            log_scope("total", total, relayed, runs);
+        }
+    }
+
+private:
+    struct Entry
+    {
+        std::string phase;
+        std::string role;
+
+        // empty for the runs of the phase
+        std::string scope;
+        SubprotocolTraffic traffic;
+        bool relayed = false;
+    };
+
+    mutable std::mutex mutex;
+    std::vector<Entry> entries;
+
+    Entry &find(const std::string &phase, const std::string &role, const std::string &scope)
+    {
+        for (Entry &entry : entries)
+        {
+            if (entry.phase == phase && entry.role == role && entry.scope == scope)
+            {
+                return entry;
+            }
+        }
+        entries.push_back({phase, role, scope});
+        return entries.back();
+    }
+
+    static void log_scope(const std::string &scope, const SubprotocolTraffic &traffic, bool relayed, double runs)
+    {
+        if (!relayed)
+        {
+            LOG_INFO("  {}: sent {} B and received {} B in {} entries", scope, traffic.bytes_sent / runs, traffic.bytes_received / runs, traffic.entries / runs);
+            return;
+        }
+        double flights = traffic.flights / runs;
+        LOG_INFO("  {}: sent {} B and received {} B in {} entries, {} flights ({} round trips) and {} reads", scope, traffic.bytes_sent / runs,
+                 traffic.bytes_received / runs, traffic.entries / runs, flights, static_cast<uint64_t>(flights + 1) / 2, traffic.reads / runs);
+    }
+};
+
+inline SubprotocolStats &subprotocol_stats()
+{
+    static SubprotocolStats stats;
+    return stats;
+}
+
+// Attributes the traffic of one party of a phase to the scopes it enters. `link` is the emulated link the connection goes through, if any.
+template <typename Socket>
+class SubprotocolMeter
+{
+public:
+    SubprotocolMeter(const char *phase, const char *role, Socket &sock, const LinkEmulator *link) : phase(phase), role(role), sock(sock), link(link)
+    {
+    }
+
+    // Ends the current scope, if any, and enters `name`.
+    void begin(const char *name)
+    {
+        end();
+        scope = name;
+        start = snapshot();
+    }
+
+    void end()
+    {
+        if (!scope)
+        {
+            return;
+        }
+
+        SubprotocolTraffic now = snapshot();
+        subprotocol_stats().add(phase, role, scope,
+                                {1, now.bytes_sent - start.bytes_sent, now.bytes_received - start.bytes_received, now.reads - start.reads,
+                                 now.flights - start.flights},
+                                link != nullptr);
+        scope = nullptr;
+    }
+
+    // Ends the current scope and counts a run of the phase.
+    void finish()
+    {
+        end();
+        subprotocol_stats().add_run(phase, role);
+    }
+
+private:
+    const char *phase;
+    const char *role;
+    Socket &sock;
+    const LinkEmulator *link;
+    const char *scope = nullptr;
+    SubprotocolTraffic start;
+
+    SubprotocolTraffic snapshot() const
+    {
+        SubprotocolTraffic traffic;
+        traffic.bytes_sent = sock.bytesSent();
+        traffic.bytes_received = sock.bytesReceived();
+        if (link)
+        {
+            LinkTraffic relayed = link->traffic();
+            traffic.reads = relayed.reads[0] + relayed.reads[1];
+            traffic.flights = relayed.flights[0] + relayed.flights[1];
+        }
+        return traffic;
+    }
+};
@@ -0,0 +1,49 @@
+/*
+Minimal checks for the test programs: `CHECK` reports a failed condition with its location and the program goes on, and
+`check_result()` is the exit status of the program.
+*/
+
+#pragma once
+
+#include <cstdio>
+
+inline int &check_failures()
+{
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(condition) \
+    do \
+    { \
+        if (!(condition)) \
+        { \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            check_failures()++; \
+        } \
+    } while (0)
+
+// Whether `f` throws an exception of type `E`.
+template <typename E, typename F>
+bool throws(F &&f)
+{
+    try
+    {
+        f();
+    }
+    catch (const E &)
+    {
+        return true;
+    }
+    return false;
+}
+
+inline int check_result()
+{
+    if (check_failures())
+    {
+        std::fprintf(stderr, "%d checks failed\n", check_failures());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,102 @@
+/*
+Tests of the cuckoo filter (filter.h): round trips of the filter and of its updates, and rejection of malformed data.
+*/
+
+#include "check.h"
+#include "filter.h"
+
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+std::vector<uint8_t> bytes_of(const std::vector<uint64_t> &words)
+{
+    std::vector<uint8_t> out(words.size() * sizeof(uint64_t));
+    memcpy(out.data(), words.data(), out.size());
+    return out;
+}
+
+void test_round_trip()
+{
+    std::mt19937_64 prng(1);
+    std::vector<uint64_t> hashes(10000);
+    for (uint64_t &h : hashes)
+    {
+        h = prng();
+    }
+
+    CuckooFilter filter(hashes.size());
+    for (uint64_t h : hashes)
+    {
+        filter.insert(h);
+    }
+    CuckooFilter copy = CuckooFilter::deserialize(filter.serialize());
+    CHECK(copy.size() == filter.size());
+    CHECK(copy.num_buckets() == filter.num_buckets());
+
+    std::vector<uint8_t> found(hashes.size());
+    copy.contains(hashes.data(), hashes.size(), found.data());
+    for (size_t k = 0; k < hashes.size(); k++)
+    {
+        CHECK(found[k]);
+        CHECK(copy.contains(hashes[k]));
+    }
+
+    // an update replacing the first half of the elements
+    CuckooFilter base = filter;
+    for (size_t k = 0; k < hashes.size() / 2; k++)
+    {
+        CHECK(filter.erase(hashes[k]));
+        hashes[k] = prng();
+        filter.insert(hashes[k]);
+    }
+    copy.apply(filter.diff(base));
+    CHECK(copy.serialize() == filter.serialize());
+}
+
+void test_malformed_filters()
+{
+    auto rejected = [](const std::vector<uint64_t> &words)
+    { return throws<std::runtime_error>([&] { CuckooFilter::deserialize(bytes_of(words)); }); };
+
+    // counts that wrap around to the size of the data: 2^63 buckets and 2^63 + 1 stash entries in 4 words
+    CHECK(rejected({uint64_t(1) << 63, 0, (uint64_t(1) << 63) + 1, 0}));
+    CHECK(rejected({uint64_t(1) << 63, 0, uint64_t(1) << 63}));
+    CHECK(rejected({0, 0, 0}));
+    CHECK(rejected({2, 0, 0, 0}));
+    CHECK(rejected({3, 0, 0, 0, 0, 0}));
+    CHECK(rejected({1, 0}));
+    CHECK(throws<std::runtime_error>([] { CuckooFilter::deserialize(std::vector<uint8_t>(20)); }));
+
+    // a stash entry in bucket 2 of a filter of 2 buckets
+    CHECK(rejected({2, 1, 1, 0, 0, (2 << 16) | 7}));
+    CHECK(!rejected({2, 1, 1, 0, 0, (1 << 16) | 7}));
+}
+
+void test_malformed_updates()
+{
+    CuckooFilter filter(100);
+    std::vector<uint8_t> before = filter.serialize();
+    auto rejected = [&](const std::vector<uint64_t> &words)
+    { return throws<std::runtime_error>([&] { filter.apply(bytes_of(words)); }); };
+
+    // 2^63 changes and 2 stash entries wrap around to 5 words
+    CHECK(rejected({0, uint64_t(1) << 63, 2, 0, 0}));
+    CHECK(rejected({0, (uint64_t(1) << 62) + 1, 0, 0, 0}));
+    CHECK(rejected({0, 1, 0, 0}));
+    CHECK(rejected({0, 1, 0, filter.num_buckets(), 1}));
+    CHECK(rejected({0, 0, 1, filter.num_buckets() << 16}));
+
+    // a rejected update leaves the filter as it was, even when its first changes are valid
+    CHECK(rejected({1, 2, 0, 0, 0xffff, filter.num_buckets(), 1}));
+    CHECK(filter.serialize() == before);
+}
+
+int main()
+{
+    test_round_trip();
+    test_malformed_filters();
+    test_malformed_updates();
+    return check_result();
+}
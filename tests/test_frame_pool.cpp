@@ -0,0 +1,67 @@
+/*
+Tests of the coroutine frame pools (frame_pool.h): frames are reused within their size class, and a frame allocated after the pool of its
+thread is destroyed can be kept by the pool of another thread and handed to a larger frame of the same class. Out-of-bounds writes to
+such a frame are caught when built with AddressSanitizer.
+*/
+
+#include "check.h"
+#include "frame_pool.h"
+
+#include <cstring>
+#include <thread>
+
+void test_reuse()
+{
+    void *frame = FramePool::allocate(100);
+    std::memset(frame, 1, 100);
+    FramePool::deallocate(frame, 100);
+
+    // the same class of 128 bytes
+    FramePool::Stats before = FramePool::stats();
+    void *reused = FramePool::allocate(128);
+    CHECK(reused == frame);
+    CHECK(FramePool::stats().reuses == before.reuses + 1);
+    std::memset(reused, 2, 128);
+    FramePool::deallocate(reused, 128);
+
+    // beyond the largest class, frames go to the heap
+    void *large = FramePool::allocate(FramePool::max_frame_bytes + 1);
+    std::memset(large, 3, FramePool::max_frame_bytes + 1);
+    FramePool::deallocate(large, FramePool::max_frame_bytes + 1);
+}
+
+// Allocates a frame from its destructor, which runs after the destructor of the pool of its thread since it was constructed before it.
+struct LateFrame
+{
+    ~LateFrame()
+    {
+        late_frame = FramePool::allocate(70);
+    }
+
+    static inline void *late_frame = nullptr;
+};
+
+void test_frame_after_pool_destroyed()
+{
+    std::thread thread([]
+                       {
+        static thread_local LateFrame late;
+        (void)late;
+        FramePool::deallocate(FramePool::allocate(70), 70); });
+    thread.join();
+    CHECK(LateFrame::late_frame);
+
+    // the frame of 70 bytes joins the free list of the class of 128 bytes of this thread, and is handed to a frame of 128 bytes
+    FramePool::deallocate(LateFrame::late_frame, 70);
+    void *frame = FramePool::allocate(128);
+    CHECK(frame == LateFrame::late_frame);
+    std::memset(frame, 4, 128);
+    FramePool::deallocate(frame, 128);
+}
+
+int main()
+{
+    test_reuse();
+    test_frame_after_pool_destroyed();
+    return check_result();
+}
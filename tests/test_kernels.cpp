@@ -0,0 +1,197 @@
+/*
+Tests of the online kernels (kernels.h): every instruction set supported by the host is forced in turn with `select_isa`, and each of its
+kernels is compared to the generic flavour on random data, on 16-bit and 32-bit lanes, for sizes around the widths of the vectors.
+*/
+
+#include "check.h"
+#include "kernels.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+std::mt19937_64 prng(1);
+
+// sizes below, at and around multiples of the widths of the vectors, for 16-bit lanes up to 512 bits
+const size_t sizes[] = {1, 3, 7, 8, 15, 16, 17, 31, 32, 33, 63, 64, 65, 100, 127, 128, 129, 482, 1021};
+
+template <typename T>
+std::vector<T> random_values(size_t count, uint64_t mask)
+{
+    std::vector<T> values(count);
+    for (T &v : values)
+    {
+        v = static_cast<T>(prng() & mask);
+    }
+    return values;
+}
+
+template <typename Lane>
+void compare_lanes(const LaneKernels<Lane> &generic, const LaneKernels<Lane> &kernels, const char *name)
+{
+    const uint32_t lane_bits = 8 * sizeof(Lane);
+    const uint32_t lg_qs[] = {8, 12, lane_bits == 16 ? 16u : 20u, lane_bits == 16 ? 13u : 31u};
+    int failures = check_failures();
+
+    for (uint32_t lg_q : lg_qs)
+    {
+        const uint32_t q_mask = (1u << lg_q) - 1;
+        for (size_t n : sizes)
+        {
+            std::vector<Lane> a = random_values<Lane>(n, q_mask), sc0 = random_values<Lane>(n, q_mask), sc1 = random_values<Lane>(n, q_mask),
+                              rs = random_values<Lane>(n, q_mask);
+            std::vector<uint8_t> b_bar = random_values<uint8_t>((n + 7) / 8, 0xff), sk = random_values<uint8_t>((n + 7) / 8, 0xff);
+
+            // Request
+            std::vector<Lane> e_1(n), e_1_generic(n);
+            CHECK(kernels.request(a.data(), sc0.data(), sc1.data(), b_bar.data(), e_1.data(), n, q_mask) ==
+                  generic.request(a.data(), sc0.data(), sc1.data(), b_bar.data(), e_1_generic.data(), n, q_mask));
+            CHECK(e_1 == e_1_generic);
+
+            // BlindEval and the direct evaluation
+            CHECK(kernels.blind_eval(e_1.data(), rs.data(), sk.data(), n, q_mask) == generic.blind_eval(e_1.data(), rs.data(), sk.data(), n, q_mask));
+            CHECK(kernels.masked_sum(a.data(), sk.data(), n, q_mask) == generic.masked_sum(a.data(), sk.data(), n, q_mask));
+
+            // expansion of the random oracle output
+            std::vector<uint8_t> ro = random_values<uint8_t>(n * sizeof(Lane), 0xff);
+            std::vector<Lane> coeffs(n), coeffs_generic(n);
+            kernels.coeffs_from_bytes(ro.data(), n, q_mask, coeffs.data());
+            generic.coeffs_from_bytes(ro.data(), n, q_mask, coeffs_generic.data());
+            CHECK(coeffs == coeffs_generic);
+
+            // low bits of blocks, with a stride of one and of two blocks
+            for (size_t stride : {16, 32})
+            {
+                std::vector<uint8_t> blocks = random_values<uint8_t>(n * stride, 0xff);
+                std::vector<Lane> lo(n), lo_generic(n);
+                kernels.unpack_lo(blocks.data(), stride, lo.data(), n);
+                generic.unpack_lo(blocks.data(), stride, lo_generic.data(), n);
+                CHECK(lo == lo_generic);
+            }
+        }
+
+        // the y-table rotation, alone and batched, for tables around the widths of the vectors
+        for (uint32_t lg_delta = 1; lg_delta < std::min<uint32_t>(lg_q, 11); lg_delta++)
+        {
+            const size_t delta = size_t(1) << lg_delta;
+            const uint32_t p_mask = (1u << (lg_q - lg_delta)) - 1;
+            for (size_t n : {size_t(7), size_t(64), size_t(482)})
+            {
+                const size_t rounds = 5;
+                std::vector<Lane> e_1 = random_values<Lane>(n * rounds, q_mask), rs = random_values<Lane>(n * rounds, q_mask),
+                                  ss = random_values<Lane>(delta * rounds, p_mask);
+                std::vector<uint8_t> sk = random_values<uint8_t>((n + 7) / 8, 0xff);
+                std::vector<uint32_t> bpr_bar = random_values<uint32_t>(rounds, delta - 1);
+
+                std::vector<Lane> y(delta), y_generic(delta);
+                uint32_t atil_sum = static_cast<uint32_t>(prng() & q_mask);
+                kernels.y_table(ss.data(), bpr_bar[0], atil_sum, y.data(), delta, lg_delta, q_mask, p_mask);
+                generic.y_table(ss.data(), bpr_bar[0], atil_sum, y_generic.data(), delta, lg_delta, q_mask, p_mask);
+                CHECK(y == y_generic);
+
+                std::vector<Lane> y_batch(delta * rounds), y_batch_generic(delta * rounds);
+                kernels.blind_eval_batch(e_1.data(), rs.data(), sk.data(), ss.data(), bpr_bar.data(), y_batch.data(), rounds, n, delta, lg_delta, q_mask, p_mask);
+                generic.blind_eval_batch(e_1.data(), rs.data(), sk.data(), ss.data(), bpr_bar.data(), y_batch_generic.data(), rounds, n, delta, lg_delta, q_mask,
+                                         p_mask);
+                CHECK(y_batch == y_batch_generic);
+            }
+        }
+    }
+
+    // packing on every width, and back
+    for (uint32_t width = 1; width <= lane_bits; width++)
+    {
+        const uint64_t mask = width == 64 ? ~0ull : (uint64_t(1) << width) - 1;
+        for (size_t count : sizes)
+        {
+            std::vector<Lane> values = random_values<Lane>(count, mask);
+            std::vector<uint8_t> packed(packed_size(count, width) + 8, 0xa5), packed_generic(packed.size(), 0xa5);
+            CHECK(kernels.pack_bits(values.data(), count, width, packed.data()) == packed_size(count, width));
+            CHECK(generic.pack_bits(values.data(), count, width, packed_generic.data()) == packed_size(count, width));
+            CHECK(packed == packed_generic);
+
+            std::vector<Lane> unpacked(count);
+            kernels.unpack_bits(packed.data(), count, width, unpacked.data());
+            CHECK(unpacked == values);
+        }
+    }
+
+    if (check_failures() != failures)
+    {
+        std::fprintf(stderr, "%s: %d checks failed on %u-bit lanes\n", name, check_failures() - failures, lane_bits);
+    }
+}
+
+void compare_blocks(const OnlineKernels &generic, const OnlineKernels &kernels)
+{
+    for (size_t nbits : sizes)
+    {
+        // tiling of the choice bits, as in the extension of phase one
+        for (size_t reps : {size_t(1), size_t(3), size_t(64)})
+        {
+            std::vector<uint8_t> src = random_values<uint8_t>((nbits + 7) / 8, 0xff);
+            std::vector<uint8_t> dst((nbits * reps + 7) / 8 + 8, 0), dst_generic(dst.size(), 0);
+            kernels.tile_bits(src.data(), nbits, reps, dst.data());
+            generic.tile_bits(src.data(), nbits, reps, dst_generic.data());
+            CHECK(dst == dst_generic);
+        }
+
+        // scattering of the extended blocks
+        for (size_t stride : {size_t(1), size_t(2), size_t(7)})
+        {
+            std::vector<uint8_t> src = random_values<uint8_t>(16 * nbits, 0xff);
+            std::vector<uint8_t> dst(16 * nbits * stride, 0), dst_generic(dst.size(), 0);
+            kernels.scatter_blocks(src.data(), nbits, stride, dst.data());
+            generic.scatter_blocks(src.data(), nbits, stride, dst_generic.data());
+            CHECK(dst == dst_generic);
+        }
+    }
+
+    // filter probes, half of them for fingerprints in the filter
+    const uint64_t bucket_mask = 255;
+    std::vector<uint64_t> buckets = random_values<uint64_t>(bucket_mask + 1, ~0ull);
+    for (size_t count : sizes)
+    {
+        std::vector<uint64_t> hashes = random_values<uint64_t>(count, ~0ull);
+        for (size_t k = 0; k < count; k += 2)
+        {
+            uint64_t bucket = hashes[k] & bucket_mask;
+            uint16_t fp = static_cast<uint16_t>(buckets[bucket] >> (16 * (k % 4)));
+            hashes[k] = (uint64_t(fp ? fp : 1) << 48) | (hashes[k] & 0xffffffffffffull);
+        }
+        std::vector<uint8_t> found(count), found_generic(count);
+        kernels.filter_probe(buckets.data(), bucket_mask, hashes.data(), count, found.data());
+        generic.filter_probe(buckets.data(), bucket_mask, hashes.data(), count, found_generic.data());
+        CHECK(found == found_generic);
+    }
+}
+
+int main()
+{
+    const OnlineKernels *generic = kernels_for(Isa::Generic);
+    CHECK(generic);
+    if (!generic)
+    {
+        return check_result();
+    }
+
+    for (Isa isa : {Isa::Generic, Isa::Sse41, Isa::Avx2, Isa::Avx512})
+    {
+        if (!kernels_for(isa))
+        {
+            std::printf("%s: not supported by this host\n", isa_name(isa));
+            continue;
+        }
+
+        CHECK(select_isa(isa_name(isa)));
+        const OnlineKernels &kernels = online_kernels();
+        CHECK(kernels.isa == isa);
+        std::printf("%s: comparing to %s\n", kernels.name, generic->name);
+
+        compare_lanes(generic->u16, kernels.u16, kernels.name);
+        compare_lanes(generic->u32, kernels.u32, kernels.name);
+        compare_blocks(*generic, kernels);
+    }
+    return check_result();
+}
@@ -0,0 +1,210 @@
+/*
+Tests of the client and server of pool_oprf.h over in-process sockets, with the server pools in a `MemoryPoolStore`: the outputs of single
+rounds and of batched sessions are those of the direct evaluation from the key, and out-of-step requests are rejected.
+*/
+
+#include "coproto/Socket/LocalAsyncSock.h"
+
+#include "check.h"
+#include "pool_oprf.h"
+
+#include <exception>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using Lane = osuCrypto::u16;
+
+const OprfParams params{482, 12, 8};
+const size_t tau = 1 << 10;
+
+// Runs `server(sock)` in a new thread and `client(sock)` in the calling thread over a pair of in-process sockets, and rethrows the
+// exception of the client, or else of the server, once both are done.
+template <typename Client, typename Server>
+void run_pair(Client client, Server server)
+{
+    auto pair = coproto::LocalAsyncSocket::makePair();
+    coproto::Socket client_sock = pair[0], server_sock = pair[1];
+
+    std::exception_ptr server_error;
+    std::thread server_thread([&]
+                              {
+        try {
+            server(server_sock);
+        } catch (...) {
+            server_error = std::current_exception();
+        } });
+
+    std::exception_ptr client_error;
+    try
+    {
+        client(client_sock);
+    }
+    catch (...)
+    {
+        client_error = std::current_exception();
+    }
+    server_thread.join();
+
+    if (client_error)
+    {
+        std::rethrow_exception(client_error);
+    }
+    if (server_error)
+    {
+        std::rethrow_exception(server_error);
+    }
+}
+
+osuCrypto::BitVector sample_key()
+{
+    osuCrypto::PRNG prng(osuCrypto::block(1, 2));
+    osuCrypto::BitVector sk(params.n);
+    sk.randomize(prng);
+    return sk;
+}
+
+void preprocess(PoolOprfClient<Lane> &client, PoolOprfServer<Lane, MemoryPoolStore> &server, osuCrypto::u64 uid, size_t rounds)
+{
+    run_pair([&](coproto::Socket &sock)
+             { client.preprocess(rounds, sock); },
+             [&](coproto::Socket &sock)
+             { server.preprocess(uid, rounds, sock); });
+}
+
+void test_single_rounds()
+{
+    osuCrypto::BitVector sk = sample_key();
+    MemoryPoolStore<Lane> pools;
+    PoolOprfServer<Lane, MemoryPoolStore> server(params, sk, pools);
+    PoolOprfClient<Lane> client(params, 3);
+    preprocess(client, server, 3, tau);
+    CHECK(client.remaining() == tau);
+
+    osuCrypto::PRNG prng(osuCrypto::block(3, 4));
+    OnlineScratch<Lane> scratch(params);
+    std::vector<osuCrypto::u8> request(params.request_size()), response(params.response_size());
+    for (int k = 0; k < 100; k++)
+    {
+        int64_t t = prng.get<int64_t>(), x = prng.get<int64_t>();
+        PoolOprfClient<Lane>::Round round = client.request(t, x, request.data());
+        server.blind_eval(3, round.round, request.data(), response.data());
+        CHECK(client.finalize(round, response.data()) == direct_eval(params, sk, t, x, scratch));
+    }
+    CHECK(client.remaining() == tau - 100);
+
+    // a round that was already answered, and a user without a pool
+    CHECK(throws<std::runtime_error>([&] { server.blind_eval(3, 0, request.data(), response.data()); }));
+    CHECK(throws<std::runtime_error>([&] { server.blind_eval(4, 100, request.data(), response.data()); }));
+}
+
+void test_batched_sessions()
+{
+    osuCrypto::BitVector sk = sample_key();
+    MemoryPoolStore<Lane> pools;
+    PoolOprfServer<Lane, MemoryPoolStore> server(params, sk, pools);
+    PoolOprfClient<Lane> first(params, 0), second(params, 1);
+    preprocess(first, server, 0, tau);
+    preprocess(second, server, 1, tau);
+
+    // counts that are not multiples of the batch, over both users in turn on the same session
+    const size_t count = 300;
+    osuCrypto::PRNG prng(osuCrypto::block(5, 6));
+    std::vector<int64_t> records(2 * count);
+    prng.get(records.data(), records.size());
+    std::vector<Lane> z_first(count), z_second(count);
+
+    run_pair(
+        [&](coproto::Socket &sock)
+        {
+            coproto::sync_wait([&]() -> coproto::task<>
+                               {
+                co_await (first.evaluate(sock, records.data(), count, z_first.data(), 64, 4));
+                co_await (second.evaluate(sock, records.data(), count - 17, z_second.data(), 32, 2));
+                co_await (first.evaluate(sock, records.data(), 5, z_first.data(), 64, 1));
+                co_await (first.end(sock)); }());
+        },
+        [&](coproto::Socket &sock)
+        { coproto::sync_wait(server.serve(sock, 64)); });
+
+    OnlineScratch<Lane> scratch(params);
+    for (size_t i = 0; i < count; i++)
+    {
+        uint32_t expected = direct_eval(params, sk, records[2 * i], records[2 * i + 1], scratch);
+        CHECK(z_first[i] == expected);
+        CHECK(i >= count - 17 || z_second[i] == expected);
+    }
+    CHECK(first.remaining() == tau - count - 5);
+    CHECK(second.remaining() == tau - count + 17);
+}
+
+void test_rejected_batches()
+{
+    osuCrypto::BitVector sk = sample_key();
+    MemoryPoolStore<Lane> pools;
+    PoolOprfServer<Lane, MemoryPoolStore> server(params, sk, pools);
+    PoolOprfClient<Lane> client(params, 0), stranger(params, 9);
+    preprocess(client, server, 0, tau);
+
+    // the server has no pool for user 9, whose client preprocessed with a server of another store
+    MemoryPoolStore<Lane> other_pools;
+    PoolOprfServer<Lane, MemoryPoolStore> other_server(params, sk, other_pools);
+    preprocess(stranger, other_server, 9, tau);
+
+    osuCrypto::PRNG prng(osuCrypto::block(7, 8));
+    std::vector<int64_t> records(2 * 10);
+    prng.get(records.data(), records.size());
+    std::vector<Lane> z(10);
+
+    // a rejected batch leaves the session open for the next ones
+    bool rejected = false;
+    run_pair(
+        [&](coproto::Socket &sock)
+        {
+            try
+            {
+                coproto::sync_wait(stranger.evaluate(sock, records.data(), 10, z.data(), 4, 2));
+            }
+            catch (RejectedBatch &e)
+            {
+                rejected = e.status == ResponseNoPool;
+            }
+            coproto::sync_wait(client.evaluate(sock, records.data(), 10, z.data(), 4, 2));
+            coproto::sync_wait(client.end(sock));
+        },
+        [&](coproto::Socket &sock)
+        { coproto::sync_wait(server.serve(sock, 4)); });
+    CHECK(rejected);
+
+    OnlineScratch<Lane> scratch(params);
+    for (size_t i = 0; i < 10; i++)
+    {
+        CHECK(z[i] == direct_eval(params, sk, records[2 * i], records[2 * i + 1], scratch));
+    }
+}
+
+void test_exhausted_pool()
+{
+    osuCrypto::BitVector sk = sample_key();
+    MemoryPoolStore<Lane> pools;
+    PoolOprfServer<Lane, MemoryPoolStore> server(params, sk, pools);
+    PoolOprfClient<Lane> client(params, 0);
+    preprocess(client, server, 0, 8);
+
+    std::vector<osuCrypto::u8> request(params.request_size()), response(params.response_size());
+    for (int64_t k = 0; k < 8; k++)
+    {
+        server.blind_eval(0, client.request(0, k, request.data()).round, request.data(), response.data());
+    }
+    CHECK(client.remaining() == 0);
+    CHECK(throws<std::runtime_error>([&] { client.request(0, 8, request.data()); }));
+}
+
+int main()
+{
+    test_single_rounds();
+    test_batched_sessions();
+    test_rejected_batches();
+    test_exhausted_pool();
+    return check_result();
+}
@@ -0,0 +1,172 @@
+/*
+Helpers of the `oprf` executable declared in tool.h: connections between the parties, results and baselines, and reports of the online traffic.
+*/
+
+#include "coproto/Socket/AsioSocket.h"
+#include "coproto/Socket/LocalAsyncSock.h"
+
+#include "log.h"
+#include "preprocess.h"
+#include "stats.h"
+#include "tool.h"
+
+#include <array>
+#include <fstream>
+#include <map>
+#include <mutex>
+
+void set_params(uint new_n, uint new_tau, uint new_lg_delta, uint new_kappa)
+{
+    n = new_n;
+    tau = new_tau;
+    kappa = new_kappa;
+    lg_delta = new_lg_delta;
+    delta = 1 << lg_delta;
+    lg_p = lg_q - lg_delta;
+    p = 1 << lg_p;
+}
+
+const LinkEmulator *link_emulator()
+{
+    if (transport != Transport::Link)
+    {
+        return nullptr;
+    }
+    static LinkEmulator link(1213, 1212, link_latency_ms, link_mbps);
+    return &link;
+}
+
+coproto::Socket connect_party(bool server)
+{
+    if (transport == Transport::Local)
+    {
+        // the first party to connect makes a pair of sockets and the second one takes the other end
+        static std::mutex pair_mutex;
+        static std::array<coproto::LocalAsyncSocket, 2> pair;
+        static bool pending = false;
+
+        std::lock_guard<std::mutex> lock(pair_mutex);
+        if (!pending)
+        {
+            pair = coproto::LocalAsyncSocket::makePair();
+        }
+        pending = !pending;
+        return pair[pending ? 0 : 1];
+    }
+
+    if (transport == Transport::Link)
+    {
+        // the client connects to the emulator, which relays to the server (both over IPv4, which the emulator uses)
+        link_emulator();
+        return coproto::asioConnect(server ? "127.0.0.1:1212" : "127.0.0.1:1213", server);
+    }
+
+    return coproto::asioConnect("localhost:1212", server);
+}
+
+ResultContext result_context()
+{
+    ResultContext context;
+    context.params = {{"n", n}, {"tau", tau}, {"lg_q", lg_q}, {"lg_p", lg_p}, {"kappa", kappa}, {"base_ot_count", baseOtCount}};
+    return context;
+}
+
+bool results_as_csv()
+{
+    return results_path.size() >= 4 && results_path.compare(results_path.size() - 4, 4, ".csv") == 0;
+}
+
+void save_results()
+{
+    if (results_path.empty())
+    {
+        return;
+    }
+
+    std::ofstream out(results_path);
+    write_results(out, phase_stats().series(), result_context(), results_as_csv());
+    if (!out)
+    {
+        LOG_ERROR("Could not write the results to {}", results_path);
+    }
+}
+
+int check_baseline()
+{
+    if (!save_baseline_path.empty())
+    {
+        std::ofstream out(save_baseline_path);
+        write_results(out, phase_stats().series(), result_context(), false);
+        if (!out)
+        {
+            LOG_ERROR("Could not write the baseline to {}", save_baseline_path);
+            return 1;
+        }
+        LOG_INFO("Baseline saved to {}", save_baseline_path);
+    }
+
+    if (compare_baseline_path.empty())
+    {
+        return 0;
+    }
+    std::map<PhaseKey, std::vector<PhaseSample>> baseline;
+    if (!read_results(compare_baseline_path, baseline))
+    {
+        LOG_ERROR("Could not read the baseline {}", compare_baseline_path);
+        return 1;
+    }
+    size_t regressions = compare_to_baseline(baseline, phase_stats().series(), regression_thresholds);
+    if (regressions)
+    {
+        LOG_ERROR("{} measures regressed from the baseline {}", regressions, compare_baseline_path);
+        return 4;
+    }
+    LOG_INFO("No regression from the baseline {}", compare_baseline_path);
+    return 0;
+}
+
+osuCrypto::BitVector sample_key()
+{
+    osuCrypto::PRNG prng(osuCrypto::sysRandomSeed());
+
+    osuCrypto::BitVector sk(n);
+    sk.randomize(prng);
+    return sk;
+}
+
+volatile uint benchmark_sink;
+
+void log_wire_budget(const OprfParams &params)
+{
+    double formula = (params.request_bits() + params.response_bits()) / 8.0;
+    size_t packed = params.request_size() + params.response_size();
+    LOG_INFO("Communication per evaluation: {}B by the formula, {}B packed ({}B request + {}B response), plus {}B of headers per batch",
+             formula, packed, params.request_size(), params.response_size(), sizeof(RequestHeader) + sizeof(ResponseHeader));
+}
+
+void log_wire_bytes(const OprfParams &params, const WireBytes &wire, uint64_t socket_sent, uint64_t socket_received)
+{
+    if (wire.evaluations == 0)
+    {
+        return;
+    }
+
+    double evals = wire.evaluations;
+    auto log_direction = [&](const char *name, const WireDirection &direction, uint64_t socket_bytes)
+    {
+        double framing = double(socket_bytes) - double(direction.bytes());
+        LOG_INFO("  {}: {}B payload + {}B padding + {}B headers + {}B framing = {}B per evaluation", name, direction.payload_bits / 8.0 / evals,
+                 direction.padding_bits / 8.0 / evals, direction.header_bytes / evals, framing / evals, socket_bytes / evals);
+    };
+
+    double formula = (params.request_bits() + params.response_bits()) / 8.0;
+    double measured = (socket_sent + socket_received) / evals;
+    LOG_INFO("Online bytes on the wire: {} evaluations in {} batches", wire.evaluations, wire.batches);
+    log_direction("requests", wire.requests, socket_sent);
+    log_direction("responses", wire.responses, socket_received);
+    LOG_INFO("  total: {}B per evaluation against {}B by the formula, i.e. {}% overhead", measured, formula, 100 * (measured / formula - 1));
+    if (measured > (1 + online_overhead_budget) * formula)
+    {
+        LOG_WARN("The online sessions exceed the communication complexity by more than the budget of {}%", 100 * online_overhead_budget);
+    }
+}
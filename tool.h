@@ -0,0 +1,241 @@
+/*
+Parameters and helpers shared by the modes of the `oprf` executable: main.cpp parses the command line and runs the online example, and each
+mode lives in its own source (mode_*.cpp), on top of the `pool_oprf` library (see pool_oprf.h).
+*/
+
+#pragma once
+
+#include "libOTe/Tools/Coproto.h"
+#include "cryptoTools/Common/BitVector.h"
+
+#include "baseline.h"
+#include "link.h"
+#include "online.h"
+#include "results.h"
+#include "trace.h"
+
+#include <exception>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/*
+Parameters for the preprocessing.
+Variable names are chosen to match the paper's notation. `lg_X` denotes the binary logarithm of `X`.
+When changing the parameters, one should be careful to make sure that they are consistent.
+For example, `tau` should be big enough for `num_rounds` of OPRF rounds to be executed in the online phase.
+
+As is, the parameters allow to measure numbers used in Table 4 for `# evals` set at 2^13.
+`n`, `tau`, `lg_p` (through `lg_delta`) and `kappa` are changed at every point of a parameter sweep (`--sweep=`, see `set_params`).
+*/
+inline uint n = 482;
+inline uint tau = 1 << 16;
+const uint lg_q = 12;
+const uint q = 1 << lg_q;
+const uint lg_lg_p = 3;
+inline uint lg_p = 1 << lg_lg_p;
+inline uint p = 1 << lg_p;
+inline uint lg_delta = lg_q - lg_p;
+inline uint delta = 1 << lg_delta;
+
+static_assert(lg_q < 32, "values mod q are held in at most 32 bits");
+static_assert((1 << lg_lg_p) < lg_q, "lg_p must be smaller than lg_q");
+
+// Values mod q are stored in the narrowest lane type that holds them (see `LaneKernels` in kernels.h).
+// The random oracle output is read in words of this size, so parameter sets with lg_q <= 16 use 2 bytes per coefficient and 4 bytes otherwise.
+using lane_t = std::conditional_t<lg_q <= 16, osuCrypto::u16, osuCrypto::u32>;
+
+// refer to appendix A of the paper for the definition of kappa
+inline uint kappa = 6144;
+
+// number of OPRF rounds to execute in the online phase
+const uint num_rounds = 10;
+
+// bulk mode (`--bulk=`): number of evaluations per request batch, and number of batches in flight at once.
+const uint bulk_batch = 256;
+const uint bulk_pipeline = 4;
+
+static_assert(bulk_batch % 8 == 0, "batches of outputs are packed on whole bytes");
+
+// budget of the bytes that online sessions send beyond the communication complexity of the paper (headers, padding and framing),
+// as a fraction of it; `log_wire_bytes` warns above it.
+const double online_overhead_budget = 0.02;
+
+// PSI mode (`--psi=`): statistical security parameter bounding the probability of a false positive in the intersection, and binary
+// logarithm of the largest sets.
+const uint psi_stat_sec = 40;
+const uint max_psi_lg_size = 32;
+
+// lookup mode (`--lookup=`): number of client queries, half of which are in the server set, and share of the server set replaced by an update.
+const uint lookup_queries = 1 << 10;
+const double lookup_churn = 0.01;
+
+// multi-tenant mode (`--tenants=`): bytes of server pools kept in memory (overridden in MB with `--pool-budget=`), directory of the spilled pools,
+// and number of passes over the users, each running `tenant_evals` evaluations per user.
+inline size_t tenant_budget = size_t(256) << 20;
+const char *const tenant_pool_dir = "oprf_pools";
+const uint tenant_passes = 2;
+const uint tenant_evals = 1024;
+
+// load generator (`--load=<users>`): rounds of each user's pool, which is preprocessed again once exhausted, evaluations per request, and
+// number of requests waiting for a connection in open loop beyond which new arrivals are rejected.
+// connections, duration in seconds, arrival rate in requests per second (0 for closed loop) and Zipf exponent of the popularity of the users
+// can be overridden with `--load-clients=`, `--load-duration=`, `--load-rate=` and `--zipf=`.
+const uint load_pool_rounds = 1 << 12;
+const uint load_request_evals = 1;
+const size_t load_max_queue = 1 << 12;
+inline uint load_clients = 8;
+inline double load_duration_s = 10;
+inline double load_rate = 0;
+inline double load_zipf = 0.99;
+
+// repetitions of the preprocessing benchmarks, after unmeasured warm-up runs; can be overridden with `--reps=` and `--warmup=`.
+// measures whose standard deviation exceeds `bench_max_cv` times their mean are reported as noisy.
+inline uint bench_reps = 1;
+inline uint bench_warmup = 0;
+const double bench_max_cv = 0.05;
+
+// file receiving one record per measure of the preprocessing benchmarks (`--results=`), as CSV if it ends in `.csv` and JSON lines otherwise.
+inline std::string results_path;
+
+// baselines of the benchmarks (see baseline.h): file receiving the measures of this run as a baseline (`--save-baseline=`), baseline they are
+// compared to (`--compare=`), and relative increases of time, peak RSS and traffic from which a measure regresses.
+inline std::string save_baseline_path;
+inline std::string compare_baseline_path;
+const RegressionThresholds regression_thresholds{0.05, 0.10, 0.01};
+
+// latency histograms of the online evaluations (`--latency=`): seconds between two exports of the histograms to the log.
+const double latency_export_interval_s = 1;
+
+// fraction of the online outputs cross-checked against a direct evaluation from the key, in every build type.
+// can be overridden with `--verify-rate=`.
+inline double verify_rate = 0.001;
+
+// number of upcoming rounds whose pool data is prefetched when a round is reserved (0 disables prefetching).
+// can be overridden with `--prefetch=`, up to `max_prefetch_rounds`, beyond which the prefetched rounds would evict those in use from L2.
+inline uint prefetch_rounds = 2;
+const uint max_prefetch_rounds = 64;
+
+// how the two parties of a phase are connected: over TCP on localhost, with a pair of in-process sockets (`--transport=local`) to measure
+// the computation alone, or over TCP through an emulated link (`--link=<latency ms>,<Mbit/s>`, see link.h) to measure network-bound phases.
+enum class Transport
+{
+    Tcp,
+    Local,
+    Link,
+};
+inline Transport transport = Transport::Tcp;
+inline double link_latency_ms = 0;
+inline double link_mbps = 0;
+
+// whether the traffic of the sub-protocols of the preprocessing phases is logged after the benchmarks (see subprotocol.h).
+// can be enabled with `--subprotocols`; flights are only counted over the emulated link.
+inline bool subprotocol_report = false;
+
+// parameter sweep (`--sweep=`): growth of a cost between two consecutive points, beyond its expected scaling, from which it is reported
+// as superlinear, and share of the physical memory that the pools of the online measures may take.
+const double sweep_max_growth = 0.25;
+const double sweep_memory_share = 0.5;
+
+// number of evaluations timed at every point of a sweep, at most `tau`
+const uint sweep_online_evals = 1 << 14;
+
+// Sets the parameters of the next measures. `new_lg_delta` sets `lg_p` to `lg_q - new_lg_delta`.
+void set_params(uint new_n, uint new_tau, uint new_lg_delta, uint new_kappa);
+
+// The emulated link the connections go through, started on first use, or nullptr unless the transport is `Transport::Link`.
+const LinkEmulator *link_emulator();
+
+// Connects to the other party of a phase over the current transport, as the party that listens if `server`.
+coproto::Socket connect_party(bool server);
+
+// Samples the server key.
+osuCrypto::BitVector sample_key();
+
+// Connects a client and a server over the current transport, and runs `server(sock)` in a new thread and `client(sock)` in the calling thread.
+// The server's end stays open until the client is done, so that the last message of the server is not lost with in-process sockets.
+// Once both are done, rethrows the exception of the client, or else of the server, if either failed.
+template <typename Client, typename Server>
+void run_client_server(Client client, Server server)
+{
+    coproto::Socket server_sock;
+    std::exception_ptr server_error;
+    auto server_thread = std::thread([&]
+                                     {
+       set_trace_thread_name("server");
+       try {
+          server_sock = connect_party(true);
+          server(server_sock);
+       } catch (...) {
+          server_error = std::current_exception();
+       } });
+
+    std::exception_ptr client_error;
+    try
+    {
+        auto sock = connect_party(false);
+        client(sock);
+    }
+    catch (...)
+    {
+        client_error = std::current_exception();
+    }
+    server_thread.join();
+
+    if (client_error)
+    {
+        std::rethrow_exception(client_error);
+    }
+    if (server_error)
+    {
+        std::rethrow_exception(server_error);
+    }
+}
+
+// written to by benchmarks so that the measured calls cannot be optimized away
+extern volatile uint benchmark_sink;
+
+// What the records of the measures made with the current parameters have in common (see results.h).
+ResultContext result_context();
+
+bool results_as_csv();
+
+// Writes every measure recorded so far to `results_path`, if set.
+void save_results();
+
+// Saves the measures of this run as a baseline to `save_baseline_path`, and compares them to the baseline at `compare_baseline_path`, if set.
+// Returns 4 if a measure regressed, 1 if a baseline cannot be read or written, and 0 otherwise.
+int check_baseline();
+
+// Logs the communication of one evaluation: the communication complexity of the paper, and the packed messages.
+// `uid` and `ctr` are not part of the messages; they are sent once per batch in the headers of the batched sessions.
+void log_wire_budget(const OprfParams &params);
+
+// Logs the bytes of the online sessions of a client per evaluation, split into the payload counted by the formula, the padding of the
+// packed values, the headers of the batches and the framing of the transport, i.e. what the socket counted beyond the messages.
+// Warns if they exceed the formula by more than `online_overhead_budget`.
+void log_wire_bytes(const OprfParams &params, const WireBytes &wire, uint64_t socket_sent, uint64_t socket_received);
+
+// Preprocessing benchmarks (mode_preprocess.cpp).
+void run_alt_preproc();
+void benchmark_alt_preproc();
+
+// Microbenchmarks of the online kernels and of the coroutine frames (mode_bench.cpp).
+void benchmark_online_kernels();
+void benchmark_coroutine_frames();
+
+// Parameter sweep (mode_sweep.cpp).
+int run_sweep(const std::string &parameter, std::vector<uint> values);
+
+// Bulk evaluation of a file of records (mode_bulk.cpp).
+int run_bulk(const std::string &input_path, const std::string &output_path, bool direct);
+
+// PSI and membership lookups (mode_psi.cpp).
+void run_psi(uint lg_size);
+bool lookup_size_valid(uint lg_size);
+void run_lookup(uint lg_size);
+
+// Multi-tenant server and load generator (mode_tenants.cpp).
+int run_tenants(uint users);
+int run_load(uint users);
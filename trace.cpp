@@ -0,0 +1,187 @@
+#include "trace.h"
+#include "log.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace trace_detail
+{
+
+std::atomic<bool> enabled{false};
+
+namespace
+{
+
+// Ring of spans of one thread at a time: `head` counts the spans ever recorded and is only written by the owning thread.
+struct Ring
+{
+    // A thread that recorded to the ring, from its span `first` on.
+    struct Owner
+    {
+        uint64_t first;
+        size_t tid;
+        std::string name;
+    };
+
+    std::unique_ptr<Event[]> events{new Event[trace_ring_events]};
+    std::atomic<uint64_t> head{0};
+
+    // in the order they took the ring, the last one being the current one; guarded by `registry_mutex`
+    std::vector<Owner> owners;
+};
+
+std::mutex registry_mutex;
+std::vector<std::unique_ptr<Ring>> registry;
+
+// Rings of threads that exited, handed to the next threads that trace, so that there are only as many rings as threads tracing at once.
+// Their spans are still written, under the thread that recorded them, until the new owner overwrites them.
+std::vector<Ring *> spare_rings;
+size_t num_threads = 0;
+
+// Gives the ring of a thread back when the thread exits.
+struct RingOwner
+{
+    Ring *ring = nullptr;
+
+    ~RingOwner()
+    {
+        if (ring)
+        {
+            std::lock_guard<std::mutex> lock(registry_mutex);
+            spare_rings.push_back(ring);
+            ring = nullptr;
+        }
+    }
+};
+
+Ring &thread_ring()
+{
+    thread_local RingOwner owner;
+    if (!owner.ring)
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        if (spare_rings.empty())
+        {
+            registry.push_back(std::make_unique<Ring>());
+            owner.ring = registry.back().get();
+        }
+        else
+        {
+            owner.ring = spare_rings.back();
+            spare_rings.pop_back();
+        }
+
+        // forgets the owners whose spans have all been overwritten
+        Ring &ring = *owner.ring;
+        uint64_t head = ring.head.load(std::memory_order_relaxed);
+        while (ring.owners.size() > 1 && ring.owners[1].first + trace_ring_events <= head)
+        {
+            ring.owners.erase(ring.owners.begin());
+        }
+        ring.owners.push_back({head, num_threads, "thread " + std::to_string(num_threads + 1)});
+        num_threads++;
+    }
+    return *owner.ring;
+}
+
+// TSC and steady clock when tracing started
+uint64_t start_tsc;
+std::chrono::steady_clock::time_point start_time;
+
+}
+
+void record(const char *name, uint64_t begin, uint64_t end)
+{
+    Ring &ring = thread_ring();
+    uint64_t head = ring.head.load(std::memory_order_relaxed);
+    ring.events[head & (trace_ring_events - 1)] = {name, begin, end};
+    ring.head.store(head + 1, std::memory_order_release);
+}
+
+}
+
+void set_trace_thread_name(const std::string &name)
+{
+    using namespace trace_detail;
+
+    if (!trace_enabled())
+    {
+        return;
+    }
+
+    Ring &ring = thread_ring();
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    ring.owners.back().name = name;
+}
+
+void TraceSession::start(const std::string &trace_path)
+{
+    using namespace trace_detail;
+
+    path = trace_path;
+    start_time = std::chrono::steady_clock::now();
+    start_tsc = __rdtsc();
+    enabled = true;
+}
+
+// Writes the spans of every thread as complete ("X") events, with one metadata event naming each thread.
+// The traced work must be done: spans recorded while the trace is written may be torn.
+TraceSession::~TraceSession()
+{
+    using namespace trace_detail;
+
+    if (path.empty())
+    {
+        return;
+    }
+    enabled = false;
+
+    double elapsed_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start_time).count();
+    double ticks_per_us = (__rdtsc() - start_tsc) / elapsed_us;
+    auto us = [&](uint64_t tsc)
+    { return (static_cast<double>(tsc) - static_cast<double>(start_tsc)) / ticks_per_us; };
+
+    std::ofstream out(path);
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    bool first = true;
+    uint64_t dropped = 0;
+
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    for (const std::unique_ptr<Ring> &ring : registry)
+    {
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t count = std::min<uint64_t>(head, trace_ring_events);
+        dropped += head - count;
+
+        for (size_t k = 0; k < ring->owners.size(); k++)
+        {
+            const Ring::Owner &owner = ring->owners[k];
+            out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << owner.tid << ",\"args\":{\"name\":\"" << owner.name
+                << "\"}}";
+            first = false;
+
+            uint64_t end = k + 1 < ring->owners.size() ? ring->owners[k + 1].first : head;
+            for (uint64_t i = std::max(owner.first, head - count); i < end; i++)
+            {
+                const Event &event = ring->events[i & (trace_ring_events - 1)];
+                char line[256];
+                snprintf(line, sizeof(line), ",\n{\"name\":\"%s\",\"cat\":\"oprf\",\"ph\":\"X\",\"pid\":1,\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f}", event.name,
+                         owner.tid, us(event.begin), (event.end - event.begin) / ticks_per_us);
+                out << line;
+            }
+        }
+    }
+    out << "\n]}\n";
+
+    if (!out)
+    {
+        LOG_ERROR("Could not write the trace to {}", path);
+        return;
+    }
+    LOG_INFO("Trace written to {} ({} spans overwritten in full rings)", path, dropped);
+}
@@ -0,0 +1,98 @@
+/*
+Timeline tracing of the protocol, exported in the Chrome trace-event format (chrome://tracing, https://ui.perfetto.dev).
+
+A span is a name and two TSC readings. Each thread writes its spans to a ring of its own, which keeps the last `trace_ring_events` spans,
+so that recording a span costs two `rdtsc` and a store, and nothing when tracing is off. Names must be string literals, since only their
+address is kept. TSC readings are converted to time when the trace is written, from the TSC rate observed over the traced session.
+The ring of a thread that exits goes to the next thread that traces, so that memory is bounded by the number of threads tracing at once.
+
+Spans are recorded with `TRACE_SCOPE(name)` until the end of the enclosing scope, or with `trace_span(name, begin)` from a reading of
+`trace_now()`, e.g. around a `co_await`, after which a coroutine may run on another thread.
+*/
+
+#pragma once
+
+#include <x86intrin.h>
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace trace_detail
+{
+
+struct Event
+{
+    const char *name;
+    uint64_t begin;
+    uint64_t end;
+};
+
+extern std::atomic<bool> enabled;
+
+void record(const char *name, uint64_t begin, uint64_t end);
+
+}
+
+const size_t trace_ring_events = size_t(1) << 16;
+
+inline bool trace_enabled()
+{
+    return trace_detail::enabled.load(std::memory_order_relaxed);
+}
+
+inline uint64_t trace_now()
+{
+    return trace_enabled() ? __rdtsc() : 0;
+}
+
+// Records a span from `begin`, a reading of `trace_now()`, to now.
+inline void trace_span(const char *name, uint64_t begin)
+{
+    if (begin && trace_enabled())
+    {
+        trace_detail::record(name, begin, __rdtsc());
+    }
+}
+
+class TraceSpan
+{
+public:
+    explicit TraceSpan(const char *name) : name(name), begin(trace_now())
+    {
+    }
+
+    ~TraceSpan()
+    {
+        trace_span(name, begin);
+    }
+
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+
+private:
+    const char *name;
+    uint64_t begin;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceSpan TRACE_CONCAT(trace_span_, __LINE__)(name)
+
+// Names the calling thread in the trace, e.g. "receiver", if tracing is on; other threads are numbered.
+void set_trace_thread_name(const std::string &name);
+
+// Traces from `start` until the session ends, and then writes the trace to the given path.
+class TraceSession
+{
+public:
+    TraceSession() = default;
+    ~TraceSession();
+    TraceSession(const TraceSession &) = delete;
+    TraceSession &operator=(const TraceSession &) = delete;
+
+    void start(const std::string &path);
+
+private:
+    std::string path;
+};